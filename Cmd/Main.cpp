@@ -1,58 +1,38 @@
-//
+﻿//
 //    Created: 2019/04/01 01:43
 //     Author: Eugene V. Palchukovsky
 //     E-mail: eugene@palchukovsky.com
 //
 
 #include "Prec.hpp"
-#include "LogReader/LogReader.hpp"
-
-namespace {
-void PrintHelp(const char *exec) {
-  printf(R"(
-Usage:
-  %s "mask" "log file path"
-
-Accepts string with fixed string blocks and the next mask special symbols:
-  ? - Block can have one any symbol or can be empty.
-  * - Block can have several any symbols or can be empty.
-Use slash before special symbols to find special symbols.
-
-Example to match strings "abcXabc*absX" and "abcabc*abs":
-  %s "abc?abc\*abs*" debug.log 
-
-)",
-         exec, exec);
-}
-}  // namespace
+#include "Query.hpp"
+#include "Server.hpp"
+#include "Sink.hpp"
 
 int main(const int argc, const char *argv[]) {
   if (argc < 1) {
     return 1;
   }
-  const auto exec = argv[0];
-  if (argc != 3) {
-    PrintHelp(exec);
-    return 1;
+  if (argc == 3 && !strcmp(argv[1], "--serve")) {
+    return Serve(argv[2]);
   }
-  const auto mask = argv[1];
-  const auto filePath = argv[2];
-
-  LogReader reader;
-  if (!reader.Open(filePath)) {
-    printf(R"(Filed to open file \"%s\".\n)", filePath);
-    return 1;
+  if (argc >= 3 && !strcmp(argv[1], "--connect")) {
+    // The server gets the query with the executable name.
+    const auto pipeName = argv[2];
+    argv[2] = argv[0];
+    return Connect(pipeName, argc - 2, argv + 2);
   }
-  if (!reader.SetFilter(mask)) {
-    printf(R"(Failed to parse mask "%s".\n)", mask);
-    PrintHelp(exec);
+  Output console;
+  Output errors;
+  if (!console.Open(nullptr) || !errors.OpenError()) {
     return 1;
   }
-
-  char buffer[1024 * 10];
-  while (reader.GetNextLine(&buffer[0], sizeof(buffer))) {
-    printf("%s\n", &buffer[0]);
+  if (argc == 4 && !strcmp(argv[1], "--compress")) {
+    if (!LogReader::CompressFile(argv[2], argv[3])) {
+      errors.Print("Failed to compress file \"%s\".\n", argv[2]);
+      return 1;
+    }
+    return 0;
   }
-
-  return 0;
-}  // namespace
+  return RunQuery(argc, argv, console, errors, nullptr, nullptr);
+}
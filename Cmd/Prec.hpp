@@ -6,4 +6,10 @@
 
 #pragma once
 
+#include <Windows.h>
+#include <Psapi.h>
+#include <cstdarg>
+#include <cstdint>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
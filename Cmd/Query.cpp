@@ -0,0 +1,847 @@
+﻿//
+//    Created: 2019/04/25 14:05
+//     Author: Eugene V. Palchukovsky
+//     E-mail: eugene@palchukovsky.com
+//
+
+#include "Prec.hpp"
+#include "Query.hpp"
+#include "LogReader/MergedLogReader.hpp"
+#include "Sink.hpp"
+
+namespace {
+//! Option of the query, has to be in sync with RunQuery arguments parsing.
+struct Option {
+  const char *name;
+  bool hasValue;
+};
+
+const Option options[] = {
+    {"--from", true},         {"--to", true},          {"-A", true},
+    {"-B", true},             {"-C", true},            {"-n", false},
+    {"-b", false},            {"--build-index", false}, {"--expression", false},
+    {"--utf8", false},        {"--stats", false},      {"--record-start", true},
+    {"--read-ahead", true},   {"--scan-once", true},   {"--match-limit", true},
+    {"--templates", true},    {"--fields", false},     {"--estimate", true},
+    {"--format", true},       {"--output", true}};
+
+//! Returns the option or nullptr if the argument is not an option.
+const Option *FindOption(const char *arg) {
+  for (const auto &option : options) {
+    if (!strcmp(arg, option.name)) {
+      return &option;
+    }
+  }
+  return nullptr;
+}
+
+void PrintHelp(Output &console, const char *exec) {
+  console.Print(R"(
+Usage:
+  %s [options] "mask" "log file path" ["log file path" ...]
+
+  %s --serve "pipe name"
+  %s --connect "pipe name" [options] "mask" "log file path" ...
+  %s --compress "log file path" "archive path"
+
+Records of several files are merged in order of timestamps at the records
+begin and are prefixed by the file path.
+
+The server keeps compiled masks, mappings of 16 files and results of queries
+between queries, which are sent by clients over the local named pipe. A
+mapped file can't be truncated by its writer while it's kept. Queries of
+several clients are executed concurrently, records are sent back to the
+client. Concurrent queries of one file without time range, context,
+--match-limit, --templates, --estimate, --stats and --scan-once read it
+together by one pass. A query, which is started while other such queries
+read the file, gets records from the pass position to the file end and then
+from the file begin. Relative log file paths are resolved by the client. The
+server doesn't accept --output and --build-index.
+
+The compressed archive is read as a log file, its blocks are decompressed to
+memory in parallel while they are read, without a temporary file.
+
+Options:
+  --expression           The mask is a boolean expression of masks in double
+                         quotes with AND, OR, NOT and parentheses, like
+                         "\"*ERROR*\" AND NOT \"*healthcheck*\"".
+  --from "time"          Skip records earlier than the time.
+  --to "time"            Stop at the first record not earlier than the time.
+  -A "number"            Print number of records after each matched record.
+  -B "number"            Print number of records before each matched record.
+  -C "number"            Print number of records before and after each matched
+                         record.
+  -n                     Print line number before each record.
+  -b                     Print byte offset before each record.
+  --stats                Print reading and matching counters, the process
+                         working set and the system file cache with changes
+                         by the query at the end.
+  --record-start "mask"  Start records only at lines which begin with a string
+                         matching the mask, other lines continue the previous
+                         record (like stack traces).
+  --read-ahead "number"  Request the number of megabytes after the reading
+                         position from the disk in advance (4 by default).
+  --scan-once "number"   Keep in memory only the number of megabytes before
+                         the reading position and read with the very low
+                         memory priority, so a scan of large files doesn't
+                         push out memory of other processes.
+  --build-index          Build skip index of the log file (near the file with
+                         ".lri" extension) to skip parts of the file without
+                         the mask fixed strings in next searches.
+  --utf8                 Count "?" by UTF-8 symbols instead of bytes.
+  --match-limit "number" Skip records which check by the mask takes more steps
+                         than the number.
+  --format "format"      Output format:
+                           raw - records as is (by default);
+                           json - JSON object with file, offset, line,
+                             matched and text fields for each record on a
+                             separate line;
+                           binary - "LRRB" and 32-bit version 2, then for each
+                             record 64-bit offset, 64-bit line, 64-bit size
+                             and 32-bit flags (1 - matched, 2 - gap), only
+                             for one file.
+  --templates "number"   Print the number of the most frequent shapes of
+                         matched records, where numbers, hex numbers and UUIDs
+                         are replaced by placeholders, instead of records.
+  --fields               Print parts of matched records, which are matched by
+                         "*" and "?" groups of the mask, separated by tabs
+                         instead of records text (raw format), or as "fields"
+                         array (json format).
+  --estimate "number"    Print estimated number of matched records by the
+                         number of random samples instead of records.
+  --output "file path"   Write records to the file instead of the standard
+                         output.
+Time format: "YYYY-MM-DD HH:MM[:SS[.FFFFFF]]" or "HH:MM[:SS[.FFFFFF]]". Records
+are expected to be written in time order.
+
+Accepts string with fixed string blocks and the next mask special symbols:
+  ? - Block can have one any symbol or can be empty.
+  * - Block can have several any symbols or can be empty.
+Use slash before special symbols to find special symbols.
+
+Example to match strings "abcXabc*absX" and "abcabc*abs":
+  %s "abc?abc\*abs*" debug.log 
+
+)",
+                exec, exec, exec, exec, exec);
+}
+
+//! Writes the most frequent templates of matched records of all files as
+//! lines with number of records and template.
+bool WriteTemplates(MergedLogReader &readers,
+                    const size_t number,
+                    Output &output,
+                    bool &isWritten) {
+  const auto templates = static_cast<LogReader::Template *>(
+      malloc(number * sizeof(LogReader::Template)));
+  auto &reader = readers.GetReader(0);
+  auto isAggregated = templates && reader.AggregateTemplates();
+  for (size_t i = 1; isAggregated && i < readers.GetFilesNumber(); ++i) {
+    isAggregated = readers.GetReader(i).AggregateTemplates() &&
+                   reader.MergeTemplates(readers.GetReader(i));
+  }
+  if (!isAggregated) {
+    free(templates);
+    return false;
+  }
+  const auto size = reader.GetTopTemplates(templates, number);
+  for (size_t i = 0; i < size && isWritten; ++i) {
+    char count[24];
+    const auto len =
+        snprintf(count, sizeof(count), "%llu\t", templates[i].recordsNumber);
+    isWritten = output.Write(count, static_cast<size_t>(len)) &&
+                output.Write(templates[i].begin,
+                             static_cast<size_t>(templates[i].end -
+                                                 templates[i].begin)) &&
+                output.Write("\n", 1);
+  }
+  free(templates);
+  return true;
+}
+
+//! Returns sum of numbers of records skipped by the match limit of all files
+//! readers.
+size_t GetAbortedRecordsNumber(MergedLogReader &readers) {
+  size_t result = 0;
+  for (size_t i = 0; i < readers.GetFilesNumber(); ++i) {
+    result += readers.GetReader(i).GetAbortedRecordsNumber();
+  }
+  return result;
+}
+
+//! Returns sum of counters of all files readers.
+bool GetStats(MergedLogReader &readers, LogReader::Stats &result) {
+  result = {};
+  for (size_t i = 0; i < readers.GetFilesNumber(); ++i) {
+    LogReader::Stats stats;
+    if (!readers.GetReader(i).GetStats(stats)) {
+      return false;
+    }
+    result.bytesScanned += stats.bytesScanned;
+    result.bytesSkipped += stats.bytesSkipped;
+    result.bytesReleased += stats.bytesReleased;
+    result.recordsRead += stats.recordsRead;
+    result.recordsMatched += stats.recordsMatched;
+    result.quickRejections += stats.quickRejections;
+    result.greedyRetries += stats.greedyRetries;
+    result.literalSearches += stats.literalSearches;
+    result.literalComparisons += stats.literalComparisons;
+  }
+  return true;
+}
+
+//! Sets the memory priority of the current thread, pages which are read by
+//! the thread get it.
+bool SetMemoryPriority(const ULONG priority) {
+  MEMORY_PRIORITY_INFORMATION info;
+  info.MemoryPriority = priority;
+  return SetThreadInformation(GetCurrentThread(), ThreadMemoryPriority, &info,
+                              sizeof(info)) != FALSE;
+}
+
+//! Memory is memory usage of the process and of the system.
+struct Memory {
+  //! Process working set in bytes.
+  long long workingSet;
+  //! System file cache in bytes.
+  long long systemCache;
+};
+
+//! Returns the current memory usage.
+bool GetMemory(Memory &result) {
+  PROCESS_MEMORY_COUNTERS process;
+  PERFORMANCE_INFORMATION system;
+  if (!GetProcessMemoryInfo(GetCurrentProcess(), &process, sizeof(process)) ||
+      !GetPerformanceInfo(&system, sizeof(system))) {
+    return false;
+  }
+  result.workingSet = static_cast<long long>(process.WorkingSetSize);
+  result.systemCache =
+      static_cast<long long>(system.SystemCache * system.PageSize);
+  return true;
+}
+}  // namespace
+
+struct ReaderCache::Entry {
+  LogReader reader;
+  char *filter;
+  bool isExpression;
+  bool isUtf8;
+  //! Record start mask or nullptr.
+  char *recordStart;
+  bool isConfigured;
+  Entry *next;
+};
+
+ReaderCache::~ReaderCache() {
+  Entry *const lists[] = {m_released, m_acquired};
+  for (auto entry : lists) {
+    while (entry) {
+      const auto next = entry->next;
+      Destroy(entry);
+      entry = next;
+    }
+  }
+}
+
+LogReader *ReaderCache::Acquire(const char *filter,
+                                const bool isExpression,
+                                const bool isUtf8,
+                                const char *recordStart,
+                                bool &isConfigured) {
+  AcquireSRWLockExclusive(&m_lock);
+  for (auto link = &m_released; *link; link = &(*link)->next) {
+    const auto entry = *link;
+    if (entry->isExpression != isExpression || entry->isUtf8 != isUtf8 ||
+        strcmp(entry->filter, filter) ||
+        (entry->recordStart && recordStart
+             ? strcmp(entry->recordStart, recordStart) != 0
+             : entry->recordStart != recordStart)) {
+      continue;
+    }
+    *link = entry->next;
+    --m_releasedNumber;
+    entry->next = m_acquired;
+    m_acquired = entry;
+    ReleaseSRWLockExclusive(&m_lock);
+    isConfigured = true;
+    return &entry->reader;
+  }
+  ReleaseSRWLockExclusive(&m_lock);
+
+  // One allocation for the entry and masks.
+  const auto filterSize = strlen(filter) + 1;
+  const auto recordStartSize = recordStart ? strlen(recordStart) + 1 : 0;
+  const auto buffer = static_cast<char *>(
+      malloc(sizeof(Entry) + filterSize + recordStartSize));
+  if (!buffer) {
+    return nullptr;
+  }
+  const auto entry = new (buffer) Entry();
+  entry->filter = buffer + sizeof(Entry);
+  memcpy(entry->filter, filter, filterSize);
+  if (recordStart) {
+    entry->recordStart = entry->filter + filterSize;
+    memcpy(entry->recordStart, recordStart, recordStartSize);
+  }
+  entry->isExpression = isExpression;
+  entry->isUtf8 = isUtf8;
+  entry->reader.SetResultCaching(true);
+  AcquireSRWLockExclusive(&m_lock);
+  entry->next = m_acquired;
+  m_acquired = entry;
+  ReleaseSRWLockExclusive(&m_lock);
+  isConfigured = false;
+  return &entry->reader;
+}
+
+void ReaderCache::SetConfigured(const LogReader &reader) {
+  AcquireSRWLockExclusive(&m_lock);
+  const auto link = Find(&m_acquired, reader);
+  if (link) {
+    (*link)->isConfigured = true;
+  }
+  ReleaseSRWLockExclusive(&m_lock);
+}
+
+void ReaderCache::Release(LogReader &reader) {
+  // The acquired reader is used only by its query, so it's closed without
+  // lock.
+  reader.Close();
+  reader.ResetTemplates();
+  AcquireSRWLockExclusive(&m_lock);
+  const auto link = Find(&m_acquired, reader);
+  if (!link) {
+    ReleaseSRWLockExclusive(&m_lock);
+    return;
+  }
+  const auto entry = *link;
+  *link = entry->next;
+  Entry *evicted = nullptr;
+  if (!entry->isConfigured) {
+    evicted = entry;
+  } else {
+    entry->next = m_released;
+    m_released = entry;
+    if (++m_releasedNumber > defaultSize) {
+      auto last = &m_released;
+      for (; (*last)->next; last = &(*last)->next) {
+      }
+      evicted = *last;
+      *last = nullptr;
+      --m_releasedNumber;
+    }
+  }
+  ReleaseSRWLockExclusive(&m_lock);
+  if (evicted) {
+    Destroy(evicted);
+  }
+}
+
+void ReaderCache::Destroy(Entry *entry) {
+  entry->~Entry();
+  free(entry);
+}
+
+ReaderCache::Entry **ReaderCache::Find(Entry **list, const LogReader &reader) {
+  for (; *list; list = &(*list)->next) {
+    if (&(*list)->reader == &reader) {
+      return list;
+    }
+  }
+  return nullptr;
+}
+
+struct ScanCache::Entry {
+  SharedScan scan;
+  char *filePath;
+  bool isUtf8;
+  //! Record start mask or nullptr.
+  char *recordStart;
+  //! Number of queries of the file, which read it by the scan or by own
+  //! readers.
+  size_t queriesNumber;
+  //! Number of queries, which read the file by the scan.
+  size_t sharedQueriesNumber;
+  Entry *next;
+};
+
+ScanCache::~ScanCache() {
+  while (m_entries) {
+    const auto next = m_entries->next;
+    Destroy(m_entries);
+    m_entries = next;
+  }
+}
+
+SharedScan *ScanCache::Acquire(const char *filePath,
+                               const bool isUtf8,
+                               const char *recordStart,
+                               bool &isShared) {
+  AcquireSRWLockExclusive(&m_lock);
+  struct Scope {
+    SRWLOCK &lock;
+    ~Scope() { ReleaseSRWLockExclusive(&lock); }
+  } scope{m_lock};  // NOLINT
+  auto entry = m_entries;
+  for (; entry; entry = entry->next) {
+    if (entry->isUtf8 == isUtf8 && !strcmp(entry->filePath, filePath) &&
+        (entry->recordStart && recordStart
+             ? !strcmp(entry->recordStart, recordStart)
+             : entry->recordStart == recordStart)) {
+      break;
+    }
+  }
+  if (!entry) {
+    // One allocation for the entry and strings.
+    const auto filePathSize = strlen(filePath) + 1;
+    const auto recordStartSize = recordStart ? strlen(recordStart) + 1 : 0;
+    const auto buffer = static_cast<char *>(
+        malloc(sizeof(Entry) + filePathSize + recordStartSize));
+    if (!buffer) {
+      return nullptr;
+    }
+    entry = new (buffer) Entry();
+    entry->filePath = buffer + sizeof(Entry);
+    memcpy(entry->filePath, filePath, filePathSize);
+    if (recordStart) {
+      entry->recordStart = entry->filePath + filePathSize;
+      memcpy(entry->recordStart, recordStart, recordStartSize);
+    }
+    entry->isUtf8 = isUtf8;
+    if (!entry->scan.SetUtf8(isUtf8) ||
+        !entry->scan.SetRecordStart(recordStart)) {
+      Destroy(entry);
+      return nullptr;
+    }
+    entry->next = m_entries;
+    m_entries = entry;
+  }
+  // The scan is opened by the first query of the file, so it reads the file
+  // as it's at the time, and concurrent queries join its pass. A query, which
+  // fails to open the file, reads it by its own reader to report the error.
+  isShared = entry->sharedQueriesNumber || entry->scan.Open(filePath);
+  ++entry->queriesNumber;
+  if (isShared) {
+    ++entry->sharedQueriesNumber;
+  }
+  return &entry->scan;
+}
+
+void ScanCache::Release(SharedScan &scan, const bool isShared) {
+  AcquireSRWLockExclusive(&m_lock);
+  auto link = &m_entries;
+  for (; *link && &(*link)->scan != &scan; link = &(*link)->next) {
+  }
+  const auto entry = *link;
+  if (!entry) {
+    ReleaseSRWLockExclusive(&m_lock);
+    return;
+  }
+  if (isShared && !--entry->sharedQueriesNumber) {
+    entry->scan.Close();
+  }
+  if (--entry->queriesNumber) {
+    ReleaseSRWLockExclusive(&m_lock);
+    return;
+  }
+  *link = entry->next;
+  ReleaseSRWLockExclusive(&m_lock);
+  Destroy(entry);
+}
+
+void ScanCache::Destroy(Entry *entry) {
+  entry->~Entry();
+  free(entry);
+}
+
+int RunQuery(const int argc,
+             const char *const argv[],
+             Output &console,
+             Output &errors,
+             ReaderCache *cache,
+             ScanCache *scans) {
+  if (argc < 1) {
+    return 1;
+  }
+  const auto exec = argv[0];
+  const char *mask = nullptr;
+  const auto filePaths =
+      static_cast<const char **>(malloc(argc * sizeof(const char *)));
+  if (!filePaths) {
+    return 1;
+  }
+  // Cached readers are released after the merged reader.
+  struct Scope {
+    const char **filePaths;
+    ReaderCache *cache;
+    LogReader **cachedReaders;
+    size_t cachedReadersNumber;
+    ~Scope() {
+      for (size_t i = 0; i < cachedReadersNumber; ++i) {
+        cache->Release(*cachedReaders[i]);
+      }
+      free(cachedReaders);
+      free(filePaths);
+    }
+  } scope{filePaths, cache, nullptr, 0};  // NOLINT
+  if (cache) {
+    scope.cachedReaders =
+        static_cast<LogReader **>(malloc(argc * sizeof(LogReader *)));
+    if (!scope.cachedReaders) {
+      return 1;
+    }
+  }
+  size_t filesNumber = 0;
+  const char *from = nullptr;
+  const char *to = nullptr;
+  const char *recordStart = nullptr;
+  const char *format = "raw";
+  const char *outputPath = nullptr;
+  size_t before = 0;
+  size_t after = 0;
+  auto isLineNumberPrinted = false;
+  auto isOffsetPrinted = false;
+  auto isStatsPrinted = false;
+  auto isIndexBuilt = false;
+  auto isUtf8 = false;
+  auto isExpression = false;
+  auto isCapturing = false;
+  size_t matchLimit = 0;
+  size_t templatesNumber = 0;
+  size_t samplesNumber = 0;
+  size_t readAhead = 4 * 1024 * 1024;
+  size_t residentLimit = 0;
+  for (auto i = 1; i < argc; ++i) {
+    const auto arg = argv[i];
+    if (!strcmp(arg, "--from") && i + 1 < argc) {
+      from = argv[++i];
+    } else if (!strcmp(arg, "--to") && i + 1 < argc) {
+      to = argv[++i];
+    } else if (!strcmp(arg, "-A") && i + 1 < argc) {
+      after = strtoul(argv[++i], nullptr, 10);
+    } else if (!strcmp(arg, "-B") && i + 1 < argc) {
+      before = strtoul(argv[++i], nullptr, 10);
+    } else if (!strcmp(arg, "-C") && i + 1 < argc) {
+      before = after = strtoul(argv[++i], nullptr, 10);
+    } else if (!strcmp(arg, "-n")) {
+      isLineNumberPrinted = true;
+    } else if (!strcmp(arg, "-b")) {
+      isOffsetPrinted = true;
+    } else if (!strcmp(arg, "--build-index")) {
+      isIndexBuilt = true;
+    } else if (!strcmp(arg, "--expression")) {
+      isExpression = true;
+    } else if (!strcmp(arg, "--utf8")) {
+      isUtf8 = true;
+    } else if (!strcmp(arg, "--stats")) {
+      isStatsPrinted = true;
+    } else if (!strcmp(arg, "--record-start") && i + 1 < argc) {
+      recordStart = argv[++i];
+    } else if (!strcmp(arg, "--read-ahead") && i + 1 < argc) {
+      readAhead = strtoul(argv[++i], nullptr, 10) * 1024 * 1024;
+    } else if (!strcmp(arg, "--scan-once") && i + 1 < argc) {
+      residentLimit = strtoul(argv[++i], nullptr, 10) * 1024 * 1024;
+    } else if (!strcmp(arg, "--match-limit") && i + 1 < argc) {
+      matchLimit = strtoul(argv[++i], nullptr, 10);
+    } else if (!strcmp(arg, "--templates") && i + 1 < argc) {
+      templatesNumber = strtoul(argv[++i], nullptr, 10);
+    } else if (!strcmp(arg, "--fields")) {
+      isCapturing = true;
+    } else if (!strcmp(arg, "--estimate") && i + 1 < argc) {
+      samplesNumber = strtoul(argv[++i], nullptr, 10);
+    } else if (!strcmp(arg, "--format") && i + 1 < argc) {
+      format = argv[++i];
+    } else if (!strcmp(arg, "--output") && i + 1 < argc) {
+      outputPath = argv[++i];
+    } else if (!mask) {
+      mask = arg;
+    } else {
+      filePaths[filesNumber++] = arg;
+    }
+  }
+  if (!filesNumber) {
+    PrintHelp(console, exec);
+    return 1;
+  }
+  // Paths are resolved by the server process, which may have other rights.
+  if (cache && (outputPath || isIndexBuilt)) {
+    errors.Print("Options --output and --build-index are not accepted by "
+                 "the server.\n");
+    return 1;
+  }
+
+  // A query, which only filters records of one file, reads the file together
+  // with concurrent queries of the file. The query is detached and the scan
+  // is released after readers of the query.
+  struct ScanScope {
+    ScanCache *scans;
+    SharedScan *scan;
+    bool isShared;
+    bool isAttached;
+    size_t query;
+    ~ScanScope() {
+      if (isAttached) {
+        scan->Detach(query);
+      }
+      if (scan) {
+        scans->Release(*scan, isShared);
+      }
+    }
+  } scanScope{scans, nullptr, false, false, 0};  // NOLINT
+  if (scans && filesNumber == 1 && !from && !to && !before && !after &&
+      !matchLimit && !templatesNumber && !samplesNumber && !isStatsPrinted &&
+      !residentLimit) {
+    scanScope.scan =
+        scans->Acquire(filePaths[0], isUtf8, recordStart, scanScope.isShared);
+  }
+  const auto sharedScan = scanScope.isShared ? scanScope.scan : nullptr;
+  if (sharedScan) {
+    if (!sharedScan->Attach(mask, isExpression, scanScope.query)) {
+      errors.Print("Failed to parse mask \"%s\".\n", mask);
+      PrintHelp(console, exec);
+      return 1;
+    }
+    scanScope.isAttached = true;
+    sharedScan->SetLineNumbering(scanScope.query, isLineNumberPrinted);
+    if (!sharedScan->SetCapturing(scanScope.query, isCapturing)) {
+      errors.Print("Failed to set capturing.\n");
+      return 1;
+    }
+  }
+
+  // Files are read from the opening, so memory is measured before it.
+  Memory initialMemory;
+  const auto hasMemory = GetMemory(initialMemory);
+
+  MergedLogReader readers;
+  for (size_t i = 0; !sharedScan && i < filesNumber; ++i) {
+    const auto filePath = filePaths[i];
+    if (isIndexBuilt && !LogReader::BuildIndex(filePath)) {
+      errors.Print("Failed to build index of file \"%s\".\n", filePath);
+      return 1;
+    }
+
+    LogReader *reader;
+    auto isConfigured = false;
+    if (cache) {
+      reader =
+          cache->Acquire(mask, isExpression, isUtf8, recordStart, isConfigured);
+      if (!reader) {
+        errors.Print("Failed to create reader.\n");
+        return 1;
+      }
+      scope.cachedReaders[scope.cachedReadersNumber++] = reader;
+      if (!reader->Open(filePath) || !readers.Open(*reader)) {
+        errors.Print("Failed to open file \"%s\".\n", filePath);
+        return 1;
+      }
+    } else {
+      if (!readers.Open(filePath, nullptr)) {
+        errors.Print("Failed to open file \"%s\".\n", filePath);
+        return 1;
+      }
+      reader = &readers.GetReader(i);
+    }
+    if (!isConfigured) {
+      reader->SetUtf8(isUtf8);
+      if (isExpression ? !reader->SetFilterExpression(mask)
+                       : !reader->SetFilter(mask)) {
+        errors.Print("Failed to parse mask \"%s\".\n", mask);
+        PrintHelp(console, exec);
+        return 1;
+      }
+      if (recordStart && !reader->SetRecordStart(recordStart)) {
+        errors.Print("Failed to parse record start mask \"%s\".\n",
+                     recordStart);
+        PrintHelp(console, exec);
+        return 1;
+      }
+      if (cache) {
+        cache->SetConfigured(*reader);
+      }
+    }
+    if ((from || to) && !reader->SetTimeRange(from, to)) {
+      errors.Print("Failed to parse time range.\n");
+      PrintHelp(console, exec);
+      return 1;
+    }
+
+    // The cached reader has the context of the previous query.
+    if ((before || after || isConfigured) &&
+        !reader->SetContext(before, after)) {
+      errors.Print("Failed to set context.\n");
+      return 1;
+    }
+
+    reader->SetLineNumbering(isLineNumberPrinted);
+    reader->SetCapturing(isCapturing);
+    reader->SetMatchLimit(matchLimit);
+    reader->SetReadAhead(readAhead);
+    reader->SetScanOnce(residentLimit);
+    reader->SetStatsCounting(isStatsPrinted);
+  }
+
+  if (samplesNumber) {
+    for (size_t i = 0; i < filesNumber; ++i) {
+      LogReader::Estimate estimate;
+      if (!readers.GetReader(i).EstimateMatches(samplesNumber, estimate)) {
+        errors.Print("Failed to estimate matched records.\n");
+        return 1;
+      }
+      if (filesNumber > 1) {
+        console.Print("%s:\n", filePaths[i]);
+      }
+      console.Print(
+          "Records: %.0f\n"
+          "Matched records: %.0f (95%% confidence interval: %.0f - %.0f)\n",
+          estimate.recordsNumber, estimate.matchesNumber,
+          estimate.matchesLowerBound, estimate.matchesUpperBound);
+    }
+    return 0;
+  }
+
+  Output file;
+  auto &output = outputPath ? file : console;
+  RawSink rawSink(output, isLineNumberPrinted, isOffsetPrinted);
+  JsonSink jsonSink(output, filePaths[0], isLineNumberPrinted);
+  BinarySink binarySink(output);
+  Sink *sink;
+  if (!strcmp(format, "raw")) {
+    sink = &rawSink;
+  } else if (!strcmp(format, "json")) {
+    sink = &jsonSink;
+  } else if (!strcmp(format, "binary") && filesNumber == 1) {
+    sink = &binarySink;
+  } else {
+    errors.Print("Unknown output format \"%s\" for %zu files.\n", format,
+                 filesNumber);
+    PrintHelp(console, exec);
+    return 1;
+  }
+  if (outputPath && !file.Open(outputPath)) {
+    errors.Print("Failed to open output \"%s\".\n", outputPath);
+    return 1;
+  }
+
+  // Cached readers have counters of previous queries.
+  const auto initialAbortedRecordsNumber = GetAbortedRecordsNumber(readers);
+  LogReader::Stats initialStats;
+  const auto hasStats = GetStats(readers, initialStats);
+
+  // Pages of the scan get the lowest priority in the system cache, so they are
+  // repurposed before pages of other processes. The server thread gets its
+  // priority back after the query.
+  struct PriorityScope {
+    MEMORY_PRIORITY_INFORMATION previous;
+    bool isLowered;
+    ~PriorityScope() {
+      if (isLowered) {
+        SetMemoryPriority(previous.MemoryPriority);
+      }
+    }
+  } priorityScope{};  // NOLINT
+  priorityScope.isLowered =
+      residentLimit &&
+      GetThreadInformation(GetCurrentThread(), ThreadMemoryPriority,
+                           &priorityScope.previous,
+                           sizeof(priorityScope.previous)) &&
+      SetMemoryPriority(MEMORY_PRIORITY_VERY_LOW);
+
+  auto isWritten = true;
+  if (templatesNumber) {
+    if (!WriteTemplates(readers, templatesNumber, output, isWritten)) {
+      errors.Print("Failed to aggregate records.\n");
+      return 1;
+    }
+  } else {
+    isWritten = sink->Start();
+    LogReader::Record record;
+    if (sharedScan) {
+      while (isWritten && sharedScan->GetNextRecord(scanScope.query, record)) {
+        isWritten = sink->Write(record);
+      }
+    } else if (filesNumber == 1) {
+      auto &reader = readers.GetReader(0);
+      while (isWritten && reader.GetNextRecord(record)) {
+        isWritten = sink->Write(record);
+      }
+    } else {
+      size_t fileIndex;
+      while (isWritten && readers.GetNextRecord(record, fileIndex)) {
+        sink->SetFilePath(filePaths[fileIndex]);
+        isWritten = sink->Write(record);
+      }
+    }
+  }
+  if (!output.Flush() || !isWritten) {
+    errors.Print("Failed to write output.\n");
+    return 1;
+  }
+
+  const auto abortedRecordsNumber =
+      GetAbortedRecordsNumber(readers) - initialAbortedRecordsNumber;
+  if (abortedRecordsNumber) {
+    errors.Print("Skipped %zu records by the match limit.\n",
+                 abortedRecordsNumber);
+  }
+
+  if (isStatsPrinted) {
+    LogReader::Stats stats;
+    if (!hasStats || !GetStats(readers, stats)) {
+      errors.Print("Failed to get statistics.\n");
+    } else {
+      errors.Print(
+          "Bytes scanned: %llu\n"
+          "Bytes skipped: %llu\n"
+          "Bytes released: %llu\n"
+          "Records read: %llu\n"
+          "Records matched: %llu\n"
+          "Quick rejections: %llu\n"
+          "Greedy retries: %llu\n"
+          "Literal searches: %llu\n"
+          "Literal comparisons: %llu\n",
+          stats.bytesScanned - initialStats.bytesScanned,
+          stats.bytesSkipped - initialStats.bytesSkipped,
+          stats.bytesReleased - initialStats.bytesReleased,
+          stats.recordsRead - initialStats.recordsRead,
+          stats.recordsMatched - initialStats.recordsMatched,
+          stats.quickRejections - initialStats.quickRejections,
+          stats.greedyRetries - initialStats.greedyRetries,
+          stats.literalSearches - initialStats.literalSearches,
+          stats.literalComparisons - initialStats.literalComparisons);
+    }
+    Memory memory;
+    if (hasMemory && GetMemory(memory)) {
+      errors.Print(
+          "Working set: %lld KB (%+lld KB)\n"
+          "System cache: %lld KB (%+lld KB)\n",
+          memory.workingSet / 1024,
+          (memory.workingSet - initialMemory.workingSet) / 1024,
+          memory.systemCache / 1024,
+          (memory.systemCache - initialMemory.systemCache) / 1024);
+    }
+  }
+
+  return 0;
+}
+
+bool IsQueryFilePath(const int argc,
+                     const char *const argv[],
+                     const int index) {
+  auto isMaskFound = false;
+  for (auto i = 1; i < argc; ++i) {
+    const auto option = FindOption(argv[i]);
+    if (option && (!option->hasValue || i + 1 < argc)) {
+      if (option->hasValue) {
+        ++i;
+      }
+      continue;
+    }
+    if (i == index) {
+      return isMaskFound;
+    }
+    isMaskFound = true;
+  }
+  return false;
+}
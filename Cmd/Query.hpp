@@ -0,0 +1,140 @@
+﻿//
+//    Created: 2019/04/25 13:50
+//     Author: Eugene V. Palchukovsky
+//     E-mail: eugene@palchukovsky.com
+//
+
+#pragma once
+
+#include "LogReader/LogReader.hpp"
+#include "LogReader/SharedScan.hpp"
+
+class Output;
+
+//! ReaderCache keeps readers with compiled filters between queries.
+/**
+ * Readers are found by the filter, the filter type, the UTF-8 mode and the
+ * record start mask. Released readers are kept in the least recently used
+ * order, with the result cache enabled. Methods are thread-safe, an acquired
+ * reader is used only by its query.
+ */
+class ReaderCache {
+ public:
+  //! Default maximum number of released readers.
+  enum : size_t { defaultSize = 32 };
+
+  ReaderCache() = default;
+  ReaderCache(ReaderCache &&) = delete;
+  ReaderCache(const ReaderCache &) = delete;
+  ReaderCache &operator=(ReaderCache &&) = delete;
+  ReaderCache &operator=(const ReaderCache &) = delete;
+  ~ReaderCache();
+
+  //! Acquire returns a released reader for the query or creates a new one.
+  /**
+   * @param[out] isConfigured True if the reader has the filter, the UTF-8
+   * mode and the record start of the query, false if the reader is new and
+   * it has to be configured and marked by SetConfigured.
+   * @return Reader without opened file or nullptr at error.
+   */
+  LogReader *Acquire(const char *filter,
+                     bool isExpression,
+                     bool isUtf8,
+                     const char *recordStart,
+                     bool &isConfigured);
+
+  //! SetConfigured marks the new reader as configured for its query.
+  void SetConfigured(const LogReader &);
+
+  //! Release closes the file of the acquired reader and keeps the reader for
+  //! next queries, if it's configured, or destroys it.
+  void Release(LogReader &);
+
+ private:
+  struct Entry;
+
+  //! Destroy destroys the entry and its reader.
+  static void Destroy(Entry *);
+
+  //! Find returns address of the link to the entry of the reader.
+  Entry **Find(Entry **list, const LogReader &);
+
+  SRWLOCK m_lock = SRWLOCK_INIT;
+  //! Released entries from the recently used.
+  Entry *m_released = nullptr;
+  size_t m_releasedNumber = 0;
+  Entry *m_acquired = nullptr;
+};
+
+//! ScanCache keeps shared scans of files, which are read by concurrent
+//! queries.
+/**
+ * Scans are found by the file path, the UTF-8 mode and the record start
+ * mask. The first query of a file opens the scan, and queries, which are
+ * started while the file is read, join the same pass from its current
+ * position, so concurrent queries of a file read it once. Methods are
+ * thread-safe.
+ */
+class ScanCache {
+ public:
+  ScanCache() = default;
+  ScanCache(ScanCache &&) = delete;
+  ScanCache(const ScanCache &) = delete;
+  ScanCache &operator=(ScanCache &&) = delete;
+  ScanCache &operator=(const ScanCache &) = delete;
+  ~ScanCache();
+
+  //! Acquire registers the query of the file and returns the scan of the
+  //! file for the query settings.
+  /**
+   * @param[out] isShared True if the query has to read the file by the
+   * opened scan, false if the file isn't opened and the query reads it by
+   * its own reader.
+   * @return Scan or nullptr at error or if the record start is invalid.
+   */
+  SharedScan *Acquire(const char *filePath,
+                      bool isUtf8,
+                      const char *recordStart,
+                      bool &isShared);
+
+  //! Release unregisters the query of the file and closes the scan after
+  //! its last shared query.
+  void Release(SharedScan &, bool isShared);
+
+ private:
+  struct Entry;
+
+  //! Destroy destroys the entry and its scan.
+  static void Destroy(Entry *);
+
+  SRWLOCK m_lock = SRWLOCK_INIT;
+  Entry *m_entries = nullptr;
+};
+
+//! RunQuery executes the query with command line arguments.
+/**
+ * @param[in] argc Number of arguments, including the executable name.
+ * @param[in] argv Arguments.
+ * @param[in] console Output for records and messages.
+ * @param[in] errors Output for error messages.
+ * @param[in] cache Cache of readers of the server or nullptr to create
+ * readers for the query. The server doesn't write files, so the output file
+ * and the index building are rejected with the cache.
+ * @param[in] scans Shared scans of the server or nullptr to read files by
+ * readers of the query only.
+ * @return Process exit code.
+ */
+int RunQuery(int argc,
+             const char *const argv[],
+             Output &console,
+             Output &errors,
+             ReaderCache *cache,
+             ScanCache *scans);
+
+//! IsQueryFilePath returns true if the query argument is a log file path.
+/**
+ * @param[in] argc Number of arguments, including the executable name.
+ * @param[in] argv Arguments.
+ * @param[in] index Index of the argument.
+ */
+bool IsQueryFilePath(int argc, const char *const argv[], int index);
@@ -0,0 +1,294 @@
+﻿//
+//    Created: 2019/04/25 15:42
+//     Author: Eugene V. Palchukovsky
+//     E-mail: eugene@palchukovsky.com
+//
+
+#include "Prec.hpp"
+#include "Server.hpp"
+#include "Query.hpp"
+#include "Sink.hpp"
+
+namespace {
+//! Maximum size of query arguments in bytes.
+const uint32_t maxRequestSize = 64 * 1024;
+//! Size of pipe buffers in bytes.
+const DWORD pipeBufferSize = 64 * 1024;
+//! Number of files, which mappings are kept between queries.
+const size_t fileCacheSize = 16;
+
+//! Returns the full pipe path or false if the name is too long.
+bool GetPipePath(const char *name, char (&path)[MAX_PATH]) {
+  const auto len = snprintf(path, sizeof(path), R"(\\.\pipe\%s)", name);
+  return len > 0 && static_cast<size_t>(len) < sizeof(path);
+}
+
+//! Reads exactly the size of data.
+bool ReadAll(const HANDLE pipe, void *data, size_t size) {
+  auto it = static_cast<char *>(data);
+  while (size) {
+    const auto chunk =
+        static_cast<DWORD>(size < 0x40000000 ? size : 0x40000000);
+    DWORD read;
+    if (!ReadFile(pipe, it, chunk, &read, nullptr) || !read) {
+      return false;
+    }
+    it += read;
+    size -= read;
+  }
+  return true;
+}
+
+//! Writes all data.
+bool WriteAll(const HANDLE pipe, const void *data, const DWORD size) {
+  DWORD written;
+  return WriteFile(pipe, data, size, &written, nullptr) && written == size;
+}
+
+//! Reads the query from the connected client, executes it and sends the
+//! response.
+void Respond(const HANDLE pipe, ReaderCache &cache, ScanCache &scans) {
+  uint32_t size;
+  if (!ReadAll(pipe, &size, sizeof(size)) || !size ||
+      size > maxRequestSize) {
+    return;
+  }
+  const auto request = static_cast<char *>(malloc(size));
+  // Each argument ends with zero, so there are not more arguments than bytes.
+  const auto argv =
+      static_cast<const char **>(malloc(size * sizeof(const char *)));
+  struct Scope {
+    char *request;
+    const char **argv;
+    ~Scope() {
+      free(argv);
+      free(request);
+    }
+  } scope{request, argv};  // NOLINT
+  if (!request || !argv || !ReadAll(pipe, request, size) ||
+      request[size - 1]) {
+    return;
+  }
+  int argc = 0;
+  for (auto it = request; it < request + size; it += strlen(it) + 1) {
+    argv[argc++] = it;
+  }
+
+  int32_t exitCode;
+  {
+    Output console;
+    Output errors;
+    if (!console.OpenFramed(pipe, false) || !errors.OpenFramed(pipe, true)) {
+      return;
+    }
+    exitCode = RunQuery(argc, argv, console, errors, &cache, &scans);
+    if (!console.Flush() || !errors.Flush()) {
+      return;
+    }
+  }
+  const uint32_t end[] = {0, static_cast<uint32_t>(exitCode)};
+  WriteAll(pipe, end, sizeof(end));
+}
+
+//! Connection is the connected pipe instance.
+struct Connection {
+  HANDLE pipe;
+  ReaderCache *cache;
+  ScanCache *scans;
+};
+
+//! Responds to the client and closes the pipe instance.
+void ServeClient(const Connection &connection) {
+  Respond(connection.pipe, *connection.cache, *connection.scans);
+  FlushFileBuffers(connection.pipe);
+  DisconnectNamedPipe(connection.pipe);
+  CloseHandle(connection.pipe);
+}
+}  // namespace
+
+int Serve(const char *pipeName) {
+  char path[MAX_PATH];
+  if (!GetPipePath(pipeName, path)) {
+    fprintf(stderr, "Pipe name \"%s\" is too long.\n", pipeName);
+    return 1;
+  }
+  // Next queries of the same file don't map it again. A changed file is
+  // mapped again and the mapping of its previous version is closed, so a
+  // rotated log is not kept.
+  LogReader::SetFileCacheSize(fileCacheSize);
+  ReaderCache cache;
+  ScanCache scans;
+  // Each connection is served by a thread of the pool, caches are destroyed
+  // after all of them.
+  TP_CALLBACK_ENVIRON environment;
+  InitializeThreadpoolEnvironment(&environment);
+  struct Scope {
+    TP_CALLBACK_ENVIRON &environment;
+    PTP_CLEANUP_GROUP group;
+    ~Scope() {
+      if (group) {
+        CloseThreadpoolCleanupGroupMembers(group, FALSE, nullptr);
+        CloseThreadpoolCleanupGroup(group);
+      }
+      DestroyThreadpoolEnvironment(&environment);
+    }
+  } scope{environment, CreateThreadpoolCleanupGroup()};  // NOLINT
+  if (!scope.group) {
+    fprintf(stderr, "Failed to create thread pool.\n");
+    return 1;
+  }
+  SetThreadpoolCallbackCleanupGroup(&environment, scope.group, nullptr);
+
+  for (;;) {
+    const auto pipe = CreateNamedPipe(
+        path, PIPE_ACCESS_DUPLEX,
+        PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT |
+            PIPE_REJECT_REMOTE_CLIENTS,
+        PIPE_UNLIMITED_INSTANCES, pipeBufferSize, pipeBufferSize, 0, nullptr);
+    if (pipe == INVALID_HANDLE_VALUE) {
+      fprintf(stderr, "Failed to create pipe \"%s\".\n", path);
+      return 1;
+    }
+    if (!ConnectNamedPipe(pipe, nullptr) &&
+        GetLastError() != ERROR_PIPE_CONNECTED) {
+      CloseHandle(pipe);
+      continue;
+    }
+    // The next pipe instance waits for the next client while this one is
+    // served. If the thread can't be started the client is served here.
+    const auto connection =
+        static_cast<Connection *>(malloc(sizeof(Connection)));
+    if (!connection) {
+      ServeClient(Connection{pipe, &cache, &scans});
+      continue;
+    }
+    *connection = Connection{pipe, &cache, &scans};
+    if (!TrySubmitThreadpoolCallback(
+            [](PTP_CALLBACK_INSTANCE instance, PVOID context) {
+              // Queries take long, so the pool may start more threads.
+              CallbackMayRunLong(instance);
+              ServeClient(*static_cast<Connection *>(context));
+              free(context);
+            },
+            connection, &environment)) {
+      ServeClient(*connection);
+      free(connection);
+    }
+  }
+}
+
+int Connect(const char *pipeName, const int argc, const char *const argv[]) {
+  char path[MAX_PATH];
+  if (!GetPipePath(pipeName, path)) {
+    fprintf(stderr, "Pipe name \"%s\" is too long.\n", pipeName);
+    return 1;
+  }
+  HANDLE pipe;
+  for (;;) {
+    pipe = CreateFile(path, GENERIC_READ | GENERIC_WRITE, 0, nullptr,
+                      OPEN_EXISTING, 0, nullptr);
+    // The server creates the next pipe instance after the previous client is
+    // connected.
+    if (pipe != INVALID_HANDLE_VALUE || GetLastError() != ERROR_PIPE_BUSY ||
+        !WaitNamedPipe(path, NMPWAIT_WAIT_FOREVER)) {
+      break;
+    }
+  }
+  if (pipe == INVALID_HANDLE_VALUE) {
+    fprintf(stderr, "Failed to connect to pipe \"%s\".\n", path);
+    return 1;
+  }
+  struct Scope {
+    HANDLE pipe;
+    char *buffer;
+    ~Scope() {
+      free(buffer);
+      CloseHandle(pipe);
+    }
+  } scope{pipe, nullptr};  // NOLINT
+
+  // The server has its own current directory, so log file paths are sent as
+  // full paths.
+  size_t size = 0;
+  for (auto i = 0; i < argc; ++i) {
+    if (!IsQueryFilePath(argc, argv, i)) {
+      size += strlen(argv[i]) + 1;
+      continue;
+    }
+    const auto pathSize = GetFullPathName(argv[i], 0, nullptr, nullptr);
+    if (!pathSize) {
+      fprintf(stderr, "Failed to resolve path \"%s\".\n", argv[i]);
+      return 1;
+    }
+    size += pathSize;
+  }
+  if (!size || size > maxRequestSize) {
+    fprintf(stderr, "Query is too long.\n");
+    return 1;
+  }
+  scope.buffer = static_cast<char *>(malloc(sizeof(uint32_t) + size));
+  if (!scope.buffer) {
+    return 1;
+  }
+  auto it = scope.buffer + sizeof(uint32_t);
+  const auto end = it + size;
+  for (auto i = 0; i < argc; ++i) {
+    if (!IsQueryFilePath(argc, argv, i)) {
+      const auto argSize = strlen(argv[i]) + 1;
+      memcpy(it, argv[i], argSize);
+      it += argSize;
+      continue;
+    }
+    const auto len = GetFullPathName(
+        argv[i], static_cast<DWORD>(end - it), it, nullptr);
+    if (!len || len >= static_cast<DWORD>(end - it)) {
+      fprintf(stderr, "Failed to resolve path \"%s\".\n", argv[i]);
+      return 1;
+    }
+    it += len + 1;
+  }
+  const auto size32 = static_cast<uint32_t>(it - scope.buffer) -
+                      static_cast<uint32_t>(sizeof(uint32_t));
+  memcpy(scope.buffer, &size32, sizeof(size32));
+  if (!WriteAll(pipe, scope.buffer, static_cast<DWORD>(it - scope.buffer))) {
+    fprintf(stderr, "Failed to send query.\n");
+    return 1;
+  }
+
+  Output console;
+  Output errors;
+  if (!console.Open(nullptr) || !errors.OpenError()) {
+    return 1;
+  }
+  for (;;) {
+    uint32_t header;
+    if (!ReadAll(pipe, &header, sizeof(header))) {
+      break;
+    }
+    if (!header) {
+      uint32_t exitCode;
+      if (!ReadAll(pipe, &exitCode, sizeof(exitCode))) {
+        break;
+      }
+      return static_cast<int>(exitCode);
+    }
+    auto frameSize = header & ~Output::errorFrameFlag;
+    auto &output = header & Output::errorFrameFlag ? errors : console;
+    // Frames are read by parts of the pipe buffer size.
+    char part[pipeBufferSize];
+    while (frameSize) {
+      const auto partSize = frameSize < sizeof(part) ? frameSize : sizeof(part);
+      if (!ReadAll(pipe, part, partSize) || !output.Write(part, partSize)) {
+        errors.Print("Failed to receive response.\n");
+        return 1;
+      }
+      frameSize -= static_cast<uint32_t>(partSize);
+    }
+    // Records and messages are shown in order of frames.
+    if (!output.Flush()) {
+      return 1;
+    }
+  }
+  errors.Print("Connection is closed by the server.\n");
+  return 1;
+}
@@ -0,0 +1,31 @@
+﻿//
+//    Created: 2019/04/25 15:30
+//     Author: Eugene V. Palchukovsky
+//     E-mail: eugene@palchukovsky.com
+//
+
+#pragma once
+
+//! Serve executes queries of clients, which are connected to the named pipe,
+//! until the process is stopped.
+/**
+ * The request is 32-bit size of arguments and command line arguments, each
+ * with terminating zero, starting with the executable name. The response is
+ * Output frames of records and error messages, followed by the zero header
+ * and 32-bit process exit code.
+ *
+ * @param[in] pipeName Local pipe name without "\\.\pipe\" prefix.
+ * @return Process exit code.
+ */
+int Serve(const char *pipeName);
+
+//! Connect sends the query to the server and writes the response records and
+//! messages to the standard output and to the standard error output.
+/**
+ * @param[in] pipeName Local pipe name without "\\.\pipe\" prefix.
+ * @param[in] argc Number of the query arguments, including the executable
+ * name.
+ * @param[in] argv Query arguments.
+ * @return Exit code of the query or 1 at error.
+ */
+int Connect(const char *pipeName, int argc, const char *const argv[]);
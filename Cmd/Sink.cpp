@@ -0,0 +1,367 @@
+﻿//
+//    Created: 2019/04/22 10:12
+//     Author: Eugene V. Palchukovsky
+//     E-mail: eugene@palchukovsky.com
+//
+
+#include "Prec.hpp"
+#include "Sink.hpp"
+
+Output::~Output() {
+  Flush();
+  if (m_isOwned) {
+    CloseHandle(m_file);
+  }
+  free(m_buffer);
+}
+
+namespace {
+//! Writes all data, the size is limited by DWORD.
+bool WriteAll(const HANDLE file, const char *data, DWORD size) {
+  while (size) {
+    DWORD written;
+    if (!::WriteFile(file, data, size, &written, nullptr) || !written) {
+      return false;
+    }
+    data += written;
+    size -= written;
+  }
+  return true;
+}
+
+//! Returns the size of valid UTF-8 sequence at the begin or zero if the
+//! sequence is invalid, overlong, a surrogate or out of Unicode range.
+size_t GetCodePointSize(const char *begin, const char *end) {
+  const auto lead = static_cast<unsigned char>(*begin);
+  size_t size;
+  uint32_t codePoint;
+  if (lead < 0x80) {
+    return 1;
+  } else if (lead >= 0xC2 && lead <= 0xDF) {
+    size = 2;
+    codePoint = lead & 0x1F;
+  } else if (lead >= 0xE0 && lead <= 0xEF) {
+    size = 3;
+    codePoint = lead & 0x0F;
+  } else if (lead >= 0xF0 && lead <= 0xF4) {
+    size = 4;
+    codePoint = lead & 0x07;
+  } else {
+    return 0;
+  }
+  if (static_cast<size_t>(end - begin) < size) {
+    return 0;
+  }
+  for (size_t i = 1; i < size; ++i) {
+    const auto symbol = static_cast<unsigned char>(begin[i]);
+    if ((symbol & 0xC0) != 0x80) {
+      return 0;
+    }
+    codePoint = codePoint << 6 | (symbol & 0x3F);
+  }
+  if ((size == 3 && codePoint < 0x800) || (size == 4 && codePoint < 0x10000) ||
+      (codePoint >= 0xD800 && codePoint <= 0xDFFF) || codePoint > 0x10FFFF) {
+    return 0;
+  }
+  return size;
+}
+}  // namespace
+
+bool Output::Open(const char *filePath) {
+  if (m_file != INVALID_HANDLE_VALUE) {
+    return false;
+  }
+  m_buffer = static_cast<char *>(malloc(bufferSize));
+  if (!m_buffer) {
+    return false;
+  }
+  if (!filePath) {
+    m_file = GetStdHandle(STD_OUTPUT_HANDLE);
+    return m_file != INVALID_HANDLE_VALUE && m_file != nullptr;
+  }
+  m_file = CreateFile(filePath, GENERIC_WRITE, FILE_SHARE_READ, nullptr,
+                      CREATE_ALWAYS,
+                      FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
+                      nullptr);
+  m_isOwned = m_file != INVALID_HANDLE_VALUE;
+  return m_isOwned;
+}
+
+bool Output::OpenError() {
+  if (m_file != INVALID_HANDLE_VALUE) {
+    return false;
+  }
+  m_buffer = static_cast<char *>(malloc(bufferSize));
+  if (!m_buffer) {
+    return false;
+  }
+  m_file = GetStdHandle(STD_ERROR_HANDLE);
+  return m_file != INVALID_HANDLE_VALUE && m_file != nullptr;
+}
+
+bool Output::OpenFramed(const HANDLE stream, const bool isError) {
+  if (m_file != INVALID_HANDLE_VALUE) {
+    return false;
+  }
+  m_buffer = static_cast<char *>(malloc(bufferSize));
+  if (!m_buffer) {
+    return false;
+  }
+  m_file = stream;
+  m_isFramed = true;
+  m_frameFlags = isError ? errorFrameFlag : 0;
+  return true;
+}
+
+bool Output::Write(const void *data, const size_t size) {
+  if (size <= bufferSize - m_size) {
+    memcpy(m_buffer + m_size, data, size);
+    m_size += size;
+    return true;
+  }
+  if (!Flush()) {
+    return false;
+  }
+  if (size >= bufferSize) {
+    return WriteDirect(data, size);
+  }
+  memcpy(m_buffer, data, size);
+  m_size = size;
+  return true;
+}
+
+bool Output::Flush() {
+  if (!m_size) {
+    return true;
+  }
+  const auto result = WriteDirect(m_buffer, m_size);
+  m_size = 0;
+  return result;
+}
+
+bool Output::WriteDirect(const void *data, size_t size) {
+  if (m_file == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+  auto it = static_cast<const char *>(data);
+  while (size) {
+    // Large data is written by parts, as the size is limited by DWORD and
+    // by the frame header.
+    const auto chunk =
+        static_cast<DWORD>(size < 0x40000000 ? size : 0x40000000);
+    if (m_isFramed) {
+      const uint32_t header = chunk | m_frameFlags;
+      if (!WriteAll(m_file, reinterpret_cast<const char *>(&header),
+                    sizeof(header))) {
+        return false;
+      }
+    }
+    if (!WriteAll(m_file, it, chunk)) {
+      return false;
+    }
+    it += chunk;
+    size -= chunk;
+  }
+  return true;
+}
+
+bool Output::Print(const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  va_list argsCopy;
+  va_copy(argsCopy, args);
+  char buffer[256];
+  const auto len = vsnprintf(buffer, sizeof(buffer), format, args);
+  va_end(args);
+  auto result = len >= 0;
+  if (result && static_cast<size_t>(len) < sizeof(buffer)) {
+    result = Write(buffer, static_cast<size_t>(len));
+  } else if (result) {
+    // Long text, like help, is formatted again to the allocated buffer.
+    const auto text = static_cast<char *>(malloc(len + 1));
+    result = text && vsnprintf(text, len + 1, format, argsCopy) == len &&
+             Write(text, static_cast<size_t>(len));
+    free(text);
+  }
+  va_end(argsCopy);
+  return result;
+}
+
+bool Sink::WriteNumber(uint64_t value) {
+  char buffer[20];
+  auto it = buffer + sizeof(buffer);
+  do {
+    *--it = static_cast<char>('0' + value % 10);
+    value /= 10;
+  } while (value);
+  return m_output.Write(it, static_cast<size_t>(buffer + sizeof(buffer) - it));
+}
+
+RawSink::RawSink(Output &output,
+                 const bool isLineNumberPrinted,
+                 const bool isOffsetPrinted)
+    : Sink(output),
+      m_isLineNumberPrinted(isLineNumberPrinted),
+      m_isOffsetPrinted(isOffsetPrinted) {}
+
+bool RawSink::Write(const LogReader::Record &record) {
+  if (record.isGap && !m_output.Write("--\n", 3)) {
+    return false;
+  }
+  const auto separator = record.isMatched ? ':' : '-';
+  if (m_filePath && (!m_output.Write(m_filePath, strlen(m_filePath)) ||
+                     !m_output.Write(&separator, 1))) {
+    return false;
+  }
+  if (m_isLineNumberPrinted &&
+      (!WriteNumber(record.line) || !m_output.Write(&separator, 1))) {
+    return false;
+  }
+  if (m_isOffsetPrinted &&
+      (!WriteNumber(record.offset) || !m_output.Write(&separator, 1))) {
+    return false;
+  }
+  if (!record.captures) {
+    return m_output.Write(record.begin,
+                          static_cast<size_t>(record.end - record.begin)) &&
+           m_output.Write("\n", 1);
+  }
+  for (size_t i = 0; i < record.capturesNumber; ++i) {
+    const auto &capture = record.captures[i];
+    if ((i > 0 && !m_output.Write("\t", 1)) ||
+        !m_output.Write(capture.begin,
+                        static_cast<size_t>(capture.end - capture.begin))) {
+      return false;
+    }
+  }
+  return m_output.Write("\n", 1);
+}
+
+JsonSink::JsonSink(Output &output,
+                   const char *filePath,
+                   const bool isLineNumberPrinted)
+    : Sink(output), m_isLineNumberPrinted(isLineNumberPrinted) {
+  m_filePath = filePath;
+}
+
+bool JsonSink::Write(const LogReader::Record &record) {
+  const auto &write = [this](const char *string) {
+    return m_output.Write(string, strlen(string));
+  };
+  if (!write(R"({"file":)") ||
+      !WriteString(m_filePath, m_filePath + strlen(m_filePath)) ||
+      !write(R"(,"offset":)") || !WriteNumber(record.offset)) {
+    return false;
+  }
+  if (m_isLineNumberPrinted &&
+      (!write(R"(,"line":)") || !WriteNumber(record.line))) {
+    return false;
+  }
+  if (!write(record.isMatched ? R"(,"matched":true)"
+                               : R"(,"matched":false)") ||
+      !write(record.isGap ? R"(,"gap":true)" : R"(,"gap":false)") ||
+      !write(R"(,"text":)") || !WriteString(record.begin, record.end)) {
+    return false;
+  }
+  if (record.captures) {
+    if (!write(R"(,"fields":[)")) {
+      return false;
+    }
+    for (size_t i = 0; i < record.capturesNumber; ++i) {
+      const auto &capture = record.captures[i];
+      if ((i > 0 && !write(",")) ||
+          !WriteString(capture.begin, capture.end)) {
+        return false;
+      }
+    }
+    if (!write("]")) {
+      return false;
+    }
+  }
+  return write("}\n");
+}
+
+bool JsonSink::WriteString(const char *begin, const char *const end) {
+  if (!m_output.Write("\"", 1)) {
+    return false;
+  }
+  // Symbols without escaping are written by continuous ranges.
+  auto rangeBegin = begin;
+  while (begin < end) {
+    const auto symbol = static_cast<unsigned char>(*begin);
+    if (symbol >= 0x80) {
+      const auto size = GetCodePointSize(begin, end);
+      if (size) {
+        begin += size;
+        continue;
+      }
+      // JSON text has to be valid UTF-8, each byte of invalid sequence is
+      // replaced by the replacement character.
+      if (!m_output.Write(rangeBegin,
+                          static_cast<size_t>(begin - rangeBegin)) ||
+          !m_output.Write("\\ufffd", 6)) {
+        return false;
+      }
+      rangeBegin = ++begin;
+      continue;
+    }
+    if (symbol >= 0x20 && symbol != '"' && symbol != '\\') {
+      ++begin;
+      continue;
+    }
+    if (!m_output.Write(rangeBegin, static_cast<size_t>(begin - rangeBegin))) {
+      return false;
+    }
+    rangeBegin = ++begin;
+    char escape[6] = {'\\', static_cast<char>(symbol)};
+    size_t escapeLen = 2;
+    switch (symbol) {
+      case '"':
+      case '\\':
+        break;
+      case '\n':
+        escape[1] = 'n';
+        break;
+      case '\r':
+        escape[1] = 'r';
+        break;
+      case '\t':
+        escape[1] = 't';
+        break;
+      default: {
+        const auto digits = "0123456789abcdef";
+        escape[1] = 'u';
+        escape[2] = escape[3] = '0';
+        escape[4] = digits[symbol >> 4];
+        escape[5] = digits[symbol & 0xf];
+        escapeLen = sizeof(escape);
+        break;
+      }
+    }
+    if (!m_output.Write(escape, escapeLen)) {
+      return false;
+    }
+  }
+  return m_output.Write(rangeBegin, static_cast<size_t>(end - rangeBegin)) &&
+         m_output.Write("\"", 1);
+}
+
+bool BinarySink::Start() {
+  const uint32_t header[] = {'L' | 'R' << 8 | 'R' << 16 | 'B' << 24, version};
+  return m_output.Write(header, sizeof(header));
+}
+
+bool BinarySink::Write(const LogReader::Record &record) {
+  Entry entry;
+  entry.offset = record.offset;
+  entry.line = record.line;
+  entry.size = static_cast<uint64_t>(record.end - record.begin);
+  entry.flags = 0;
+  if (record.isMatched) {
+    entry.flags |= FLAG_MATCHED;
+  }
+  if (record.isGap) {
+    entry.flags |= FLAG_GAP;
+  }
+  return m_output.Write(&entry, sizeof(entry));
+}
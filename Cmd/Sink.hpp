@@ -0,0 +1,203 @@
+﻿//
+//    Created: 2019/04/22 10:12
+//     Author: Eugene V. Palchukovsky
+//     E-mail: eugene@palchukovsky.com
+//
+
+#pragma once
+
+#include "LogReader/LogReader.hpp"
+
+//! Output writes data to the standard output or to a file by large blocks.
+class Output {
+ public:
+  //! Size of the output buffer in bytes.
+  enum : size_t { bufferSize = 1024 * 1024 };
+  //! Frame header flag of the error messages stream, the rest of the header
+  //! is the frame size. The zero header ends the frames.
+  static const uint32_t errorFrameFlag = 0x80000000;
+
+  Output() = default;
+  Output(Output &&) = delete;
+  Output(const Output &) = delete;
+  Output &operator=(Output &&) = delete;
+  Output &operator=(const Output &) = delete;
+  ~Output();
+
+  //! Open opens the output.
+  /**
+   * @param[in] filePath File path to create or rewrite the file, or nullptr
+   * to write to the standard output.
+   * @return True at success, false at error.
+   */
+  bool Open(const char *filePath);
+
+  //! OpenError opens the standard error output.
+  /**
+   * @return True at success, false at error.
+   */
+  bool OpenError();
+
+  //! OpenFramed opens the output to the stream, which is not owned, so data
+  //! of several outputs can be sent by one stream.
+  /**
+   * Each written block is prefixed by 32-bit header with its size and the
+   * error flag.
+   *
+   * @param[in] stream Stream handle.
+   * @param[in] isError True if it's the error messages stream.
+   * @return True at success, false at error.
+   */
+  bool OpenFramed(HANDLE stream, bool isError);
+
+  //! Write writes data.
+  /**
+   * Data is copied to the buffer, data which is larger than the buffer is
+   * written directly without copying.
+   *
+   * @return True at success, false at error.
+   */
+  bool Write(const void *data, size_t size);
+
+  //! Flush writes buffered data.
+  /**
+   * @return True at success, false at error.
+   */
+  bool Flush();
+
+  //! Print writes formatted text like printf.
+  /**
+   * @return True at success, false at error.
+   */
+  bool Print(const char *format, ...);
+
+ private:
+  //! WriteDirect writes data to the file without buffering.
+  bool WriteDirect(const void *data, size_t size);
+
+  HANDLE m_file{INVALID_HANDLE_VALUE};
+  bool m_isOwned = false;
+  //! Frame header flags or zero if data is not framed.
+  uint32_t m_frameFlags = 0;
+  bool m_isFramed = false;
+  char *m_buffer{nullptr};
+  size_t m_size = 0;
+};
+
+//! Sink writes records in an output format.
+class Sink {
+ public:
+  explicit Sink(Output &output) : m_output(output) {}
+  Sink(Sink &&) = delete;
+  Sink(const Sink &) = delete;
+  Sink &operator=(Sink &&) = delete;
+  Sink &operator=(const Sink &) = delete;
+  virtual ~Sink() = default;
+
+  //! Start writes the output header, if the format has it.
+  /**
+   * @return True at success, false at error.
+   */
+  virtual bool Start() { return true; }
+
+  //! Write writes the record.
+  /**
+   * @return True at success, false at error.
+   */
+  virtual bool Write(const LogReader::Record &) = 0;
+
+  //! SetFilePath sets file path of the next records.
+  void SetFilePath(const char *filePath) { m_filePath = filePath; }
+
+ protected:
+  //! WriteNumber writes decimal number.
+  bool WriteNumber(uint64_t);
+
+  Output &m_output;
+  //! File path of records or nullptr if it's not written.
+  const char *m_filePath{nullptr};
+};
+
+//! RawSink writes records as lines with optional file path, line number and
+//! offset prefixes and "--" lines between context groups.
+/**
+ * Records with captures are written as captures separated by tabs.
+ */
+class RawSink final : public Sink {
+ public:
+  explicit RawSink(Output &output,
+                   bool isLineNumberPrinted,
+                   bool isOffsetPrinted);
+  RawSink(RawSink &&) = delete;
+  RawSink(const RawSink &) = delete;
+  RawSink &operator=(RawSink &&) = delete;
+  RawSink &operator=(const RawSink &) = delete;
+  ~RawSink() override = default;
+
+  bool Write(const LogReader::Record &) override;
+
+ private:
+  const bool m_isLineNumberPrinted;
+  const bool m_isOffsetPrinted;
+};
+
+//! JsonSink writes each record as JSON object on a separate line (NDJSON).
+/**
+ * Object fields: "file", "offset", "line" (only with line numbering),
+ * "matched" (false for context records), "gap", "text" and "fields" (array
+ * of captures, only for records with captures). Control symbols,
+ * quotes and back slashes are escaped, bytes of invalid UTF-8 sequences are
+ * replaced by U+FFFD, other bytes are written as is.
+ */
+class JsonSink final : public Sink {
+ public:
+  explicit JsonSink(Output &output,
+                    const char *filePath,
+                    bool isLineNumberPrinted);
+  JsonSink(JsonSink &&) = delete;
+  JsonSink(const JsonSink &) = delete;
+  JsonSink &operator=(JsonSink &&) = delete;
+  JsonSink &operator=(const JsonSink &) = delete;
+  ~JsonSink() override = default;
+
+  bool Write(const LogReader::Record &) override;
+
+ private:
+  bool WriteString(const char *begin, const char *end);
+
+  const bool m_isLineNumberPrinted;
+};
+
+//! BinarySink writes records positions without content.
+/**
+ * The output starts with the signature "LRRB" and 32-bit format version,
+ * followed by BinarySink::Entry for each record. All numbers are
+ * little-endian.
+ */
+class BinarySink final : public Sink {
+ public:
+#pragma pack(push, 1)
+  struct Entry {
+    //! Record offset in the file in bytes.
+    uint64_t offset;
+    //! Record line number or zero if line numbering is disabled.
+    uint64_t line;
+    //! Record size in bytes.
+    uint64_t size;
+    //! Combination of flags.
+    uint32_t flags;
+  };
+#pragma pack(pop)
+  enum Flags : uint32_t { FLAG_MATCHED = 1, FLAG_GAP = 2 };
+  static const uint32_t version = 2;
+
+  explicit BinarySink(Output &output) : Sink(output) {}
+  BinarySink(BinarySink &&) = delete;
+  BinarySink(const BinarySink &) = delete;
+  BinarySink &operator=(BinarySink &&) = delete;
+  BinarySink &operator=(const BinarySink &) = delete;
+  ~BinarySink() override = default;
+
+  bool Start() override;
+  bool Write(const LogReader::Record &) override;
+};
@@ -0,0 +1,122 @@
+﻿//
+//    Created: 2019/04/17 18:05
+//     Author: Eugene V. Palchukovsky
+//     E-mail: eugene@palchukovsky.com
+//
+
+// Differential fuzzer for MaskMatcher. Compares MaskMatcher::Match with a
+// simple dynamic programming matcher and checks the number of matching steps.
+//
+// Input is the mask, zero byte and the content. Build and run (Linux, clang):
+//   Fuzz/build.sh
+//   ./MaskMatcherFuzzer -dict=Fuzz/MaskMatcher.dict corpus/
+//
+// Set LOG_READER_FUZZ_SLOW_US to report cases that take more microseconds
+// (10000 by default).
+
+#include "LogReader/Prec.hpp"
+#include "LogReader/MaskMatcher.hpp"
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+using namespace logReader;
+
+namespace {
+
+//! Reference matcher: mask symbol "i" matches content from "j" if "d[i][j]".
+bool MatchReference(const std::string &mask, const std::string &content) {
+  enum { ANY_SYMBOL = 256, ANY_SYMBOLS = 257 };
+  std::vector<int> symbols;
+  auto isDisabled = false;
+  for (const auto ch : mask) {
+    const auto symbol = static_cast<unsigned char>(ch);
+    if (isDisabled) {
+      isDisabled = false;
+      symbols.emplace_back(symbol);
+    } else if (ch == '\\') {
+      isDisabled = true;
+    } else if (ch == '?') {
+      symbols.emplace_back(ANY_SYMBOL);
+    } else if (ch == '*') {
+      symbols.emplace_back(ANY_SYMBOLS);
+    } else {
+      symbols.emplace_back(symbol);
+    }
+  }
+
+  const auto n = content.size();
+  std::vector<char> next(n + 1, 0);
+  std::vector<char> current(n + 1);
+  next[n] = 1;
+  for (auto i = symbols.size(); i-- > 0;) {
+    for (auto j = n + 1; j-- > 0;) {
+      switch (symbols[i]) {
+        case ANY_SYMBOLS:
+          current[j] = next[j] || (j < n && current[j + 1]);
+          break;
+        case ANY_SYMBOL:
+          current[j] = next[j] || (j < n && next[j + 1]);
+          break;
+        default:
+          current[j] = j < n &&
+                       static_cast<unsigned char>(content[j]) == symbols[i] &&
+                       next[j + 1];
+          break;
+      }
+    }
+    next.swap(current);
+  }
+  return next[0] != 0;
+}
+
+long long GetSlowCaseTime() {
+  const auto value = getenv("LOG_READER_FUZZ_SLOW_US");
+  return value ? atoll(value) : 10000;
+}
+
+}  // namespace
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, const size_t size) {
+  const auto begin = reinterpret_cast<const char *>(data);
+  const auto end = begin + size;
+  const auto separator = static_cast<const char *>(memchr(begin, 0, size));
+  const std::string mask(begin, separator ? separator : end);
+  const std::string content(separator ? separator + 1 : end, end);
+
+  MaskMatcher matcher;
+  if (!matcher.Compile(mask.c_str())) {
+    fprintf(stderr, "Failed to compile mask.\n");
+    abort();
+  }
+  // Counters are checked by sanitizers too.
+  matcher.SetStatsCounting(true);
+
+  const auto start = std::chrono::steady_clock::now();
+  const auto result =
+      matcher.Match(content.data(), content.data() + content.size());
+  const auto time = std::chrono::duration_cast<std::chrono::microseconds>(
+                        std::chrono::steady_clock::now() - start)
+                        .count();
+
+  if (result != MatchReference(mask, content)) {
+    fprintf(stderr, "Result %d differs from reference.\n", result);
+    abort();
+  }
+  // Each branch is checked once, so steps are limited by the content length
+  // multiplied by the mask length.
+  const auto stepsLimit = 4 * (mask.size() + 1) * (content.size() + 1);
+  if (matcher.GetStepsNumber() > stepsLimit) {
+    fprintf(stderr, "Too many steps: %zu > %zu.\n", matcher.GetStepsNumber(),
+            stepsLimit);
+    abort();
+  }
+  static const auto slowCaseTime = GetSlowCaseTime();
+  if (time > slowCaseTime) {
+    fprintf(stderr, "Slow case: %lld us, mask %zu bytes, content %zu bytes.\n",
+            static_cast<long long>(time), mask.size(), content.size());
+  }
+
+  return 0;
+}
@@ -0,0 +1,12 @@
+#!/bin/sh
+# Builds MaskMatcher fuzzer with libFuzzer and sanitizers (Linux, clang).
+set -e
+ROOT=$(dirname "$0")/..
+${CXX:-clang++} -std=c++14 -g -O1 \
+  -fsanitize=fuzzer,address,undefined \
+  -I"$ROOT" -I"$ROOT/LogReader" \
+  "$ROOT/Fuzz/MaskMatcherFuzzer.cpp" \
+  "$ROOT/LogReader/MaskMatcher.cpp" \
+  "$ROOT/LogReader/Rules.cpp" \
+  "$ROOT/LogReader/Scan.cpp" \
+  -o MaskMatcherFuzzer
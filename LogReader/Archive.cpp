@@ -0,0 +1,558 @@
+﻿//
+//    Created: 2019/04/26 11:25
+//     Author: Eugene V. Palchukovsky
+//     E-mail: eugene@palchukovsky.com
+//
+
+#include "Prec.hpp"
+#include "Archive.hpp"
+#include "Mapping.hpp"
+
+#pragma comment(lib, "Cabinet.lib")
+
+using namespace logReader;
+
+namespace {
+
+const DWORD algorithm = COMPRESS_ALGORITHM_XPRESS_HUFF | COMPRESS_RAW;
+
+//! Decompresses the block content, the decompressor is created by the first
+//! call.
+bool DecompressBlock(const char *source,
+                     const size_t size,
+                     char *content,
+                     const size_t contentSize,
+                     void *&decompressor) {
+  if (!decompressor) {
+    DECOMPRESSOR_HANDLE handle;
+    if (!CreateDecompressor(algorithm, nullptr, &handle)) {
+      return false;
+    }
+    decompressor = handle;
+  }
+  SIZE_T resultSize;
+  return Decompress(static_cast<DECOMPRESSOR_HANDLE>(decompressor), source,
+                    size, content, contentSize, &resultSize) &&
+         resultSize == contentSize;
+}
+
+}  // namespace
+
+//! Header is the archive header, followed by compressed blocks and by the
+//! table of blocks, which is aligned by 8 bytes.
+struct Archive::Header {
+  char signature[4];
+  uint32_t version;
+  uint64_t contentSize;
+  uint64_t blocksNumber;
+  //! Offset of the table of blocks in the archive.
+  uint64_t tableOffset;
+
+  static const uint32_t currentVersion = 1;
+};
+
+//! Block is an entry of the table of blocks.
+struct Archive::Block {
+  //! Offset of the compressed block in the archive.
+  uint64_t offset;
+  //! Offset of the block in the content.
+  uint64_t contentOffset;
+  //! Size of the compressed block. It's equal to the content size if the
+  //! block is not compressible and it's stored as is.
+  uint32_t size;
+  //! Size of the block in the content.
+  uint32_t contentSize;
+};
+
+//! Slot is a state of the block.
+struct Archive::Slot {
+  enum State : uint8_t {
+    STATE_NONE,
+    STATE_QUEUED,
+    STATE_EXTRACTING,
+    STATE_EXTRACTED,
+    //! The block is corrupted, it's not extracted again.
+    STATE_FAILED,
+  };
+
+  //! Links of the extraction queue or of the list of not locked blocks.
+  size_t prev;
+  size_t next;
+  size_t locksNumber;
+  State state;
+
+  //! Returns true if pages of the block are committed.
+  bool IsUsed() const {
+    return state != STATE_NONE && state != STATE_FAILED;
+  }
+};
+
+bool Archive::Create(const char *filePath,
+                     const char *archivePath,
+                     const size_t blockSize) {
+  if (!blockSize || blockSize > UINT32_MAX) {
+    return false;
+  }
+  const auto mapping = Mapping::Acquire(filePath);
+  if (!mapping) {
+    return false;
+  }
+  const auto file = CreateFile(archivePath, GENERIC_WRITE, 0, nullptr,
+                               CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+  struct Scope {  // NOLINT
+    const Mapping *mapping;
+    const char *archivePath;
+    HANDLE file;
+    COMPRESSOR_HANDLE compressor;
+    char *buffer;
+    Block *blocks;
+    bool isCompleted;
+    ~Scope() {
+      free(blocks);
+      free(buffer);
+      if (compressor) {
+        CloseCompressor(compressor);
+      }
+      if (file != INVALID_HANDLE_VALUE) {
+        CloseHandle(file);
+        if (!isCompleted) {
+          DeleteFile(archivePath);
+        }
+      }
+      Mapping::Release(mapping);
+    }
+  } scope{mapping, archivePath, file, nullptr, nullptr, nullptr, false};
+  if (file == INVALID_HANDLE_VALUE ||
+      !CreateCompressor(algorithm, nullptr, &scope.compressor)) {
+    return false;
+  }
+  scope.buffer = static_cast<char *>(malloc(blockSize));
+  if (!scope.buffer) {
+    return false;
+  }
+
+  const auto &write = [file](const void *data, const size_t size) {
+    DWORD written;
+    return WriteFile(file, data, static_cast<DWORD>(size), &written,
+                     nullptr) &&
+           written == size;
+  };
+
+  const auto content = mapping->GetBegin();
+  const auto size = mapping->GetSize();
+  Header header = {
+      {'L', 'R', 'Z', 'A'}, Header::currentVersion, size, 0, 0};
+  if (!write(&header, sizeof(header))) {
+    return false;
+  }
+  uint64_t offset = sizeof(header);
+  size_t blocksCapacity = 0;
+  for (size_t pos = 0; pos < size;) {
+    if (header.blocksNumber == blocksCapacity) {
+      const auto capacity = blocksCapacity ? blocksCapacity * 2 : 64;
+      const auto blocks = static_cast<Block *>(
+          realloc(scope.blocks, capacity * sizeof(*scope.blocks)));
+      if (!blocks) {
+        return false;
+      }
+      scope.blocks = blocks;
+      blocksCapacity = capacity;
+    }
+    auto end = size - pos > blockSize ? pos + blockSize : size;
+    // The source file can be an archive too.
+    const auto lockEnd = end;
+    if (!mapping->Lock(pos, lockEnd)) {
+      return false;
+    }
+    if (end < size) {
+      // Blocks end at line ends, so each block starts with a line.
+      for (auto it = end; it > pos; --it) {
+        if (content[it - 1] == '\n') {
+          end = it;
+          break;
+        }
+      }
+    }
+    auto &block = scope.blocks[header.blocksNumber++];
+    block.offset = offset;
+    block.contentOffset = pos;
+    block.contentSize = static_cast<uint32_t>(end - pos);
+    // The block is stored as is, if it isn't compressed to a smaller size.
+    SIZE_T compressedSize;
+    const auto isCompressed =
+        Compress(scope.compressor, content + pos, block.contentSize,
+                 scope.buffer, block.contentSize - 1, &compressedSize);
+    const auto isFailed =
+        !isCompressed && GetLastError() != ERROR_INSUFFICIENT_BUFFER;
+    block.size = isCompressed ? static_cast<uint32_t>(compressedSize)
+                              : block.contentSize;
+    const auto isWritten =
+        !isFailed &&
+        write(isCompressed ? scope.buffer : content + pos, block.size);
+    mapping->Unlock(pos, lockEnd);
+    if (!isWritten) {
+      return false;
+    }
+    offset += block.size;
+    pos = end;
+  }
+
+  const auto padding = static_cast<size_t>((8 - offset % 8) % 8);
+  const uint64_t zero = 0;
+  if (!write(&zero, padding) ||
+      !write(scope.blocks, header.blocksNumber * sizeof(*scope.blocks))) {
+    return false;
+  }
+  header.tableOffset = offset + padding;
+  LARGE_INTEGER begin;
+  begin.QuadPart = 0;
+  if (!SetFilePointerEx(file, begin, nullptr, FILE_BEGIN) ||
+      !write(&header, sizeof(header))) {
+    return false;
+  }
+  scope.isCompleted = true;
+  return true;
+}
+
+bool Archive::IsArchive(const char *view, const size_t size) {
+  if (size < sizeof(Header) ||
+      memcmp(view, "LRZA", sizeof(Header::signature))) {
+    return false;
+  }
+  const auto &header = *reinterpret_cast<const Header *>(view);
+  if (header.version != Header::currentVersion || !header.contentSize ||
+      header.contentSize > SIZE_MAX || header.tableOffset % 8 ||
+      header.tableOffset > size || header.blocksNumber > SIZE_MAX / 2 ||
+      (size - header.tableOffset) / sizeof(Block) != header.blocksNumber ||
+      (size - header.tableOffset) % sizeof(Block)) {
+    return false;
+  }
+  const auto blocks =
+      reinterpret_cast<const Block *>(view + header.tableOffset);
+  uint64_t contentOffset = 0;
+  for (size_t i = 0; i < header.blocksNumber; ++i) {
+    const auto &block = blocks[i];
+    if (block.contentOffset != contentOffset || !block.contentSize ||
+        block.size > block.contentSize || block.offset < sizeof(Header) ||
+        block.offset > header.tableOffset ||
+        block.size > header.tableOffset - block.offset) {
+      return false;
+    }
+    contentOffset += block.contentSize;
+  }
+  return contentOffset == header.contentSize;
+}
+
+Archive *Archive::Open(const char *view,
+                       const size_t size,
+                       const size_t cacheSize) {
+  if (!IsArchive(view, size)) {
+    return nullptr;
+  }
+  const auto &header = *reinterpret_cast<const Header *>(view);
+  const auto archive = static_cast<Archive *>(malloc(sizeof(Archive)));
+  if (!archive) {
+    return nullptr;
+  }
+  new (archive) Archive();
+  struct Scope {
+    Archive *archive;
+    ~Scope() { Close(archive); }
+  } scope{archive};  // NOLINT
+
+  archive->m_view = view;
+  archive->m_blocks =
+      reinterpret_cast<const Block *>(view + header.tableOffset);
+  archive->m_blocksNumber = static_cast<size_t>(header.blocksNumber);
+  archive->m_contentSize = static_cast<size_t>(header.contentSize);
+  archive->m_cacheSize = cacheSize;
+  archive->m_queue = archive->m_unlocked = {archive->m_blocksNumber,
+                                            archive->m_blocksNumber};
+  SYSTEM_INFO system;
+  GetSystemInfo(&system);
+  archive->m_pageSize = system.dwPageSize;
+  archive->m_threadsNumber = system.dwNumberOfProcessors;
+
+  archive->m_slots = static_cast<Slot *>(
+      calloc(archive->m_blocksNumber, sizeof(*archive->m_slots)));
+  if (!archive->m_slots) {
+    return nullptr;
+  }
+  archive->m_content = static_cast<char *>(VirtualAlloc(
+      nullptr, archive->m_contentSize, MEM_RESERVE, PAGE_NOACCESS));
+  if (!archive->m_content) {
+    return nullptr;
+  }
+  archive->m_work = CreateThreadpoolWork(
+      [](PTP_CALLBACK_INSTANCE, PVOID context, PTP_WORK) {
+        static_cast<Archive *>(context)->ExtractQueued();
+      },
+      archive, nullptr);
+  if (!archive->m_work) {
+    return nullptr;
+  }
+  scope.archive = nullptr;
+  return archive;
+}
+
+void Archive::Close(Archive *archive) {
+  if (!archive) {
+    return;
+  }
+  archive->~Archive();
+  free(archive);
+}
+
+Archive::~Archive() {
+  if (m_work) {
+    WaitForThreadpoolWorkCallbacks(static_cast<PTP_WORK>(m_work), FALSE);
+    CloseThreadpoolWork(static_cast<PTP_WORK>(m_work));
+  }
+  if (m_content) {
+    VirtualFree(m_content, 0, MEM_RELEASE);
+  }
+  free(m_slots);
+}
+
+void Archive::GetBlock(const size_t pos, size_t &begin, size_t &end) const {
+  const auto &block = m_blocks[FindBlock(pos)];
+  begin = static_cast<size_t>(block.contentOffset);
+  end = begin + block.contentSize;
+}
+
+bool Archive::Lock(const size_t begin, const size_t end) {
+  assert(begin < end);
+  assert(end <= m_contentSize);
+  const auto first = FindBlock(begin);
+  const auto last = FindBlock(end - 1) + 1;
+  AcquireSRWLockExclusive(&m_lock);
+  // Blocks are locked before extraction, so they are not evicted after it.
+  for (auto i = first; i < last; ++i) {
+    auto &slot = m_slots[i];
+    if (!slot.locksNumber++ && slot.state == Slot::STATE_EXTRACTED) {
+      Remove(m_unlocked, i);
+      m_unlockedSize -= m_blocks[i].contentSize;
+    }
+  }
+  const auto queuedNumber = Queue(first, last);
+  ReleaseSRWLockExclusive(&m_lock);
+  // The calling thread extracts blocks too, so one thread is not submitted.
+  if (queuedNumber > 1) {
+    Submit(queuedNumber - 1);
+  }
+
+  void *decompressor = nullptr;
+  auto isExtracted = true;
+  AcquireSRWLockExclusive(&m_lock);
+  for (auto i = first; i < last; ++i) {
+    if (m_slots[i].state == Slot::STATE_QUEUED) {
+      Remove(m_queue, i);
+      Extract(i, decompressor);
+    }
+  }
+  for (auto i = first; i < last;) {
+    const auto state = m_slots[i].state;
+    if (state == Slot::STATE_QUEUED || state == Slot::STATE_EXTRACTING) {
+      SleepConditionVariableSRW(&m_extracted, &m_lock, INFINITE, 0);
+      continue;
+    }
+    // Pages of a block are not committed if there is no memory.
+    if (state != Slot::STATE_EXTRACTED) {
+      isExtracted = false;
+    }
+    ++i;
+  }
+  if (!isExtracted) {
+    for (auto i = first; i < last; ++i) {
+      auto &slot = m_slots[i];
+      if (!--slot.locksNumber && slot.state == Slot::STATE_EXTRACTED) {
+        Push(m_unlocked, i);
+        m_unlockedSize += m_blocks[i].contentSize;
+      }
+    }
+    Evict();
+  }
+  ReleaseSRWLockExclusive(&m_lock);
+  if (decompressor) {
+    CloseDecompressor(static_cast<DECOMPRESSOR_HANDLE>(decompressor));
+  }
+  return isExtracted;
+}
+
+void Archive::Unlock(const size_t begin, const size_t end) {
+  assert(begin < end);
+  assert(end <= m_contentSize);
+  const auto last = FindBlock(end - 1) + 1;
+  AcquireSRWLockExclusive(&m_lock);
+  for (auto i = FindBlock(begin); i < last; ++i) {
+    auto &slot = m_slots[i];
+    assert(slot.locksNumber > 0);
+    if (!--slot.locksNumber && slot.state == Slot::STATE_EXTRACTED) {
+      Push(m_unlocked, i);
+      m_unlockedSize += m_blocks[i].contentSize;
+    }
+  }
+  Evict();
+  ReleaseSRWLockExclusive(&m_lock);
+}
+
+void Archive::Prefetch(const size_t begin, const size_t end) {
+  assert(begin < end);
+  assert(end <= m_contentSize);
+  AcquireSRWLockExclusive(&m_lock);
+  const auto queuedNumber = Queue(FindBlock(begin), FindBlock(end - 1) + 1);
+  ReleaseSRWLockExclusive(&m_lock);
+  Submit(queuedNumber);
+}
+
+void Archive::Push(List &list, const size_t index) {
+  auto &slot = m_slots[index];
+  slot.prev = list.last;
+  slot.next = m_blocksNumber;
+  (list.last < m_blocksNumber ? m_slots[list.last].next : list.first) = index;
+  list.last = index;
+}
+
+void Archive::Remove(List &list, const size_t index) {
+  auto &slot = m_slots[index];
+  (slot.prev < m_blocksNumber ? m_slots[slot.prev].next : list.first) =
+      slot.next;
+  (slot.next < m_blocksNumber ? m_slots[slot.next].prev : list.last) =
+      slot.prev;
+}
+
+size_t Archive::Queue(const size_t first, const size_t last) {
+  size_t result = 0;
+  for (auto i = first; i < last; ++i) {
+    auto &slot = m_slots[i];
+    if (slot.state != Slot::STATE_NONE) {
+      continue;
+    }
+    size_t begin;
+    size_t end;
+    GetPages(i, begin, end);
+    if (begin < end && !VirtualAlloc(m_content + begin, end - begin,
+                                     MEM_COMMIT, PAGE_READWRITE)) {
+      continue;
+    }
+    slot.state = Slot::STATE_QUEUED;
+    Push(m_queue, i);
+    ++result;
+  }
+  return result;
+}
+
+void Archive::Submit(const size_t threadsNumber) {
+  for (size_t i = 0; i < threadsNumber && i < m_threadsNumber; ++i) {
+    SubmitThreadpoolWork(static_cast<PTP_WORK>(m_work));
+  }
+}
+
+void Archive::ExtractQueued() {
+  void *decompressor = nullptr;
+  AcquireSRWLockExclusive(&m_lock);
+  while (m_queue.first < m_blocksNumber) {
+    const auto index = m_queue.first;
+    Remove(m_queue, index);
+    Extract(index, decompressor);
+  }
+  ReleaseSRWLockExclusive(&m_lock);
+  if (decompressor) {
+    CloseDecompressor(static_cast<DECOMPRESSOR_HANDLE>(decompressor));
+  }
+}
+
+void Archive::Extract(const size_t index, void *&decompressor) {
+  auto &slot = m_slots[index];
+  assert(slot.state == Slot::STATE_QUEUED);
+  slot.state = Slot::STATE_EXTRACTING;
+  ReleaseSRWLockExclusive(&m_lock);
+  // Pages of the block are committed and other threads don't read it, so
+  // the block is written without the lock. Shared pages are written by
+  // neighbors at the same time, but each block has own bytes.
+  const auto &block = m_blocks[index];
+  const auto content = m_content + block.contentOffset;
+  auto isExtracted = true;
+  if (block.size == block.contentSize) {
+    memcpy(content, m_view + block.offset, block.size);
+  } else {
+    isExtracted = DecompressBlock(m_view + block.offset, block.size, content,
+                                  block.contentSize, decompressor);
+  }
+  AcquireSRWLockExclusive(&m_lock);
+
+  if (isExtracted) {
+    slot.state = Slot::STATE_EXTRACTED;
+    if (!slot.locksNumber) {
+      // A prefetched block waits for its reader in the cache.
+      Push(m_unlocked, index);
+      m_unlockedSize += block.contentSize;
+      Evict();
+    }
+  } else {
+    slot.state = Slot::STATE_FAILED;
+    size_t begin;
+    size_t end;
+    GetPages(index, begin, end);
+    if (begin < end) {
+      VirtualFree(m_content + begin, end - begin, MEM_DECOMMIT);
+    }
+  }
+  WakeAllConditionVariable(&m_extracted);
+}
+
+void Archive::Evict() {
+  while (m_unlockedSize > m_cacheSize) {
+    const auto index = m_unlocked.first;
+    Remove(m_unlocked, index);
+    m_unlockedSize -= m_blocks[index].contentSize;
+    m_slots[index].state = Slot::STATE_NONE;
+    size_t begin;
+    size_t end;
+    GetPages(index, begin, end);
+    if (begin < end) {
+      VirtualFree(m_content + begin, end - begin, MEM_DECOMMIT);
+    }
+  }
+}
+
+void Archive::GetPages(const size_t index, size_t &begin, size_t &end) const {
+  // A page is committed while any block on the page is used.
+  const auto &isUsed = [this, index](const size_t page) {
+    const auto pageEnd = page + m_pageSize;
+    for (auto i = FindBlock(page);
+         i < m_blocksNumber && m_blocks[i].contentOffset < pageEnd; ++i) {
+      if (i != index && m_slots[i].IsUsed()) {
+        return true;
+      }
+    }
+    return false;
+  };
+  const auto &block = m_blocks[index];
+  begin = static_cast<size_t>(block.contentOffset) & ~(m_pageSize - 1);
+  end = (static_cast<size_t>(block.contentOffset) + block.contentSize +
+         m_pageSize - 1) &
+        ~(m_pageSize - 1);
+  // Only the first and the last pages can have other blocks.
+  if (isUsed(begin)) {
+    begin += m_pageSize;
+  }
+  if (begin < end && isUsed(end - m_pageSize)) {
+    end -= m_pageSize;
+  }
+}
+
+size_t Archive::FindBlock(const size_t pos) const {
+  assert(pos < m_contentSize);
+  size_t begin = 0;
+  size_t end = m_blocksNumber;
+  while (end - begin > 1) {
+    const auto middle = begin + (end - begin) / 2;
+    if (m_blocks[middle].contentOffset <= pos) {
+      begin = middle;
+    } else {
+      end = middle;
+    }
+  }
+  return begin;
+}
@@ -0,0 +1,180 @@
+﻿//
+//    Created: 2019/04/26 11:20
+//     Author: Eugene V. Palchukovsky
+//     E-mail: eugene@palchukovsky.com
+//
+
+#pragma once
+
+namespace logReader {
+
+//! Archive is a seekable compressed file of log.
+/**
+ * The content is split into blocks at line ends and each block is compressed
+ * separately by XPRESS Huffman of the Windows Compression API. The table of
+ * blocks at the archive end has offsets of each block in the archive and in
+ * the content, so any block can be decompressed without previous blocks.
+ *
+ * An opened archive reserves address space for the whole content, and blocks
+ * are extracted to committed pages of it by Lock, which keeps them until
+ * Unlock, so records reading, the skip index, the time range search and
+ * random access work as for a not compressed file, without a temporary file
+ * on the disk. Blocks are decompressed in parallel on the thread pool, for
+ * the locked region and ahead of the reading by Prefetch. Blocks which are
+ * not locked are kept up to the cache size and are decommitted in the least
+ * recently used order, so memory of blocks which are not read doesn't depend
+ * on the archive size.
+ *
+ * Locked content is usual read-only memory, so it's read by any threads and
+ * by the system (like WriteFile from it). Thread-safe.
+ */
+class Archive {
+ public:
+  //! Default size of the content block in bytes.
+  enum : size_t { defaultBlockSize = 1 << 20 };
+  //! Default maximum size of not locked extracted blocks of one archive in
+  //! bytes.
+  enum : size_t { defaultCacheSize = 32 << 20 };
+
+  Archive(Archive &&) = delete;
+  Archive(const Archive &) = delete;
+  Archive &operator=(Archive &&) = delete;
+  Archive &operator=(const Archive &) = delete;
+
+  //! Create compresses the file of log to the archive.
+  /**
+   * @param[in] filePath Source file path.
+   * @param[in] archivePath Archive file path, the file is overwritten.
+   * @param[in] blockSize Maximum size of the content block, a block ends at
+   * the last line end in the block, if it has line ends.
+   * @return True at success, false at error.
+   */
+  static bool Create(const char *filePath,
+                     const char *archivePath,
+                     size_t blockSize = defaultBlockSize);
+
+  //! IsArchive returns true if the file content is an archive with valid
+  //! header and table of blocks. A file of log can start with the signature.
+  static bool IsArchive(const char *view, size_t size);
+
+  //! Open opens the archive without decompression.
+  /**
+   * @param[in] view Archive file content, it has to be valid until the
+   * archive is closed.
+   * @param[in] size Archive file size.
+   * @param[in] cacheSize Maximum size of extracted blocks, which are not
+   * locked.
+   * @return Archive which has to be closed by Close, or nullptr at error or
+   * if the content is not an archive.
+   */
+  static Archive *Open(const char *view,
+                       size_t size,
+                       size_t cacheSize = defaultCacheSize);
+
+  //! Close closes the archive, which is opened by Open, after extraction of
+  //! prefetched blocks.
+  static void Close(Archive *);
+
+  //! GetContent returns the read-only content, only locked regions of it are
+  //! readable.
+  const char *GetContent() const { return m_content; }
+
+  //! GetContentSize returns the content size in bytes.
+  size_t GetContentSize() const { return m_contentSize; }
+
+  //! GetBlock returns borders of the block with the content position.
+  void GetBlock(size_t pos, size_t &begin, size_t &end) const;
+
+  //! Lock extracts blocks of the content region and keeps them until Unlock.
+  /**
+   * Blocks, which are not extracted yet, are decompressed by the calling
+   * thread and in parallel on the thread pool. Blocks, which are extracted
+   * by other threads, are waited.
+   *
+   * @param[in] begin Region begin offset.
+   * @param[in] end Region end offset, has to be after the begin.
+   * @return True at success, false at error (blocks are not locked).
+   */
+  bool Lock(size_t begin, size_t end);
+
+  //! Unlock unlocks blocks of the region, which is locked by Lock.
+  void Unlock(size_t begin, size_t end);
+
+  //! Prefetch starts extraction of blocks of the region on the thread pool
+  //! and doesn't wait for it.
+  void Prefetch(size_t begin, size_t end);
+
+ private:
+  struct Header;
+  struct Block;
+  struct Slot;
+
+  //! List is a list of blocks, which are linked by their slots.
+  struct List {
+    size_t first;
+    size_t last;
+  };
+
+  Archive() = default;
+  ~Archive();
+
+  //! Push adds the block to the list end.
+  void Push(List &, size_t index);
+
+  //! Remove removes the block from the list.
+  void Remove(List &, size_t index);
+
+  //! Queue commits pages of not extracted blocks of the range and adds them
+  //! to the extraction queue. Has to be called under the lock.
+  /**
+   * @return Number of queued blocks.
+   */
+  size_t Queue(size_t first, size_t last);
+
+  //! Submit submits extraction of queued blocks by the number of threads of
+  //! the thread pool.
+  void Submit(size_t threadsNumber);
+
+  //! ExtractQueued extracts blocks from the extraction queue until it's
+  //! empty.
+  void ExtractQueued();
+
+  //! Extract extracts the block, which is taken from the queue by the
+  //! calling thread. Has to be called under the lock, which is released for
+  //! decompression.
+  void Extract(size_t index, void *&decompressor);
+
+  //! Evict decommits the least recently used not locked blocks over the cache
+  //! size. Has to be called under the lock.
+  void Evict();
+
+  //! GetPages returns pages of the block, which are not shared with other
+  //! blocks in extraction or extracted.
+  void GetPages(size_t index, size_t &begin, size_t &end) const;
+
+  //! FindBlock returns the index of the block with the content position.
+  size_t FindBlock(size_t pos) const;
+
+  const char *m_view = nullptr;
+  const Block *m_blocks = nullptr;
+  size_t m_blocksNumber = 0;
+  //! Reserved address space of the content.
+  char *m_content = nullptr;
+  size_t m_contentSize = 0;
+  size_t m_pageSize = 0;
+  size_t m_cacheSize = 0;
+  size_t m_threadsNumber = 0;
+  void *m_work{nullptr};
+  SRWLOCK m_lock = SRWLOCK_INIT;
+  //! Signaled when a block extraction is completed.
+  CONDITION_VARIABLE m_extracted = CONDITION_VARIABLE_INIT;
+  //! State of each block.
+  Slot *m_slots = nullptr;
+  //! Blocks which wait for extraction.
+  List m_queue{};
+  //! Extracted blocks which are not locked, from the least recently used.
+  List m_unlocked{};
+  size_t m_unlockedSize = 0;
+};
+
+}  // namespace logReader
@@ -0,0 +1,91 @@
+﻿//
+//    Created: 2019/04/15 20:16
+//     Author: Eugene V. Palchukovsky
+//     E-mail: eugene@palchukovsky.com
+//
+
+#include "Prec.hpp"
+#include "Context.hpp"
+
+using namespace logReader;
+
+Context::~Context() { free(m_ring); }
+
+bool Context::Set(const size_t before, const size_t after) {
+  Span *ring = nullptr;
+  if (before) {
+    ring = static_cast<Span *>(malloc(before * sizeof(Span)));
+    if (!ring) {
+      return false;
+    }
+  }
+  free(m_ring);
+  m_ring = ring;
+  m_before = before;
+  m_after = after;
+  Reset();
+  return true;
+}
+
+void Context::Reset() {
+  m_ringBegin = m_ringSize = 0;
+  m_afterLeft = 0;
+  m_hasRecord = false;
+  m_isGap = m_hasOutput;
+}
+
+bool Context::Add(const char *begin, const char *end, const bool isMatched) {
+  assert(!m_hasRecord);
+  assert(!isMatched || m_afterLeft == 0 || m_ringSize == 0);
+  if (isMatched) {
+    // The ring will be returned before this record.
+    m_afterLeft = m_after;
+  } else if (m_afterLeft) {
+    assert(m_ringSize == 0);
+    --m_afterLeft;
+  } else {
+    if (!m_before) {
+      m_isGap = true;
+      return false;
+    }
+    if (m_ringSize < m_before) {
+      ++m_ringSize;
+    } else {
+      // The oldest record is out of any window.
+      m_ringBegin = (m_ringBegin + 1) % m_before;
+      m_isGap = true;
+    }
+    auto &span = m_ring[(m_ringBegin + m_ringSize - 1) % m_before];
+    span.begin = begin;
+    span.end = end;
+    return false;
+  }
+  m_record.begin = begin;
+  m_record.end = end;
+  m_isRecordMatched = isMatched;
+  m_hasRecord = true;
+  return true;
+}
+
+bool Context::Pop(Record &result) {
+  if (!m_hasRecord) {
+    return false;
+  }
+  if (m_ringSize) {
+    const auto &span = m_ring[m_ringBegin];
+    m_ringBegin = (m_ringBegin + 1) % m_before;
+    --m_ringSize;
+    result.begin = span.begin;
+    result.end = span.end;
+    result.isMatched = false;
+  } else {
+    result.begin = m_record.begin;
+    result.end = m_record.end;
+    result.isMatched = m_isRecordMatched;
+    m_hasRecord = false;
+  }
+  result.isGap = m_isGap && m_hasOutput;
+  m_isGap = false;
+  m_hasOutput = true;
+  return true;
+}
@@ -0,0 +1,86 @@
+﻿//
+//    Created: 2019/04/15 20:10
+//     Author: Eugene V. Palchukovsky
+//     E-mail: eugene@palchukovsky.com
+//
+
+#pragma once
+
+namespace logReader {
+
+//! Context selects records around matched records.
+/**
+ * Keeps only borders of the recent records in a ring, the content stays in the
+ * file mapping. Each record is returned not more than once, so overlapped
+ * windows are merged.
+ */
+class Context {
+ public:
+  //! Record is a record from the context output.
+  struct Record {
+    const char *begin;
+    const char *end;
+    //! True if the record is matched, false if it's a record around matched.
+    bool isMatched;
+    //! True if there are skipped records between this record and the
+    //! previous returned.
+    bool isGap;
+  };
+
+  Context() = default;
+  Context(Context &&) = default;
+  Context(const Context &) = delete;
+  Context &operator=(Context &&) = delete;
+  Context &operator=(const Context &) = delete;
+  ~Context();
+
+  //! Set sets number of records to return before and after each matched
+  //! record and drops stored records.
+  /**
+   * @return True at success, false at error (previous state still be active).
+   */
+  bool Set(size_t before, size_t after);
+
+  //! IsSet returns true if there are records to return around matched.
+  bool IsSet() const { return m_before || m_after; }
+
+  //! Reset drops stored records, for example, after reading position change.
+  void Reset();
+
+  //! Add adds the next read record.
+  /**
+   * @return True if there is output, false if the record is stored as
+   * a possible record before the next matched.
+   * @sa Pop
+   */
+  bool Add(const char *begin, const char *end, bool isMatched);
+
+  //! Pop extracts the next output record.
+  /**
+   * @return True at success, false if there is no output.
+   */
+  bool Pop(Record &);
+
+ private:
+  struct Span {
+    const char *begin;
+    const char *end;
+  };
+
+  size_t m_before = 0;
+  size_t m_after = 0;
+  //! Ring of records before matched record, has size m_before.
+  Span *m_ring{nullptr};
+  size_t m_ringBegin = 0;
+  size_t m_ringSize = 0;
+  //! Number of records after matched record which are still to return.
+  size_t m_afterLeft = 0;
+  //! The last added record which is to return after the ring.
+  Span m_record{};
+  bool m_isRecordMatched = false;
+  bool m_hasRecord = false;
+  bool m_isGap = false;
+  bool m_hasOutput = false;
+};
+
+}  // namespace logReader
@@ -6,86 +6,504 @@
 
 #include "Prec.hpp"
 #include "File.hpp"
+#include "Mapping.hpp"
+#include "MaskMatcher.hpp"
+#include "Scan.hpp"
 
 using namespace logReader;
 
-File::File(const char *filePath)
-    : m_file(CreateFile(filePath,
-                        GENERIC_READ,
-                        0,
-                        nullptr,
-                        OPEN_EXISTING,
-                        FILE_ATTRIBUTE_NORMAL,
-                        nullptr)) {
-  if (m_file == INVALID_HANDLE_VALUE) {
+File::File(const char *filePath) : m_mapping(Mapping::Acquire(filePath)) {
+  if (!m_mapping) {
     return;
   }
-  LARGE_INTEGER size;
-  if (!GetFileSizeEx(m_file, &size)) {
-    Close();
+  m_view = m_mapping->GetBegin();
+  m_size = m_end = m_mapping->GetSize();
+  m_lockedEnd = m_mapping->IsArchive() ? 0 : m_size;
+}
+
+File::~File() { Close(); }
+
+void File::Close() {
+  if (!m_mapping) {
     return;
   }
-  m_size = size.QuadPart;
-  m_mapping = CreateFileMapping(m_file, nullptr, PAGE_READONLY, size.u.HighPart,
-                                size.u.LowPart, nullptr);
-  if (!m_mapping) {
+  for (size_t i = 0; i < m_locksNumber; ++i) {
+    m_mapping->Unlock(m_locks[i].begin, m_locks[i].end);
+  }
+  free(m_locks);
+  m_locks = nullptr;
+  m_locksNumber = m_locksCapacity = 0;
+  m_mapping->Unlock(m_sample.begin, m_sample.end);
+  m_sample = {0, 0};
+  Mapping::Release(m_mapping);
+  m_mapping = nullptr;
+  m_view = nullptr;
+}
+
+bool File::IsOk() const { return m_mapping != nullptr && !m_isEnd; }
+
+bool File::ReadRecord(const char *&begin, const char *&end) {
+  if (!IsOk()) {
+    // Records, which are read before the end, are valid till this call.
     Close();
+    return false;
+  }
+  assert(m_pos <= m_end);
+  ReadAhead();
+  // The content of an archive is read till the locked end, the next block is
+  // locked when the reading reaches it. A corrupted block ends the reading.
+  if (m_lockedEnd < m_pos) {
+    m_lockedEnd = m_pos;
+  }
+  auto contentEnd = m_view + (m_lockedEnd < m_end ? m_lockedEnd : m_end);
+  const auto &lockNext = [this, &contentEnd]() {
+    if (!LockNext()) {
+      return false;
+    }
+    contentEnd = m_view + (m_lockedEnd < m_end ? m_lockedEnd : m_end);
+    return true;
+  };
+  const auto &skipLineEnds = [&contentEnd, &lockNext](const char *it) {
+    while ((it = SkipLineEnds(it, contentEnd)) == contentEnd && lockNext()) {
+    }
+    return it;
+  };
+  const auto &findLineEnd = [&contentEnd, &lockNext](const char *it) {
+    while ((it = FindLineEnd(it, contentEnd)) == contentEnd && lockNext()) {
+    }
+    return it;
+  };
+
+  auto it = m_view + m_pos;
+  if (m_nextLineEnd) {
+    // The first line of this record has been already found by the previous
+    // record as its border.
+    assert(m_nextLineBegin >= it);
+    it = m_nextLineBegin;
+    end = m_nextLineEnd;
+    m_nextLineEnd = nullptr;
+  } else {
+    it = skipLineEnds(it);
+    if (it == contentEnd) {
+      if (m_isStatsCounting) {
+        m_bytesScanned += m_end - m_pos;
+      }
+      if (m_residentLimit) {
+        Release(m_end);
+      }
+      m_isEnd = true;
+      return false;
+    }
+    end = findLineEnd(it);
+  }
+  begin = it;
+  it = end;
+
+  if (m_recordStart) {
+    // Multiline record - continues until the next line which starts a record.
+    for (;;) {
+      const auto lineBegin = skipLineEnds(it);
+      if (lineBegin == contentEnd) {
+        break;
+      }
+      const auto lineEnd = findLineEnd(lineBegin);
+      if (m_recordStart->Match(lineBegin, lineEnd)) {
+        m_nextLineBegin = lineBegin;
+        m_nextLineEnd = lineEnd;
+        break;
+      }
+      it = end = lineEnd;
+    }
+  }
+
+  const auto pos = static_cast<size_t>(it - m_view);
+  if (m_isStatsCounting) {
+    m_bytesScanned += pos - m_pos;
+    ++m_recordsNumber;
+  }
+  m_pos = pos;
+  if (m_residentLimit && m_pos > m_releasedEnd &&
+      m_pos - m_releasedEnd > m_residentLimit) {
+    // Half of the limit is kept, so pages are released by large ranges.
+    Release(m_pos - m_residentLimit / 2);
+  }
+  return true;
+}
+
+void File::SetReadAhead(const size_t size) { m_readAhead = size; }
+
+void File::ReadAhead() {
+  if (!m_readAhead || m_readAheadEnd >= m_end ||
+      m_readAheadEnd > m_pos + m_readAhead / 2) {
     return;
   }
-  m_view = static_cast<const char *>(
-      MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
-  if (!m_view) {
-    Close();
+  const auto begin = m_readAheadEnd > m_pos ? m_readAheadEnd : m_pos;
+  const auto end =
+      m_end - m_pos > m_readAhead ? m_pos + m_readAhead : m_end;
+  // Blocks of an archive are decompressed ahead in parallel.
+  m_mapping->Prefetch(begin, end);
+  m_readAheadEnd = end;
+}
+
+void File::SetScanOnce(const size_t residentLimit) {
+  m_residentLimit = residentLimit;
+}
+
+void File::Release(const size_t end) {
+  // Archive content is not backed by the file, released pages would be
+  // written to the paging file, so its blocks are unlocked and are dropped
+  // from the cache of the archive first. Records, which are read before the
+  // end, are valid until the next reading.
+  if (m_mapping->IsArchive()) {
+    if (end < m_end) {
+      Unlock(end);
+    }
+    return;
+  }
+  // The page with the reading position is released only at the end.
+  const size_t pageSize = 4096;
+  const auto begin = m_releasedEnd & ~(pageSize - 1);
+  const auto releasedEnd = end == m_size ? end : end & ~(pageSize - 1);
+  if (releasedEnd <= begin) {
     return;
   }
+  // Unlocking of not locked pages removes them from the working set, the
+  // call "fails" as pages are not locked. Pages stay in the system cache as
+  // not used pages and they are read again if the record is accessed.
+  VirtualUnlock(const_cast<char *>(m_view + begin), releasedEnd - begin);
+  if (m_isStatsCounting) {
+    m_bytesReleased += releasedEnd - begin;
+  }
+  m_releasedEnd = releasedEnd;
 }
 
-File::~File() { Close(); }
+void File::SetRecordStart(const MaskMatcher *recordStart) {
+  m_recordStart = recordStart;
+  m_nextLineEnd = nullptr;
+}
 
-void File::Close() {
-  if (m_view) {
-    UnmapViewOfFile(m_view);
-    m_view = nullptr;
+void File::AddStats(Stats &stats) const {
+  stats.bytesScanned += m_bytesScanned;
+  stats.recordsRead += m_recordsNumber;
+  stats.bytesReleased += m_bytesReleased;
+}
+
+void File::SetRange(const size_t begin, const size_t end) {
+  assert(begin <= end);
+  assert(end <= m_size);
+  m_pos = begin;
+  m_end = end;
+  if (m_mapping->IsArchive()) {
+    m_lockedEnd = begin;
+  }
+  m_nextLineEnd = nullptr;
+  m_readAheadEnd = 0;
+  m_releasedEnd = begin;
+  m_isEnd = false;
+}
+
+void File::Seek(const size_t pos) {
+  assert(pos >= m_pos);
+  m_pos = pos < m_end ? pos : m_end;
+  m_nextLineEnd = nullptr;
+}
+
+bool File::Lock(size_t begin, size_t end) {
+  if (!m_mapping) {
+    return false;
+  }
+  if (!m_mapping->IsArchive() || begin >= end) {
+    return true;
+  }
+  size_t blockEnd;
+  m_mapping->GetBlock(begin, begin, blockEnd);
+  if (end > blockEnd) {
+    size_t blockBegin;
+    m_mapping->GetBlock(end - 1, blockBegin, end);
+  } else {
+    end = blockEnd;
+  }
+
+  // Locked regions from the first to the last are merged with the region.
+  // Blocks of the region are locked again, so blocks of merged regions are
+  // unlocked once after that.
+  size_t first = 0;
+  for (; first < m_locksNumber && m_locks[first].end < begin; ++first) {
+  }
+  auto last = first;
+  for (; last < m_locksNumber && m_locks[last].begin <= end; ++last) {
   }
-  if (m_mapping) {
-    CloseHandle(m_mapping);
-    m_mapping = nullptr;
+  if (first == last && m_locksNumber == m_locksCapacity) {
+    const auto capacity = m_locksCapacity ? m_locksCapacity * 2 : 16;
+    const auto locks =
+        static_cast<Region *>(realloc(m_locks, capacity * sizeof(*m_locks)));
+    if (!locks) {
+      return false;
+    }
+    m_locks = locks;
+    m_locksCapacity = capacity;
   }
-  if (m_file != INVALID_HANDLE_VALUE) {
-    CloseHandle(m_file);
-    m_file = INVALID_HANDLE_VALUE;
+  if (!m_mapping->Lock(begin, end)) {
+    return false;
   }
+  for (auto i = first; i < last; ++i) {
+    const auto &lock = m_locks[i];
+    const auto lockBegin = lock.begin > begin ? lock.begin : begin;
+    const auto lockEnd = lock.end < end ? lock.end : end;
+    m_mapping->Unlock(lockBegin, lockEnd);
+  }
+
+  if (first == last) {
+    memmove(m_locks + first + 1, m_locks + first,
+            (m_locksNumber - first) * sizeof(*m_locks));
+    ++m_locksNumber;
+  } else {
+    if (m_locks[first].begin < begin) {
+      begin = m_locks[first].begin;
+    }
+    if (m_locks[last - 1].end > end) {
+      end = m_locks[last - 1].end;
+    }
+    memmove(m_locks + first + 1, m_locks + last,
+            (m_locksNumber - last) * sizeof(*m_locks));
+    m_locksNumber -= last - first - 1;
+  }
+  m_locks[first] = {begin, end};
+  return true;
 }
 
-bool File::IsOk() const { return m_file != INVALID_HANDLE_VALUE; }
+bool File::LockNext() {
+  if (m_lockedEnd >= m_end) {
+    return false;
+  }
+  size_t begin;
+  size_t end;
+  m_mapping->GetBlock(m_lockedEnd, begin, end);
+  if (!Lock(begin, end)) {
+    return false;
+  }
+  m_lockedEnd = end;
+  return true;
+}
 
-bool File::ReadRecord(const char *&begin, const char *&end) {
-  if (!IsOk()) {
+void File::Unlock(size_t end) {
+  if (end < m_size) {
+    size_t blockEnd;
+    m_mapping->GetBlock(end, end, blockEnd);
+  }
+  size_t number = 0;
+  for (; number < m_locksNumber && m_locks[number].begin < end; ++number) {
+    auto &lock = m_locks[number];
+    if (lock.end > end) {
+      m_mapping->Unlock(lock.begin, end);
+      lock.begin = end;
+      break;
+    }
+    m_mapping->Unlock(lock.begin, lock.end);
+  }
+  memmove(m_locks, m_locks + number,
+          (m_locksNumber - number) * sizeof(*m_locks));
+  m_locksNumber -= number;
+}
+
+bool File::Sample(const size_t begin, const size_t end) const {
+  if (!m_mapping->Lock(begin, end)) {
     return false;
   }
-  assert(m_pos <= m_size);
-  if (m_pos >= m_size) {
-    Close();
+  m_mapping->Unlock(m_sample.begin, m_sample.end);
+  m_sample = {begin, end};
+  return true;
+}
+
+size_t File::CountLines(const size_t begin, const size_t end) const {
+  assert(begin <= end);
+  assert(end <= m_size);
+  if (!m_mapping->IsArchive()) {
+    return logReader::CountLines(m_view + begin, m_view + end,
+                                 m_view + m_size);
+  }
+  // The symbol after the counted block is checked too.
+  size_t result = 0;
+  for (auto pos = begin; pos < end;) {
+    size_t blockBegin;
+    size_t blockEnd;
+    m_mapping->GetBlock(pos, blockBegin, blockEnd);
+    const auto countEnd = blockEnd < end ? blockEnd : end;
+    const auto lockEnd = countEnd < m_size ? countEnd + 1 : countEnd;
+    if (!m_mapping->Lock(pos, lockEnd)) {
+      break;
+    }
+    result += logReader::CountLines(m_view + pos, m_view + countEnd,
+                                    m_view + m_size);
+    m_mapping->Unlock(pos, lockEnd);
+    pos = countEnd;
+  }
+  return result;
+}
+
+size_t File::FindLineBegin(const size_t pos) const {
+  assert(m_view);
+  assert(m_pos <= pos);
+  assert(pos <= m_size);
+  // Blocks before the position are sampled one by one until the line begin.
+  auto sampleBegin = pos;
+  auto it = pos;
+  for (;;) {
+    for (; it > sampleBegin && !IsLineEnd(m_view[it - 1]); --it) {
+    }
+    if (it > sampleBegin || it <= m_pos) {
+      return it;
+    }
+    size_t begin;
+    size_t end;
+    m_mapping->GetBlock(it - 1, begin, end);
+    if (begin < m_pos) {
+      begin = m_pos;
+    }
+    if (!Sample(begin, pos)) {
+      return m_pos;
+    }
+    sampleBegin = begin;
+  }
+}
+
+bool File::FindRecord(size_t pos, const char *&begin, const char *&end) const {
+  if (!m_view) {
+    return false;
+  }
+  if (pos > m_size) {
+    pos = m_size;
+  }
+  // The symbol before the position is checked too, the next block is sampled
+  // when the search reaches the sampled end.
+  const auto sampleBegin = pos > 0 ? pos - 1 : 0;
+  auto sampleEnd = sampleBegin;
+  const auto &sampleNext = [this, sampleBegin, &sampleEnd]() {
+    if (sampleEnd >= m_size) {
+      return false;
+    }
+    size_t blockBegin;
+    size_t blockEnd;
+    m_mapping->GetBlock(sampleEnd, blockBegin, blockEnd);
+    if (!Sample(sampleBegin, blockEnd)) {
+      return false;
+    }
+    sampleEnd = blockEnd;
+    return true;
+  };
+  if (!sampleNext()) {
+    return false;
+  }
+  auto contentEnd = m_view + sampleEnd;
+  const auto &find = [this, &contentEnd, &sampleEnd, &sampleNext](
+                         const char *it,
+                         const char *(*scan)(const char *, const char *)) {
+    while ((it = scan(it, contentEnd)) == contentEnd && sampleNext()) {
+      contentEnd = m_view + sampleEnd;
+    }
+    return it;
+  };
+
+  auto it = m_view + pos;
+  if (pos > 0 && it < m_view + m_size && !IsLineEnd(it[-1])) {
+    // The position is in the middle of a line, the record starts with the
+    // next one.
+    it = find(it, FindLineEnd);
+  }
+  it = find(it, SkipLineEnds);
+  if (it == contentEnd) {
+    return false;
+  }
+  begin = it;
+  end = find(it, FindLineEnd);
+  return true;
+}
+
+bool File::GetRecordAt(const size_t pos,
+                       const size_t window,
+                       const char *&begin,
+                       const char *&end,
+                       size_t &size) const {
+  if (!m_view || pos < m_pos || pos >= m_end) {
+    return false;
+  }
+  const auto regionBegin = m_view + m_pos;
+  const auto regionEnd = m_view + m_end;
+  const auto windowBegin =
+      pos - m_pos > window ? m_view + pos - window : regionBegin;
+  const auto windowEnd = m_end - pos > window ? m_view + pos + window
+                                              : regionEnd;
+  // Symbols around the window are checked too.
+  if (!Sample(static_cast<size_t>(windowBegin - m_view) -
+                  (windowBegin > regionBegin ? 1 : 0),
+              static_cast<size_t>(windowEnd - m_view) +
+                  (windowEnd < regionEnd ? 1 : 0))) {
+    return false;
+  }
+  const auto &findLineBegin = [windowBegin](const char *it) {
+    for (; it > windowBegin && !IsLineEnd(it[-1]); --it) {
+    }
+    return it;
+  };
+  // Lines, which are cut by the window, are not found.
+  const auto &isBeginCut = [regionBegin, windowBegin](const char *it) {
+    return it == windowBegin && it > regionBegin && !IsLineEnd(it[-1]);
+  };
+  const auto &isEndCut = [regionEnd, windowEnd](const char *it) {
+    return it == windowEnd && it < regionEnd && !IsLineEnd(*it);
+  };
+
+  // Line ends belong to the line before them.
+  auto it = m_view + pos;
+  for (; it > windowBegin && IsLineEnd(*it); --it) {
+  }
+  if (IsLineEnd(*it)) {
+    return false;
+  }
+  begin = findLineBegin(it);
+  end = FindLineEnd(it, windowEnd);
+  if (isBeginCut(begin) || isEndCut(end)) {
     return false;
   }
 
-  auto isStarted = false;
-  for (; m_pos < m_size; ++m_pos) {
-    const auto &ch = m_view[m_pos];
-    if (ch == '\r' || ch == '\n') {
-      if (!isStarted) {
-        continue;
+  if (m_recordStart) {
+    // The first line of the region starts a record even if it doesn't match.
+    while (begin > regionBegin &&
+           !m_recordStart->Match(begin, FindLineEnd(begin, windowEnd))) {
+      auto prevEnd = begin;
+      for (; prevEnd > windowBegin && IsLineEnd(prevEnd[-1]); --prevEnd) {
+      }
+      if (prevEnd == regionBegin) {
+        break;
+      }
+      if (prevEnd == windowBegin) {
+        return false;
+      }
+      begin = findLineBegin(prevEnd);
+      if (isBeginCut(begin)) {
+        return false;
       }
-      end = &ch;
-      return true;
     }
-    if (!isStarted) {
-      begin = &ch;
-      isStarted = true;
+    for (;;) {
+      const auto lineBegin = SkipLineEnds(end, windowEnd);
+      if (lineBegin == windowEnd) {
+        if (windowEnd < regionEnd) {
+          // The next record start could be after the window.
+          return false;
+        }
+        break;
+      }
+      const auto lineEnd = FindLineEnd(lineBegin, windowEnd);
+      if (isEndCut(lineEnd)) {
+        return false;
+      }
+      if (m_recordStart->Match(lineBegin, lineEnd)) {
+        break;
+      }
+      end = lineEnd;
     }
   }
-  if (!isStarted) {
-    Close();
-  }
-  return isStarted;
+
+  size = static_cast<size_t>(SkipLineEnds(end, windowEnd) - begin);
+  return true;
 }
@@ -6,11 +6,27 @@
 
 #pragma once
 
+#include "Stats.hpp"
+
 namespace logReader {
 
+class Mapping;
+class MaskMatcher;
+
 //! File provides an access to a file of log.
+/**
+ * The file content is shared with other readers of the same file by Mapping,
+ * the reading position is own for each File.
+ *
+ * Blocks of an archive are locked by the reading and by Lock until the file
+ * is closed, so records are valid as records of a plain file. Random access
+ * locks the sampled region until the next random access.
+ */
 class File {
  public:
+  //! Default size of the region which is read ahead.
+  enum : size_t { defaultReadAhead = 4 * 1024 * 1024 };
+
   explicit File(const char *filePath);
   File(File &&) = default;
   File(const File &) = delete;
@@ -32,6 +48,14 @@ class File {
 
   //! ReadRecord reads the next record.
   /**
+   * By default each line is a record, empty lines are skipped. If the record
+   * start is set - the record continues until the next line, that starts a
+   * record, so continuation lines (like stack traces) are in the same record.
+   *
+   * The file is closed by the call after the one, which finds no more
+   * records, so records, which are read before, are valid till then.
+   *
+   * @sa SetRecordStart
    * @param[out] begin At success returns string begin.
    * @param[out] end At success returns string end.
    * @sa IsOk
@@ -39,12 +63,192 @@ class File {
    */
   bool ReadRecord(const char *&begin, const char *&end);
 
+  //! SetRecordStart sets matcher for the lines which start records.
+  /**
+   * @param[in] recordStart Matcher, has to be alive while it's set, or nullptr
+   * to make each line a record.
+   * @sa ReadRecord
+   */
+  void SetRecordStart(const MaskMatcher *recordStart);
+
+  //! SetReadAhead sets size of file region after the reading position which
+  //! is requested to be loaded in memory before it's read.
+  /**
+   * The region is requested asynchronously, so disk reading is overlapped
+   * with records matching. Zero disables read-ahead.
+   */
+  void SetReadAhead(size_t size);
+
+  //! SetScanOnce limits size of the read region before the reading position,
+  //! which is kept in the process working set.
+  /**
+   * Pages of read records are released from the working set when the reading
+   * position passes the limit, so a long scan doesn't keep the whole file in
+   * memory and doesn't push out pages of other processes. Pages are not
+   * unmapped, records are still valid. Blocks of an archive are unlocked
+   * instead, so its records are valid only till half of the limit before the
+   * reading position. Zero disables the mode.
+   */
+  void SetScanOnce(size_t residentLimit);
+
+  //! SetStatsCounting enables or disables reading counters.
+  void SetStatsCounting(bool isEnabled) { m_isStatsCounting = isEnabled; }
+
+  //! AddStats adds reading counters to the statistics.
+  void AddStats(Stats &) const;
+
+  //! GetPos returns the reading position offset.
+  size_t GetPos() const { return m_pos; }
+
+  //! GetEnd returns the reading region end offset.
+  size_t GetEnd() const { return m_end; }
+
+  //! Seek moves the reading position forward.
+  /**
+   * @param[in] pos New position offset, has to be a line begin. It's limited
+   * by the reading region end.
+   */
+  void Seek(size_t pos);
+
+  //! GetSize returns file size in bytes.
+  size_t GetSize() const { return m_size; }
+
+  //! GetMapping returns the file content mapping or nullptr if the file is
+  //! closed.
+  const Mapping *GetMapping() const { return m_mapping; }
+
+  //! GetBegin returns the file content begin or nullptr if the file is closed.
+  const char *GetBegin() const { return m_view; }
+
+  //! Lock makes the content region readable until the file is closed.
+  /**
+   * The reading locks read records itself, the content of a plain file is
+   * always readable.
+   *
+   * @return True at success, false at error or if the file is closed.
+   */
+  bool Lock(size_t begin, size_t end);
+
+  //! CountLines counts line ends in the content region like
+  //! logReader::CountLines.
+  /**
+   * Blocks of an archive are locked only for the count, so a long region
+   * doesn't stay in memory.
+   */
+  size_t CountLines(size_t begin, size_t end) const;
+
+  //! FindLineBegin returns the begin offset of the line with the position,
+  //! or the reading position offset if the line starts before it.
+  size_t FindLineBegin(size_t pos) const;
+
+  //! SetRange restricts reading by the file region and moves reading position
+  //! to the region begin.
+  /**
+   * @param[in] begin Region begin offset, has to be a record begin.
+   * @param[in] end Region end offset.
+   */
+  void SetRange(size_t begin, size_t end);
+
+  //! FindRecord finds the first record which starts at or after the first
+  //! line begin at or after the position. Doesn't change reading position.
+  /**
+   * The record of an archive is valid until the next random access by
+   * FindRecord, GetRecordAt or FindLineBegin.
+   *
+   * @param[in] pos Offset to start search from.
+   * @param[out] begin At success returns string begin.
+   * @param[out] end At success returns string end.
+   * @return True at success, false if there are no more records or if the file
+   * is closed.
+   */
+  bool FindRecord(size_t pos, const char *&begin, const char *&end) const;
+
+  //! GetRecordAt finds the record of the reading region, which has the
+  //! position, or which line ends have it. Doesn't change reading position.
+  /**
+   * Only the record and lines before it till the record start are read, so
+   * a record at any position is found without reading the region begin.
+   * Lines are searched only in the window around the position, so a long
+   * record is not read whole. The record of an archive is valid until the
+   * next random access, like the one found by FindRecord.
+   *
+   * @param[in] pos Position offset.
+   * @param[in] window Maximum distance in bytes from the position to the
+   * record begin and to the end of the record with line ends after it.
+   * @param[out] begin At success returns record begin.
+   * @param[out] end At success returns record end.
+   * @param[out] size At success returns size of the record with line ends
+   * after it.
+   * @return True at success, false if the position is out of the reading
+   * region or in line ends before the first record, if the record is not in
+   * the window, or if the file is closed.
+   */
+  bool GetRecordAt(size_t pos,
+                   size_t window,
+                   const char *&begin,
+                   const char *&end,
+                   size_t &size) const;
+
  private:
-  void *m_file;
-  void *m_mapping{nullptr};
+  //! Region is a content region.
+  struct Region {
+    size_t begin;
+    size_t end;
+  };
+
+  //! LockNext locks the next block at the locked end for the reading.
+  /**
+   * @return True if the block is locked, false at error or if the locked end
+   * is the reading region end.
+   */
+  bool LockNext();
+
+  //! Sample locks the region for random access and unlocks the previous
+  //! sampled region.
+  bool Sample(size_t begin, size_t end) const;
+
+  //! Unlock unlocks locked blocks, which end till the offset.
+  void Unlock(size_t end);
+
+  //! ReadAhead requests the next file region if the reading position is
+  //! close to the end of the requested region.
+  void ReadAhead();
+
+  //! Release releases pages of the read region from the working set till the
+  //! offset.
+  void Release(size_t end);
+
+  const Mapping *m_mapping{nullptr};
   const char *m_view{nullptr};
   size_t m_pos = 0;
-  size_t m_size;
+  size_t m_size = 0;
+  size_t m_end = 0;
+  const MaskMatcher *m_recordStart{nullptr};
+  const char *m_nextLineBegin{nullptr};
+  const char *m_nextLineEnd{nullptr};
+  size_t m_readAhead = defaultReadAhead;
+  //! End of the region which is already requested.
+  size_t m_readAheadEnd = 0;
+  //! Size of the read region which is kept, zero if pages are not released.
+  size_t m_residentLimit = 0;
+  //! End of the region which is already released.
+  size_t m_releasedEnd = 0;
+  //! Locked regions of an archive, ordered, not adjacent and aligned by
+  //! blocks.
+  Region *m_locks{nullptr};
+  size_t m_locksNumber = 0;
+  size_t m_locksCapacity = 0;
+  //! End of the locked content after the reading position.
+  size_t m_lockedEnd = 0;
+  //! Region which is locked for random access.
+  mutable Region m_sample{0, 0};
+  //! True if there are no more records and the file has to be closed by the
+  //! next reading.
+  bool m_isEnd = false;
+  bool m_isStatsCounting = false;
+  uint64_t m_bytesScanned = 0;
+  uint64_t m_recordsNumber = 0;
+  uint64_t m_bytesReleased = 0;
 };
 
 }  // namespace logReader
@@ -0,0 +1,415 @@
+﻿//
+//    Created: 2019/04/23 19:05
+//     Author: Eugene V. Palchukovsky
+//     E-mail: eugene@palchukovsky.com
+//
+
+#include "Prec.hpp"
+#include "Filter.hpp"
+#include "MaskMatcher.hpp"
+
+using namespace logReader;
+
+//! Node is a mask or an operator of the filter expression.
+struct Filter::Node {
+  enum Type { TYPE_MASK, TYPE_NOT, TYPE_AND, TYPE_OR };
+
+  Type type;
+  //! Compiled mask, only for TYPE_MASK.
+  MaskMatcher *matcher;
+  //! Operands in the current check order.
+  Node **operands;
+  size_t operandsNumber;
+  //! Check time in processor ticks, number of checks and number of true
+  //! results, which are observed by the parent operator.
+  uint64_t ticks;
+  uint64_t checksNumber;
+  uint64_t passesNumber;
+  //! Number of checks since the last reorder of operands.
+  size_t checksSinceReorder;
+
+  //! Create creates a node, returns nullptr at error.
+  static Node *Create(Type type) {
+    const auto result = static_cast<Node *>(malloc(sizeof(Node)));
+    if (result) {
+      memset(result, 0, sizeof(*result));
+      result->type = type;
+    }
+    return result;
+  }
+
+  //! Destroy destroys the node with its operands.
+  static void Destroy(Node *node) {
+    if (!node) {
+      return;
+    }
+    for (size_t i = 0; i < node->operandsNumber; ++i) {
+      Destroy(node->operands[i]);
+    }
+    free(node->operands);
+    if (node->matcher) {
+      node->matcher->~MaskMatcher();
+      free(node->matcher);
+    }
+    free(node);
+  }
+
+  //! AddOperand moves the operand to the node. Operands of the same operator
+  //! are moved instead of the operand, so "(a AND b) AND c" is "a AND b AND
+  //! c", and its operands are reordered together.
+  /**
+   * @return True at success, false at error (the operand still belongs to
+   * the caller).
+   */
+  bool AddOperand(Node *operand) {
+    const auto isMerged = operand->type == type && type != TYPE_NOT;
+    const auto number = isMerged ? operand->operandsNumber : 1;
+    const auto newOperands = static_cast<Node **>(
+        realloc(operands, (operandsNumber + number) * sizeof(Node *)));
+    if (!newOperands) {
+      return false;
+    }
+    operands = newOperands;
+    if (!isMerged) {
+      operands[operandsNumber++] = operand;
+      return true;
+    }
+    memcpy(operands + operandsNumber, operand->operands,
+           number * sizeof(Node *));
+    operandsNumber += number;
+    operand->operandsNumber = 0;
+    Destroy(operand);
+    return true;
+  }
+
+  template <typename Callback>
+  void ForEachMatcher(const Callback &callback) const {
+    if (matcher) {
+      callback(*matcher);
+    }
+    for (size_t i = 0; i < operandsNumber; ++i) {
+      operands[i]->ForEachMatcher(callback);
+    }
+  }
+};
+
+//! Parser is a recursive descent parser of the filter expression.
+struct Filter::Parser {
+  //! Maximum nesting of parentheses and NOT.
+  enum : size_t { maxDepth = 64 };
+
+  const Filter &filter;
+  const char *it;
+  size_t depth;
+
+  void SkipSpaces() {
+    for (; *it == ' ' || *it == '\t'; ++it) {
+    }
+  }
+
+  //! Skips the keyword, if it's the next word.
+  bool SkipKeyword(const char *keyword) {
+    SkipSpaces();
+    const auto len = strlen(keyword);
+    if (strncmp(it, keyword, len)) {
+      return false;
+    }
+    const auto next = it[len];
+    if (next && next != ' ' && next != '\t' && next != '(' && next != '"') {
+      return false;
+    }
+    it += len;
+    return true;
+  }
+
+  //! Parses "operand { keyword operand }".
+  Node *ParseOperator(const Node::Type type,
+                      const char *keyword,
+                      Node *(Parser::*parseOperand)()) {
+    const auto first = (this->*parseOperand)();
+    if (!first || !SkipKeyword(keyword)) {
+      return first;
+    }
+    const auto result = Node::Create(type);
+    if (!result || !result->AddOperand(first)) {
+      Node::Destroy(first);
+      Node::Destroy(result);
+      return nullptr;
+    }
+    do {
+      const auto operand = (this->*parseOperand)();
+      if (!operand || !result->AddOperand(operand)) {
+        Node::Destroy(operand);
+        Node::Destroy(result);
+        return nullptr;
+      }
+    } while (SkipKeyword(keyword));
+    return result;
+  }
+
+  Node *ParseOr() {
+    return ParseOperator(Node::TYPE_OR, "OR", &Parser::ParseAnd);
+  }
+
+  Node *ParseAnd() {
+    return ParseOperator(Node::TYPE_AND, "AND", &Parser::ParseUnary);
+  }
+
+  Node *ParseUnary() {
+    if (++depth > maxDepth) {
+      return nullptr;
+    }
+    Node *result = nullptr;
+    if (SkipKeyword("NOT")) {
+      const auto operand = ParseUnary();
+      result = operand ? Node::Create(Node::TYPE_NOT) : nullptr;
+      if (!result || !result->AddOperand(operand)) {
+        Node::Destroy(operand);
+        Node::Destroy(result);
+        result = nullptr;
+      }
+    } else if (*it == '(') {
+      ++it;
+      result = ParseOr();
+      SkipSpaces();
+      if (*it == ')') {
+        ++it;
+      } else {
+        Node::Destroy(result);
+        result = nullptr;
+      }
+    } else if (*it == '"') {
+      result = ParseMask();
+    }
+    --depth;
+    return result;
+  }
+
+  Node *ParseMask() {
+    assert(*it == '"');
+    const auto mask = static_cast<char *>(malloc(strlen(++it) + 1));
+    if (!mask) {
+      return nullptr;
+    }
+    auto maskEnd = mask;
+    for (; *it && *it != '"'; ++it) {
+      if (*it == '\\' && it[1]) {
+        if (it[1] != '"') {
+          *maskEnd++ = *it;
+        }
+        ++it;
+      }
+      *maskEnd++ = *it;
+    }
+    *maskEnd = 0;
+    Node *result = nullptr;
+    if (*it == '"') {
+      ++it;
+      result = filter.CreateMask(mask);
+    }
+    free(mask);
+    return result;
+  }
+};
+
+Filter::~Filter() { Node::Destroy(m_root); }
+
+Filter::Node *Filter::CreateMask(const char *mask) const {
+  const auto result = Node::Create(Node::TYPE_MASK);
+  if (!result) {
+    return nullptr;
+  }
+  result->matcher = static_cast<MaskMatcher *>(malloc(sizeof(MaskMatcher)));
+  if (!result->matcher) {
+    Node::Destroy(result);
+    return nullptr;
+  }
+  new (result->matcher) MaskMatcher();
+  result->matcher->SetStepsLimit(m_stepsLimit);
+  result->matcher->SetUtf8(m_isUtf8);
+  result->matcher->SetStatsCounting(m_isStatsCounting);
+  if (!result->matcher->Compile(mask)) {
+    Node::Destroy(result);
+    return nullptr;
+  }
+  return result;
+}
+
+bool Filter::Compile(const char *mask) {
+  const auto root = mask ? CreateMask(mask) : nullptr;
+  if (!root) {
+    return false;
+  }
+  Replace(root);
+  return true;
+}
+
+bool Filter::CompileExpression(const char *expression) {
+  if (!expression) {
+    return false;
+  }
+  Parser parser{*this, expression, 0};
+  const auto root = parser.ParseOr();
+  parser.SkipSpaces();
+  if (!root || *parser.it) {
+    Node::Destroy(root);
+    return false;
+  }
+  Replace(root);
+  return true;
+}
+
+void Filter::Replace(Node *root) {
+  Node::Destroy(m_root);
+  m_root = root;
+}
+
+bool Filter::Match(const char *begin, const char *end) const {
+  m_isAborted = false;
+  if (!m_root) {
+    return true;
+  }
+  const auto result = Check(*m_root, begin, end);
+  return result && !m_isAborted;
+}
+
+bool Filter::Match(const char *begin,
+                   const char *end,
+                   Span *captures) const {
+  if (!captures || !m_root || m_root->type != Node::TYPE_MASK) {
+    return Match(begin, end);
+  }
+  const auto result = m_root->matcher->Match(begin, end, captures);
+  m_isAborted = m_root->matcher->IsAborted();
+  return result && !m_isAborted;
+}
+
+size_t Filter::GetCapturesNumber() const {
+  return m_root && m_root->type == Node::TYPE_MASK
+             ? m_root->matcher->GetCapturesNumber()
+             : 0;
+}
+
+bool Filter::Check(Node &node, const char *begin, const char *end) const {
+  switch (node.type) {
+    case Node::TYPE_MASK: {
+      const auto result = node.matcher->Match(begin, end);
+      if (node.matcher->IsAborted()) {
+        m_isAborted = true;
+      }
+      return result;
+    }
+    case Node::TYPE_NOT:
+      return !Check(*node.operands[0], begin, end);
+    case Node::TYPE_AND:
+    case Node::TYPE_OR:
+      break;
+  }
+
+  // AND is completed by the first false result, OR - by the first true.
+  const auto completion = node.type == Node::TYPE_OR;
+  auto result = !completion;
+  for (size_t i = 0; i < node.operandsNumber && !m_isAborted; ++i) {
+    auto &operand = *node.operands[i];
+    const auto start = __rdtsc();
+    const auto operandResult = Check(operand, begin, end);
+    operand.ticks += __rdtsc() - start;
+    ++operand.checksNumber;
+    operand.passesNumber += operandResult;
+    if (operandResult == completion) {
+      result = completion;
+      break;
+    }
+  }
+  if (++node.checksSinceReorder >= reorderPeriod) {
+    Reorder(node);
+  }
+  return result;
+}
+
+void Filter::Reorder(Node &node) {
+  node.checksSinceReorder = 0;
+  const auto isOr = node.type == Node::TYPE_OR;
+  // Expected time until the result, which completes the operator check. The
+  // probability of the result is smoothed, so operands without such results
+  // are checked last, and operands without checks are checked first.
+  const auto &getCost = [isOr](const Node &operand) {
+    if (!operand.checksNumber) {
+      return 0.0;
+    }
+    const auto completions = isOr
+                                 ? operand.passesNumber
+                                 : operand.checksNumber - operand.passesNumber;
+    return static_cast<double>(operand.ticks) /
+           static_cast<double>(operand.checksNumber) *
+           static_cast<double>(operand.checksNumber + 2) /
+           static_cast<double>(completions + 1);
+  };
+  for (size_t i = 1; i < node.operandsNumber; ++i) {
+    const auto operand = node.operands[i];
+    const auto cost = getCost(*operand);
+    auto j = i;
+    for (; j > 0 && getCost(*node.operands[j - 1]) > cost; --j) {
+      node.operands[j] = node.operands[j - 1];
+    }
+    node.operands[j] = operand;
+  }
+  // Older observations have less weight, so the order follows content
+  // changes.
+  for (size_t i = 0; i < node.operandsNumber; ++i) {
+    auto &operand = *node.operands[i];
+    operand.ticks /= 2;
+    operand.checksNumber /= 2;
+    operand.passesNumber /= 2;
+  }
+}
+
+void Filter::SetStepsLimit(const size_t limit) {
+  m_stepsLimit = limit;
+  if (m_root) {
+    m_root->ForEachMatcher(
+        [limit](MaskMatcher &matcher) { matcher.SetStepsLimit(limit); });
+  }
+}
+
+void Filter::SetUtf8(const bool isUtf8) {
+  m_isUtf8 = isUtf8;
+  if (m_root) {
+    m_root->ForEachMatcher(
+        [isUtf8](MaskMatcher &matcher) { matcher.SetUtf8(isUtf8); });
+  }
+}
+
+const MaskMatcher *Filter::GetRequired() const {
+  if (!m_root) {
+    return nullptr;
+  }
+  if (m_root->type == Node::TYPE_MASK) {
+    return m_root->matcher;
+  }
+  if (m_root->type != Node::TYPE_AND) {
+    return nullptr;
+  }
+  for (size_t i = 0; i < m_root->operandsNumber; ++i) {
+    if (m_root->operands[i]->type == Node::TYPE_MASK) {
+      return m_root->operands[i]->matcher;
+    }
+  }
+  return nullptr;
+}
+
+void Filter::SetStatsCounting(const bool isEnabled) {
+  m_isStatsCounting = isEnabled;
+  if (m_root) {
+    m_root->ForEachMatcher([isEnabled](MaskMatcher &matcher) {
+      matcher.SetStatsCounting(isEnabled);
+    });
+  }
+}
+
+void Filter::AddStats(Stats &stats) const {
+  if (m_root) {
+    m_root->ForEachMatcher(
+        [&stats](const MaskMatcher &matcher) { matcher.AddStats(stats); });
+  }
+}
@@ -0,0 +1,131 @@
+﻿//
+//    Created: 2019/04/23 19:05
+//     Author: Eugene V. Palchukovsky
+//     E-mail: eugene@palchukovsky.com
+//
+
+#pragma once
+
+#include "MaskMatcher.hpp"
+#include "Stats.hpp"
+
+namespace logReader {
+
+//! Filter checks a string for a boolean expression of masks.
+/**
+ * Operands of AND and OR are checked until the result is known, and the
+ * order of operands is adapted to the observed check time and result of
+ * each operand: AND operands, which reject a string faster, and OR
+ * operands, which accept a string faster, are checked first.
+ *
+ * @sa CompileExpression.
+ */
+class Filter {
+  struct Node;
+  struct Parser;
+
+ public:
+  //! Number of checks of an operator after which its operands are reordered.
+  enum : size_t { reorderPeriod = 1024 };
+
+  //! C-tor creates filter which matches any string.
+  Filter() = default;
+  Filter(Filter &&) = delete;
+  Filter(const Filter &) = delete;
+  Filter &operator=(Filter &&) = delete;
+  Filter &operator=(const Filter &) = delete;
+  ~Filter();
+
+  //! Compile compiles one mask and replaces the previous filter.
+  /**
+   * @sa MaskMatcher::Compile
+   * @return True at success, false if compilation is failed (previous filter
+   * still be active).
+   */
+  bool Compile(const char *mask);
+
+  //! CompileExpression compiles the expression and replaces the previous
+  //! filter.
+  /**
+   * The expression consists of masks in double quotes, operators AND, OR,
+   * NOT and parentheses. NOT has the highest priority, OR has the lowest.
+   * Use slash before a double quote to find it, other slash sequences are
+   * passed to the mask as is.
+   *
+   * Example: "\"*ERROR*\" AND NOT (\"*healthcheck*\" OR \"*ping*\")"
+   *
+   * @return True at success, false if compilation is failed (previous filter
+   * still be active).
+   */
+  bool CompileExpression(const char *expression);
+
+  //! Match checks the string.
+  /**
+   * @return True if the string matches, false otherwise or if the check is
+   * aborted by the steps limit of a mask.
+   */
+  bool Match(const char *begin, const char *end) const;
+
+  //! Match checks the string and returns parts of the string, which are
+  //! matched by "*" and "?" groups, if the filter is one mask.
+  /**
+   * @param[out] captures Buffer for GetCapturesNumber() parts, which is
+   * filled if the string matches.
+   * @sa MaskMatcher::Match
+   */
+  bool Match(const char *begin, const char *end, Span *captures) const;
+
+  //! GetCapturesNumber returns number of "*" and "?" groups if the filter is
+  //! one mask, zero otherwise.
+  size_t GetCapturesNumber() const;
+
+  //! IsAborted returns true if the last Match call is aborted by the steps
+  //! limit.
+  bool IsAborted() const { return m_isAborted; }
+
+  //! SetStepsLimit sets the maximum number of steps for the check of one
+  //! mask.
+  /**
+   * @sa MaskMatcher::SetStepsLimit
+   */
+  void SetStepsLimit(size_t limit);
+
+  //! SetUtf8 sets content encoding for each mask.
+  /**
+   * @sa MaskMatcher::SetUtf8
+   */
+  void SetUtf8(bool isUtf8);
+
+  //! GetRequired returns a mask, which matches each matched string, or
+  //! nullptr if the filter has no such mask.
+  const MaskMatcher *GetRequired() const;
+
+  //! SetStatsCounting enables or disables counters of each mask.
+  void SetStatsCounting(bool isEnabled);
+
+  //! AddStats adds counters of masks to the statistics.
+  void AddStats(Stats &) const;
+
+ private:
+  //! Check checks the string by the node.
+  bool Check(Node &, const char *begin, const char *end) const;
+
+  //! Reorder sorts operator operands by the observed cost of the result,
+  //! which completes the operator check.
+  static void Reorder(Node &);
+
+  //! CreateMask creates node with the compiled mask, returns nullptr at
+  //! error.
+  Node *CreateMask(const char *mask) const;
+
+  //! Replace replaces the filter tree.
+  void Replace(Node *);
+
+  Node *m_root{nullptr};
+  size_t m_stepsLimit = 0;
+  bool m_isUtf8 = false;
+  bool m_isStatsCounting = false;
+  mutable bool m_isAborted = false;
+};
+
+}  // namespace logReader
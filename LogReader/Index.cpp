@@ -0,0 +1,357 @@
+﻿//
+//    Created: 2019/04/21 12:35
+//     Author: Eugene V. Palchukovsky
+//     E-mail: eugene@palchukovsky.com
+//
+
+#include "Prec.hpp"
+#include "Index.hpp"
+#include "File.hpp"
+#include "Mapping.hpp"
+#include "MaskMatcher.hpp"
+#include "Scan.hpp"
+
+using namespace logReader;
+
+namespace {
+
+const size_t numberOfBloomHashes = 3;
+
+//! Stores bloom bit indexes of the trigram.
+void GetBloomBits(const char *trigram, uint32_t *result) {
+  const auto value = static_cast<uint64_t>(static_cast<uint8_t>(trigram[0])) |
+                     static_cast<uint64_t>(static_cast<uint8_t>(trigram[1]))
+                         << 8 |
+                     static_cast<uint64_t>(static_cast<uint8_t>(trigram[2]))
+                         << 16;
+  const auto hash = value * 0x9E3779B97F4A7C15ull;
+  const uint32_t mask = Index::bloomSize * 8 - 1;
+  result[0] = static_cast<uint32_t>(hash >> 45) & mask;
+  result[1] = static_cast<uint32_t>(hash >> 26) & mask;
+  result[2] = static_cast<uint32_t>(hash >> 7) & mask;
+}
+
+//! Returns true if the rule is a fixed string which is checked by the index.
+/**
+ * A fixed string, which is longer than a block, can cross several blocks.
+ */
+bool IsIndexed(const Rule &rule) {
+  return rule.GetFixedString() && rule.GetMinLen() >= 3 &&
+         rule.GetMinLen() <= Index::blockSize;
+}
+
+bool HasBit(const uint8_t *bloom, const uint32_t bit) {
+  return (bloom[bit / 8] & (1 << (bit % 8))) != 0;
+}
+
+//! Returns the sidecar file path, which has to be freed by free, or nullptr
+//! at error.
+char *GetIndexPath(const char *filePath) {
+  const auto len = strlen(filePath);
+  const auto result = static_cast<char *>(malloc(len + 5));
+  if (result) {
+    memcpy(result, filePath, len);
+    memcpy(result + len, ".lri", 5);
+  }
+  return result;
+}
+
+}  // namespace
+
+//! Header is the sidecar file header, followed by numbers of lines of blocks
+//! and by bloom filters of blocks.
+struct Index::Header {
+  char signature[4];
+  uint32_t version;
+  uint64_t blockSize;
+  uint64_t bloomSize;
+  //! Size of the indexed part of the file.
+  uint64_t fileSize;
+  //! Fingerprint of the indexed part of the file.
+  uint64_t fingerprint;
+  uint64_t blocksNumber;
+
+  static const uint32_t currentVersion = 3;
+
+  bool IsValid(const uint64_t indexSize) const {
+    return !memcmp(signature, "LRIX", sizeof(signature)) &&
+           version == currentVersion && blockSize == Index::blockSize &&
+           bloomSize == Index::bloomSize &&
+           blocksNumber == (fileSize + blockSize - 1) / blockSize &&
+           indexSize == sizeof(Header) + blocksNumber * sizeof(uint64_t) +
+                            blocksNumber * bloomSize;
+  }
+};
+
+Index::Index(const char *filePath, const Mapping &mapping) {
+  const auto indexPath = GetIndexPath(filePath);
+  if (!indexPath) {
+    return;
+  }
+  // The index is mapped only while it's used, not by the shared mappings
+  // cache, so it can be rebuilt after that.
+  const auto file =
+      CreateFile(indexPath, GENERIC_READ, FILE_SHARE_READ, nullptr,
+                 OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  free(indexPath);
+  if (file == INVALID_HANDLE_VALUE) {
+    return;
+  }
+  LARGE_INTEGER indexSize;
+  if (!GetFileSizeEx(file, &indexSize) ||
+      static_cast<uint64_t>(indexSize.QuadPart) < sizeof(Header)) {
+    CloseHandle(file);
+    return;
+  }
+  m_mapping = CreateFileMapping(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  CloseHandle(file);
+  if (!m_mapping) {
+    return;
+  }
+  m_view = static_cast<const char *>(
+      MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+  if (!m_view) {
+    return;
+  }
+
+  const auto header = reinterpret_cast<const Header *>(m_view);
+  uint64_t fingerprint;
+  if (!header->IsValid(static_cast<uint64_t>(indexSize.QuadPart)) ||
+      header->fileSize > mapping.GetSize() ||
+      !mapping.GetFingerprint(static_cast<size_t>(header->fileSize),
+                              fingerprint) ||
+      header->fingerprint != fingerprint) {
+    return;
+  }
+  m_header = header;
+  m_isGrown = header->fileSize < mapping.GetSize();
+  m_lines = reinterpret_cast<const uint64_t *>(m_header + 1);
+  m_blooms =
+      reinterpret_cast<const uint8_t *>(m_lines + m_header->blocksNumber);
+}
+
+Index::~Index() {
+  free(m_filterBits);
+  if (m_view) {
+    UnmapViewOfFile(m_view);
+  }
+  if (m_mapping) {
+    CloseHandle(m_mapping);
+  }
+}
+
+bool Index::Build(const char *filePath) {
+  const auto mapping = Mapping::Acquire(filePath);
+  if (!mapping) {
+    return false;
+  }
+  const auto indexPath = GetIndexPath(filePath);
+  const auto bloom = static_cast<uint8_t *>(malloc(bloomSize));
+  const auto file =
+      indexPath ? CreateFile(indexPath, GENERIC_WRITE, 0, nullptr,
+                             CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr)
+                : INVALID_HANDLE_VALUE;
+  struct Scope {  // NOLINT
+    const Mapping *mapping;
+    char *indexPath;
+    uint8_t *bloom;
+    HANDLE file;
+    bool isCompleted;
+    ~Scope() {
+      if (file != INVALID_HANDLE_VALUE) {
+        CloseHandle(file);
+        if (!isCompleted) {
+          DeleteFile(indexPath);
+        }
+      }
+      free(bloom);
+      free(indexPath);
+      Mapping::Release(mapping);
+    }
+  } scope{mapping, indexPath, bloom, file, false};
+  if (!bloom || file == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+
+  const auto &write = [file](const void *data, const size_t size) {
+    DWORD written;
+    return WriteFile(file, data, static_cast<DWORD>(size), &written,
+                     nullptr) &&
+           written == size;
+  };
+
+  const auto content = mapping->GetBegin();
+  const auto size = mapping->GetSize();
+  uint64_t fingerprint;
+  if (!mapping->GetFingerprint(size, fingerprint)) {
+    return false;
+  }
+  Header header = {{'L', 'R', 'I', 'X'},
+                   Header::currentVersion,
+                   blockSize,
+                   bloomSize,
+                   size,
+                   fingerprint,
+                   (size + blockSize - 1) / blockSize};
+  if (!write(&header, sizeof(header))) {
+    return false;
+  }
+  // The content of an archive is locked by blocks, with the symbols which
+  // are checked after the block.
+  const auto &lock = [mapping, content](const char *begin, const char *end) {
+    return mapping->Lock(static_cast<size_t>(begin - content),
+                         static_cast<size_t>(end - content));
+  };
+  const auto &unlock = [mapping, content](const char *begin,
+                                          const char *end) {
+    mapping->Unlock(static_cast<size_t>(begin - content),
+                    static_cast<size_t>(end - content));
+  };
+  for (size_t block = 0; block < header.blocksNumber; ++block) {
+    const auto begin = content + block * blockSize;
+    const auto end = size - block * blockSize > blockSize ? begin + blockSize
+                                                          : content + size;
+    const auto lockEnd = end < content + size ? end + 1 : end;
+    if (!lock(begin, lockEnd)) {
+      return false;
+    }
+    const uint64_t lines = logReader::CountLines(begin, end, content + size);
+    unlock(begin, lockEnd);
+    if (!write(&lines, sizeof(lines))) {
+      return false;
+    }
+  }
+  for (size_t block = 0; block < header.blocksNumber; ++block) {
+    memset(bloom, 0, bloomSize);
+    const auto begin = content + block * blockSize;
+    const auto end = size - block * blockSize > blockSize ? begin + blockSize
+                                                          : content + size;
+    const auto nextEnd = static_cast<size_t>(content + size - end) > blockSize
+                             ? end + blockSize
+                             : content + size;
+    if (!lock(begin, nextEnd)) {
+      return false;
+    }
+    if (nextEnd < content + size && FindLineEnd(end, nextEnd) == nextEnd) {
+      // The line, which crosses the block end, crosses the next block too,
+      // its fixed strings can be in blocks, which are not checked with this
+      // block. The full filter makes the block a candidate for each filter.
+      memset(bloom, 0xFF, bloomSize);
+    } else {
+      uint32_t bits[numberOfBloomHashes];
+      // Trigrams, which start at the block end, continue in the next block.
+      for (auto it = begin; it < end && content + size - it >= 3; ++it) {
+        GetBloomBits(it, bits);
+        for (const auto bit : bits) {
+          bloom[bit / 8] |= 1 << (bit % 8);
+        }
+      }
+    }
+    unlock(begin, nextEnd);
+    if (!write(bloom, bloomSize)) {
+      return false;
+    }
+  }
+  scope.isCompleted = true;
+  return true;
+}
+
+bool Index::SetFilter(const MaskMatcher *filter) {
+  free(m_filterBits);
+  m_filterBits = nullptr;
+  m_filterBitsNumber = 0;
+  m_candidateBlock = SIZE_MAX;
+  if (!filter) {
+    return true;
+  }
+  size_t number = 0;
+  for (size_t i = 0; i < filter->GetRulesNumber(); ++i) {
+    const auto &rule = filter->GetRule(i);
+    if (IsIndexed(rule)) {
+      number += (rule.GetMinLen() - 2) * numberOfBloomHashes;
+    }
+  }
+  if (!number) {
+    return true;
+  }
+  m_filterBits = static_cast<uint32_t *>(malloc(number * sizeof(uint32_t)));
+  if (!m_filterBits) {
+    return false;
+  }
+  for (size_t i = 0; i < filter->GetRulesNumber(); ++i) {
+    const auto &rule = filter->GetRule(i);
+    if (!IsIndexed(rule)) {
+      continue;
+    }
+    const auto string = rule.GetFixedString();
+    for (size_t pos = 0; pos + 3 <= rule.GetMinLen(); ++pos) {
+      GetBloomBits(string + pos, m_filterBits + m_filterBitsNumber);
+      m_filterBitsNumber += numberOfBloomHashes;
+    }
+  }
+  assert(m_filterBitsNumber == number);
+  return true;
+}
+
+bool Index::IsCandidate(const size_t block) const {
+  assert(m_header);
+  if (block >= m_header->blocksNumber) {
+    return true;
+  }
+  const auto bloom = m_blooms + block * bloomSize;
+  const uint8_t *nextBloom = nullptr;
+  if (block + 1 < m_header->blocksNumber) {
+    nextBloom = bloom + bloomSize;
+  } else if (m_isGrown) {
+    // A fixed string can cross the indexed part end.
+    return true;
+  }
+  for (size_t i = 0; i < m_filterBitsNumber; i += numberOfBloomHashes) {
+    auto isInBloom = true;
+    auto isInNextBloom = nextBloom != nullptr;
+    for (size_t j = i; j < i + numberOfBloomHashes; ++j) {
+      isInBloom = isInBloom && HasBit(bloom, m_filterBits[j]);
+      isInNextBloom = isInNextBloom && HasBit(nextBloom, m_filterBits[j]);
+    }
+    if (!isInBloom && !isInNextBloom) {
+      return false;
+    }
+  }
+  return true;
+}
+
+size_t Index::Skip(const size_t pos) const {
+  if (!m_header || !m_filterBitsNumber) {
+    return pos;
+  }
+  auto block = pos / blockSize;
+  if (block == m_candidateBlock || IsCandidate(block)) {
+    m_candidateBlock = block;
+    return pos;
+  }
+  while (!IsCandidate(++block)) {
+  }
+  m_candidateBlock = block;
+  return block * blockSize;
+}
+
+size_t Index::CountLines(const File &file,
+                         const size_t begin,
+                         const size_t end) const {
+  assert(begin <= end);
+  assert(end <= file.GetSize());
+  const auto firstBlock = begin / blockSize + 1;
+  const auto lastBlock = end / blockSize;
+  // Numbers of lines of the last indexed block don't cover the content
+  // appended after indexing: the block could be partial or could end with CR
+  // of an appended CR LF pair.
+  if (!m_header || firstBlock >= lastBlock ||
+      lastBlock * blockSize >= m_header->fileSize) {
+    return file.CountLines(begin, end);
+  }
+  auto result = file.CountLines(begin, firstBlock * blockSize);
+  for (auto block = firstBlock; block < lastBlock; ++block) {
+    result += static_cast<size_t>(m_lines[block]);
+  }
+  return result + file.CountLines(lastBlock * blockSize, end);
+}
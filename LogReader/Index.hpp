@@ -0,0 +1,91 @@
+﻿//
+//    Created: 2019/04/21 12:30
+//     Author: Eugene V. Palchukovsky
+//     E-mail: eugene@palchukovsky.com
+//
+
+#pragma once
+
+namespace logReader {
+
+class File;
+class Mapping;
+class MaskMatcher;
+
+//! Index is a skip index of a file of log.
+/**
+ * The file is split into blocks, for each block the index has a bloom filter
+ * of all trigrams (three symbol sequences) which start in the block, and the
+ * number of lines in the block. Each fixed string of the filter has to be in
+ * a matched record, so a block is skipped if a trigram of a fixed string is
+ * not in the bloom filters of the block and of the next block (a fixed string
+ * can cross the block end). A block, which line crosses the whole next block,
+ * is never skipped, as fixed strings of the line can be in other blocks.
+ *
+ * The index is stored in a sidecar file with ".lri" extension near the file
+ * of log and it is actual while the indexed part of the file is not changed.
+ */
+class Index {
+ public:
+  enum : size_t {
+    //! Size of the file block in bytes.
+    blockSize = 1 << 20,
+    //! Size of the block bloom filter in bytes.
+    bloomSize = 1 << 16,
+  };
+
+  explicit Index(const char *filePath, const Mapping &);
+  Index(Index &&) = delete;
+  Index(const Index &) = delete;
+  Index &operator=(Index &&) = delete;
+  Index &operator=(const Index &) = delete;
+  ~Index();
+
+  //! Returns true if the index is loaded and it's actual for the content.
+  explicit operator bool() const { return m_header != nullptr; }
+
+  //! Build builds the index of the file and stores it to the sidecar file.
+  /**
+   * @return True at success, false at error.
+   */
+  static bool Build(const char *filePath);
+
+  //! SetFilter sets the filter which fixed strings are searched.
+  /**
+   * @param[in] filter Filter or nullptr to stop blocks skipping.
+   * @return True at success, false at error (blocks are not skipped).
+   */
+  bool SetFilter(const MaskMatcher *filter);
+
+  //! Skip returns the offset of the first block, starting from the block with
+  //! the position, which can have matched records, or the position if its
+  //! block can have them.
+  size_t Skip(size_t pos) const;
+
+  //! CountLines counts line ends of the file between offsets using numbers
+  //! of lines of indexed blocks.
+  size_t CountLines(const File &, size_t begin, size_t end) const;
+
+ private:
+  struct Header;
+
+  //! IsCandidate returns true if the block can have matched records.
+  bool IsCandidate(size_t block) const;
+
+  void *m_mapping{nullptr};
+  const char *m_view{nullptr};
+  const Header *m_header{nullptr};
+  //! True if the file has content after the indexed part.
+  bool m_isGrown = false;
+  //! Number of lines of each block.
+  const uint64_t *m_lines{nullptr};
+  //! Bloom filters of blocks.
+  const uint8_t *m_blooms{nullptr};
+  //! Bloom bit indexes of filter trigrams.
+  uint32_t *m_filterBits{nullptr};
+  size_t m_filterBitsNumber = 0;
+  //! The last checked block which can have matched records.
+  mutable size_t m_candidateBlock = SIZE_MAX;
+};
+
+}  // namespace logReader
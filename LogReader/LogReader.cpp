@@ -6,15 +6,142 @@
 
 #include "Prec.hpp"
 #include "LogReader.hpp"
+#include "Archive.hpp"
+#include "Context.hpp"
 #include "File.hpp"
+#include "Filter.hpp"
+#include "Index.hpp"
+#include "Mapping.hpp"
 #include "MaskMatcher.hpp"
+#include "QueryResults.hpp"
+#include "Templates.hpp"
+#include "Timestamp.hpp"
 
 using namespace logReader;
 
+namespace {
+//! Finds the first record with timestamp which starts at or after the position.
+bool FindTimestamp(const File &file,
+                   const size_t pos,
+                   size_t &recordPos,
+                   Timestamp &timestamp) {
+  const char *begin;
+  const char *end;
+  for (auto it = pos; file.FindRecord(it, begin, end);
+       it = static_cast<size_t>(end - file.GetBegin())) {
+    if (timestamp.Parse(begin, end)) {
+      recordPos = static_cast<size_t>(begin - file.GetBegin());
+      return true;
+    }
+  }
+  return false;
+}
+
+//! Finds the offset of the first record with timestamp which is not earlier
+//! than the bound. Returns file size if there is no such record.
+size_t FindTimeBound(const File &file, const Timestamp &bound, size_t lo) {
+  auto hi = file.GetSize();
+  Timestamp timestamp;
+  size_t recordPos;
+  // Invariant: the first record with timestamp after "hi" is not earlier than
+  // the bound (or doesn't exist), and each record with timestamp before "lo"
+  // is earlier than the bound.
+  while (lo < hi) {
+    const auto mid = lo + (hi - lo) / 2;
+    if (!FindTimestamp(file, mid, recordPos, timestamp) ||
+        !(timestamp < bound)) {
+      hi = mid;
+    } else {
+      assert(recordPos >= mid);
+      lo = recordPos + 1;
+    }
+  }
+  return FindTimestamp(file, lo, recordPos, timestamp) ? recordPos
+                                                       : file.GetSize();
+}
+
+//! Returns string copy which has to be freed by free, or nullptr at error.
+char *CopyString(const char *source) {
+  const auto size = strlen(source) + 1;
+  const auto result = static_cast<char *>(malloc(size));
+  if (result) {
+    memcpy(result, source, size);
+  }
+  return result;
+}
+}  // namespace
+
 class LogReader::Implementation {
  public:
   File *m_file = nullptr;
-  MaskMatcher *m_matcher = nullptr;
+  //! Skip index of the file or nullptr.
+  Index *m_index = nullptr;
+  Filter *m_filter = nullptr;
+  //! Counted templates of matched records or nullptr.
+  Templates *m_templates = nullptr;
+  MaskMatcher *m_recordStart = nullptr;
+  Context m_context;
+  bool m_isLineNumberingEnabled = false;
+  bool m_isCapturing = false;
+  //! Captures of the filter check.
+  Span *m_matchCaptures = nullptr;
+  size_t m_matchCapturesCapacity = 0;
+  //! Captures of records returned by one call, each next record takes the
+  //! next part.
+  Span *m_captures = nullptr;
+  size_t m_capturesNumber = 0;
+  size_t m_capturesCapacity = 0;
+  //! Number of lines before the line counting position.
+  size_t m_lineNumber = 0;
+  //! Offset till which lines are counted.
+  size_t m_lineCountPos = 0;
+  size_t m_readAhead = File::defaultReadAhead;
+  size_t m_residentLimit = 0;
+  unsigned long long m_samplingSeed = 0;
+  //! Filter check steps limit, zero if there is no limit.
+  size_t m_matchLimit = 0;
+  bool m_isUtf8 = false;
+  //! Number of records which filter check is aborted by the limit.
+  size_t m_abortedRecordsNumber = 0;
+  //! True if reading and matching counters are counted.
+  bool m_isStatsCounting = false;
+  //! Counters of closed files and records matching.
+  logReader::Stats m_stats;
+  //! Filter mask or expression and record start mask as a query of the
+  //! result cache.
+  char *m_filterMask = nullptr;
+  bool m_isFilterExpression = false;
+  char *m_recordStartMask = nullptr;
+  bool m_isResultCacheEnabled = false;
+  //! True if the reading region is restricted by the time range.
+  bool m_isRangeSet = false;
+
+  //! ResultCaching is a state of the result cache usage by current reading.
+  struct ResultCaching {
+    enum State {
+      //! Reading is not started, the cache can be used.
+      STATE_READY,
+      //! Records are returned from cached results.
+      STATE_CACHED,
+      //! Records are read from the file after cached results.
+      STATE_SCANNING,
+      //! The cache is not used by this reading.
+      STATE_OFF
+    };
+    State state = STATE_READY;
+    //! Mapping is acquired while results are scanned, as the file is closed at
+    //! the end, but results are stored after that.
+    const Mapping *mapping = nullptr;
+    const QueryResults *results = nullptr;
+    size_t resultIndex = 0;
+    //! Matches after cached results.
+    QueryResults::Match *matches = nullptr;
+    size_t matchesNumber = 0;
+    size_t matchesCapacity = 0;
+    //! The last read record begin, records are stored till it, as the last
+    //! record can be continued by the file writer.
+    size_t lastRecordBegin = 0;
+  } m_resultCaching;
 
   Implementation() = default;
   Implementation(Implementation &&) = default;
@@ -22,15 +149,285 @@ class LogReader::Implementation {
   Implementation &operator=(Implementation &&) = delete;
   Implementation &operator=(const Implementation &) = delete;
   ~Implementation() {
-    if (m_matcher) {
-      m_matcher->~MaskMatcher();
-      free(m_matcher);
+    ResetResultCaching();
+    free(m_matchCaptures);
+    free(m_captures);
+    free(m_filterMask);
+    free(m_recordStartMask);
+    if (m_recordStart) {
+      m_recordStart->~MaskMatcher();
+      free(m_recordStart);
     }
+    if (m_filter) {
+      m_filter->~Filter();
+      free(m_filter);
+    }
+    if (m_templates) {
+      m_templates->~Templates();
+      free(m_templates);
+    }
+    CloseIndex();
     if (m_file) {
       m_file->~File();
       free(m_file);
     }
   }
+
+  //! Compiles the filter mask or expression.
+  bool SetFilter(const char *filter, const bool isExpression) {
+    const auto has = m_filter != nullptr;
+    if (!has) {
+      m_filter = static_cast<Filter *>(malloc(sizeof(Filter)));
+      if (!m_filter) {
+        return false;
+      }
+      new (m_filter) Filter();
+      m_filter->SetStepsLimit(m_matchLimit);
+      m_filter->SetUtf8(m_isUtf8);
+      m_filter->SetStatsCounting(m_isStatsCounting);
+    }
+    const auto text = filter ? CopyString(filter) : nullptr;
+    if (!text || !(isExpression ? m_filter->CompileExpression(filter)
+                                : m_filter->Compile(filter))) {
+      free(text);
+      if (!has) {
+        m_filter->~Filter();
+        free(m_filter);
+        m_filter = nullptr;
+      }
+      return false;
+    }
+    free(m_filterMask);
+    m_filterMask = text;
+    m_isFilterExpression = isExpression;
+    ResetResultCaching();
+    if (m_index && !m_index->SetFilter(m_filter->GetRequired())) {
+      CloseIndex();
+    }
+    return true;
+  }
+
+  //! Returns templates, creates them if it's required, nullptr at error.
+  Templates *GetTemplates() {
+    if (!m_templates) {
+      m_templates = static_cast<Templates *>(malloc(sizeof(Templates)));
+      if (m_templates) {
+        new (m_templates) Templates();
+      }
+    }
+    return m_templates;
+  }
+
+  //! Opens skip index of the opened file, if it exists.
+  void OpenIndex(const char *filePath) {
+    assert(!m_index);
+    assert(m_file);
+    const auto index = static_cast<Index *>(malloc(sizeof(Index)));
+    if (!index) {
+      return;
+    }
+    new (index) Index(filePath, *m_file->GetMapping());
+    if (!*index ||
+        !index->SetFilter(m_filter ? m_filter->GetRequired() : nullptr)) {
+      index->~Index();
+      free(index);
+      return;
+    }
+    m_index = index;
+  }
+
+  void CloseIndex() {
+    if (!m_index) {
+      return;
+    }
+    m_index->~Index();
+    free(m_index);
+    m_index = nullptr;
+  }
+
+  //! Moves the reading position over blocks without matched records.
+  void SkipBlocks() {
+    assert(m_index);
+    const auto pos = m_file->GetPos();
+    const auto skipEnd = m_index->Skip(pos);
+    if (skipEnd <= pos) {
+      return;
+    }
+    // The record, which crosses the skipped region end, has to be read.
+    m_file->Seek(m_file->FindLineBegin(
+        skipEnd < m_file->GetSize() ? skipEnd : m_file->GetSize()));
+    if (m_isStatsCounting) {
+      m_stats.bytesSkipped += m_file->GetPos() - pos;
+    }
+  }
+
+  //! Starts result cache usage, if the query is cacheable, and returns cached
+  //! results.
+  void StartResultCaching() {
+    auto &caching = m_resultCaching;
+    assert(caching.state == ResultCaching::STATE_READY);
+    caching.state = ResultCaching::STATE_OFF;
+    // Records, which check is stopped by the match limit, are not matched
+    // only for this reader.
+    if (!m_isResultCacheEnabled || !m_filterMask || m_isRangeSet ||
+        m_context.IsSet() || m_matchLimit || !m_file ||
+        !m_file->GetMapping()) {
+      return;
+    }
+    caching.mapping = Mapping::Acquire(*m_file->GetMapping());
+    const auto query = GetQuery();
+    caching.results = QueryResults::Acquire(query, *caching.mapping);
+    caching.resultIndex = 0;
+    caching.lastRecordBegin =
+        caching.results ? caching.results->GetScannedEnd() : 0;
+    caching.state = ResultCaching::STATE_CACHED;
+  }
+
+  //! Adds read record to results.
+  void AddResult(const char *begin, const char *end, const bool isMatched) {
+    auto &caching = m_resultCaching;
+    assert(caching.state == ResultCaching::STATE_SCANNING);
+    const auto fileBegin = caching.mapping->GetBegin();
+    caching.lastRecordBegin = static_cast<size_t>(begin - fileBegin);
+    if (!isMatched) {
+      return;
+    }
+    if (caching.matchesNumber == caching.matchesCapacity) {
+      const auto capacity =
+          caching.matchesCapacity ? caching.matchesCapacity * 2 : 64;
+      const auto matches = static_cast<QueryResults::Match *>(
+          realloc(caching.matches, capacity * sizeof(*caching.matches)));
+      if (!matches) {
+        ResetResultCaching();
+        return;
+      }
+      caching.matches = matches;
+      caching.matchesCapacity = capacity;
+    }
+    caching.matches[caching.matchesNumber++] = {
+        caching.lastRecordBegin, static_cast<size_t>(end - fileBegin)};
+  }
+
+  //! Stores results at the reading end.
+  void StoreResults() {
+    auto &caching = m_resultCaching;
+    assert(caching.state == ResultCaching::STATE_SCANNING);
+    auto matchesNumber = caching.matchesNumber;
+    if (matchesNumber &&
+        caching.matches[matchesNumber - 1].begin >= caching.lastRecordBegin) {
+      --matchesNumber;
+    }
+    if (!caching.results ||
+        caching.results->GetScannedEnd() < caching.lastRecordBegin) {
+      QueryResults::Store(GetQuery(), *caching.mapping,
+                          caching.lastRecordBegin, caching.results,
+                          caching.matches, matchesNumber);
+    }
+    ResetResultCaching();
+  }
+
+  //! Stops result cache usage by the current reading and frees its
+  //! resources.
+  void ResetResultCaching() {
+    auto &caching = m_resultCaching;
+    const auto isStarted = caching.state != ResultCaching::STATE_READY;
+    QueryResults::Release(caching.results);
+    Mapping::Release(caching.mapping);
+    free(caching.matches);
+    caching = ResultCaching();
+    if (isStarted) {
+      caching.state = ResultCaching::STATE_OFF;
+    }
+  }
+
+  //! Returns buffer for captures of the filter check or nullptr if the
+  //! filter has no groups or at error.
+  Span *GetMatchCaptures() {
+    const auto number = m_filter ? m_filter->GetCapturesNumber() : 0;
+    if (!number) {
+      return nullptr;
+    }
+    if (number > m_matchCapturesCapacity) {
+      const auto captures = static_cast<Span *>(
+          realloc(m_matchCaptures, number * sizeof(*m_matchCaptures)));
+      if (!captures) {
+        return nullptr;
+      }
+      m_matchCaptures = captures;
+      m_matchCapturesCapacity = number;
+    }
+    return m_matchCaptures;
+  }
+
+  //! Sets captures of the returned record.
+  /**
+   * @param[in] isCaptured True if the record is matched with captures of the
+   * filter check, false if the record has to be checked again.
+   */
+  void Capture(Record &record, const bool isCaptured) {
+    record.captures = nullptr;
+    record.capturesNumber = 0;
+    if (!m_isCapturing || !record.isMatched) {
+      return;
+    }
+    const auto source = GetMatchCaptures();
+    if (!source ||
+        (!isCaptured && !m_filter->Match(record.begin, record.end, source))) {
+      return;
+    }
+    const auto number = m_filter->GetCapturesNumber();
+    if (m_capturesNumber + number > m_capturesCapacity) {
+      const auto capacity = (m_capturesNumber + number) * 2;
+      const auto captures = static_cast<Span *>(
+          realloc(m_captures, capacity * sizeof(*m_captures)));
+      if (!captures) {
+        return;
+      }
+      m_captures = captures;
+      m_capturesCapacity = capacity;
+    }
+    // Pointer is fixed after the call, as the buffer can be reallocated by
+    // the next record.
+    record.captures = m_captures + m_capturesNumber;
+    record.capturesNumber = number;
+    memcpy(m_captures + m_capturesNumber, source, number * sizeof(*source));
+    m_capturesNumber += number;
+  }
+
+  //! Points captures of records returned by one call to the buffer.
+  void FixCaptures(Record *records, const size_t number) const {
+    auto captures = m_captures;
+    for (size_t i = 0; i < number; ++i) {
+      if (records[i].captures) {
+        records[i].captures = captures;
+        captures += records[i].capturesNumber;
+      }
+    }
+  }
+
+  enum ReadResult {
+    //! Record is read.
+    READ_RECORD,
+    //! Scan budget is exhausted, the reading can be continued.
+    READ_PAUSED,
+    //! There are no more records.
+    READ_END
+  };
+
+  //! Reads the next record, which corresponds to the filter, or a context
+  //! record.
+  /**
+   * @param[in,out] scanBudget Number of bytes which can be passed by the file
+   * reading position, returns the rest. SIZE_MAX means no limit.
+   */
+  ReadResult ReadRecord(Record &, size_t &scanBudget);
+
+  QueryResults::Query GetQuery() const {
+    assert(m_resultCaching.mapping);
+    return {m_resultCaching.mapping->GetVolume(),
+            m_resultCaching.mapping->GetFileIndex(), m_filterMask,
+            m_isFilterExpression, m_recordStartMask, m_isUtf8};
+  }
 };
 
 LogReader::LogReader()
@@ -48,6 +445,18 @@ LogReader::~LogReader() {
   }
 }
 
+void LogReader::SetFileCacheSize(const size_t numberOfFiles) {
+  Mapping::SetCacheSize(numberOfFiles);
+}
+
+bool LogReader::CompressFile(const char *filePath, const char *archivePath) {
+  return Archive::Create(filePath, archivePath);
+}
+
+bool LogReader::BuildIndex(const char *filePath) {
+  return Index::Build(filePath);
+}
+
 bool LogReader::Open(const char *filePath) {
   if (!m_pimpl || m_pimpl->m_file) {
     return false;
@@ -62,7 +471,12 @@ bool LogReader::Open(const char *filePath) {
     free(file);
     return false;
   }
+  file->SetRecordStart(m_pimpl->m_recordStart);
+  file->SetReadAhead(m_pimpl->m_readAhead);
+  file->SetScanOnce(m_pimpl->m_residentLimit);
+  file->SetStatsCounting(m_pimpl->m_isStatsCounting);
   m_pimpl->m_file = file;
+  m_pimpl->OpenIndex(filePath);
   return true;
 }
 
@@ -70,54 +484,522 @@ void LogReader::Close() {
   if (!m_pimpl || !m_pimpl->m_file) {
     return;
   }
+  m_pimpl->m_file->AddStats(m_pimpl->m_stats);
+  m_pimpl->CloseIndex();
   m_pimpl->m_file->~File();
   free(m_pimpl->m_file);
   m_pimpl->m_file = nullptr;
+  m_pimpl->m_context.Reset();
+  m_pimpl->m_lineNumber = m_pimpl->m_lineCountPos = 0;
+  m_pimpl->m_isRangeSet = false;
+  m_pimpl->ResetResultCaching();
+  m_pimpl->m_resultCaching.state = Implementation::ResultCaching::STATE_READY;
+}
+
+bool LogReader::SetFilter(const char *mask) {
+  return m_pimpl && m_pimpl->SetFilter(mask, false);
+}
+
+bool LogReader::SetFilterExpression(const char *expression) {
+  return m_pimpl && m_pimpl->SetFilter(expression, true);
 }
 
-bool LogReader::SetFilter(const char *filter) {
+bool LogReader::SetRecordStart(const char *mask) {
   if (!m_pimpl) {
     return false;
   }
-  const auto has = m_pimpl->m_matcher != nullptr;
+  m_pimpl->ResetResultCaching();
+  if (!mask) {
+    free(m_pimpl->m_recordStartMask);
+    m_pimpl->m_recordStartMask = nullptr;
+    if (m_pimpl->m_file) {
+      m_pimpl->m_file->SetRecordStart(nullptr);
+    }
+    if (m_pimpl->m_recordStart) {
+      m_pimpl->m_recordStart->~MaskMatcher();
+      free(m_pimpl->m_recordStart);
+      m_pimpl->m_recordStart = nullptr;
+    }
+    return true;
+  }
+
+  const auto maskCopy = CopyString(mask);
+  if (!maskCopy) {
+    return false;
+  }
+  // The mask is checked as a line prefix.
+  const auto maskLen = strlen(mask);
+  const auto prefixMask = static_cast<char *>(malloc(maskLen + 2));
+  if (!prefixMask) {
+    free(maskCopy);
+    return false;
+  }
+  memcpy(prefixMask, mask, maskLen);
+  prefixMask[maskLen] = '*';
+  prefixMask[maskLen + 1] = 0;
+
+  const auto has = m_pimpl->m_recordStart != nullptr;
   if (!has) {
-    m_pimpl->m_matcher =
+    m_pimpl->m_recordStart =
         static_cast<MaskMatcher *>(malloc(sizeof(MaskMatcher)));
-    if (!m_pimpl->m_matcher) {
+    if (!m_pimpl->m_recordStart) {
+      free(prefixMask);
+      free(maskCopy);
       return false;
     }
-    new (m_pimpl->m_matcher) MaskMatcher();
+    new (m_pimpl->m_recordStart) MaskMatcher();
+    m_pimpl->m_recordStart->SetUtf8(m_pimpl->m_isUtf8);
   }
-  if (!m_pimpl->m_matcher->Compile(filter)) {
+  const auto isCompiled = m_pimpl->m_recordStart->Compile(prefixMask);
+  free(prefixMask);
+  if (!isCompiled) {
+    free(maskCopy);
     if (!has) {
-      m_pimpl->m_matcher->~MaskMatcher();
-      free(m_pimpl->m_matcher);
-      m_pimpl->m_matcher = nullptr;
+      m_pimpl->m_recordStart->~MaskMatcher();
+      free(m_pimpl->m_recordStart);
+      m_pimpl->m_recordStart = nullptr;
     }
     return false;
   }
+  free(m_pimpl->m_recordStartMask);
+  m_pimpl->m_recordStartMask = maskCopy;
+  if (m_pimpl->m_file) {
+    m_pimpl->m_file->SetRecordStart(m_pimpl->m_recordStart);
+  }
   return true;
 }
 
-bool LogReader::GetNextLine(char *buffer, const int bufferSize) {
-  if (!m_pimpl || !m_pimpl->m_file || bufferSize < 1) {
+bool LogReader::SetTimeRange(const char *from, const char *to) {
+  if (!m_pimpl || !m_pimpl->m_file || !*m_pimpl->m_file) {
+    return false;
+  }
+  Timestamp fromTime;
+  Timestamp toTime;
+  if ((from && !fromTime.Parse(from, from + strlen(from))) ||
+      (to && !toTime.Parse(to, to + strlen(to)))) {
     return false;
   }
+  auto &file = *m_pimpl->m_file;
+  const auto begin = from ? FindTimeBound(file, fromTime, 0) : 0;
+  const auto end = to ? FindTimeBound(file, toTime, begin) : file.GetSize();
+  file.SetRange(begin, end < begin ? begin : end);
+  m_pimpl->m_context.Reset();
+  m_pimpl->m_isRangeSet = true;
+  m_pimpl->ResetResultCaching();
+  return true;
+}
+
+bool LogReader::SetContext(const size_t before, const size_t after) {
+  if (!m_pimpl || !m_pimpl->m_context.Set(before, after)) {
+    return false;
+  }
+  m_pimpl->ResetResultCaching();
+  return true;
+}
+
+void LogReader::SetResultCaching(const bool isEnabled) {
+  if (!m_pimpl) {
+    return;
+  }
+  m_pimpl->m_isResultCacheEnabled = isEnabled;
+  m_pimpl->ResetResultCaching();
+}
+
+void LogReader::SetResultCacheSize(const size_t numberOfQueries) {
+  QueryResults::SetCacheSize(numberOfQueries);
+}
+
+void LogReader::SetCapturing(const bool isEnabled) {
+  if (m_pimpl) {
+    m_pimpl->m_isCapturing = isEnabled;
+  }
+}
+
+void LogReader::SetLineNumbering(const bool isEnabled) {
+  if (m_pimpl) {
+    m_pimpl->m_isLineNumberingEnabled = isEnabled;
+  }
+}
+
+void LogReader::SetReadAhead(const size_t bytes) {
+  if (!m_pimpl) {
+    return;
+  }
+  m_pimpl->m_readAhead = bytes;
+  if (m_pimpl->m_file) {
+    m_pimpl->m_file->SetReadAhead(bytes);
+  }
+}
+
+void LogReader::SetScanOnce(const size_t residentLimit) {
+  if (!m_pimpl) {
+    return;
+  }
+  m_pimpl->m_residentLimit = residentLimit;
+  if (m_pimpl->m_file) {
+    m_pimpl->m_file->SetScanOnce(residentLimit);
+  }
+}
+
+void LogReader::SetUtf8(const bool isUtf8) {
+  if (!m_pimpl || m_pimpl->m_isUtf8 == isUtf8) {
+    return;
+  }
+  m_pimpl->m_isUtf8 = isUtf8;
+  if (m_pimpl->m_filter) {
+    m_pimpl->m_filter->SetUtf8(isUtf8);
+  }
+  if (m_pimpl->m_recordStart) {
+    m_pimpl->m_recordStart->SetUtf8(isUtf8);
+  }
+  m_pimpl->ResetResultCaching();
+}
+
+void LogReader::SetMatchLimit(const size_t steps) {
+  if (!m_pimpl) {
+    return;
+  }
+  m_pimpl->m_matchLimit = steps;
+  if (m_pimpl->m_filter) {
+    m_pimpl->m_filter->SetStepsLimit(steps);
+  }
+}
+
+size_t LogReader::GetAbortedRecordsNumber() const {
+  return m_pimpl ? m_pimpl->m_abortedRecordsNumber : 0;
+}
+
+LogReader::Implementation::ReadResult LogReader::Implementation::ReadRecord(
+    Record &record, size_t &scanBudget) {
+  if (!m_file) {
+    return READ_END;
+  }
+  auto &file = *m_file;
+  const auto &complete = [this, &file, &record](const bool isCaptured) {
+    Capture(record, isCaptured);
+    const auto fileBegin = file.GetBegin();
+    record.offset = static_cast<size_t>(record.begin - fileBegin);
+    if (!m_isLineNumberingEnabled) {
+      record.line = 0;
+      return;
+    }
+    auto &pos = m_lineCountPos;
+    auto &number = m_lineNumber;
+    if (record.offset < pos) {
+      // Reading position is moved back, counting from the file begin.
+      pos = number = 0;
+    }
+    number += m_index ? m_index->CountLines(file, pos, record.offset)
+                      : file.CountLines(pos, record.offset);
+    pos = record.offset;
+    record.line = number + 1;
+  };
+
+  auto &caching = m_resultCaching;
+  if (caching.state == ResultCaching::STATE_READY) {
+    StartResultCaching();
+  }
+  if (caching.state == ResultCaching::STATE_CACHED) {
+    if (caching.results &&
+        caching.resultIndex < caching.results->GetMatchesNumber()) {
+      const auto &match = caching.results->GetMatches()[caching.resultIndex++];
+      // Cached records of an archive are extracted only when they are read.
+      if (!file.Lock(match.begin, match.end)) {
+        return READ_END;
+      }
+      record.begin = file.GetBegin() + match.begin;
+      record.end = file.GetBegin() + match.end;
+      record.isMatched = true;
+      record.isGap = false;
+      complete(false);
+      return READ_RECORD;
+    }
+    if (caching.results) {
+      file.SetRange(caching.results->GetScannedEnd(), file.GetSize());
+    }
+    caching.state = ResultCaching::STATE_SCANNING;
+  }
+
+  // Captures are taken by the same check, if the matched record is returned
+  // at once.
+  const auto captures =
+      m_isCapturing && !m_context.IsSet() ? GetMatchCaptures() : nullptr;
+  Context::Record contextRecord;
   for (;;) {
+    if (m_context.Pop(contextRecord)) {
+      record.begin = contextRecord.begin;
+      record.end = contextRecord.end;
+      record.isMatched = contextRecord.isMatched;
+      record.isGap = contextRecord.isGap;
+      complete(false);
+      return READ_RECORD;
+    }
+    if (!scanBudget) {
+      return READ_PAUSED;
+    }
+    if (m_index && !m_recordStart && !m_context.IsSet()) {
+      SkipBlocks();
+    }
+    const auto pos = file.GetPos();
     const char *begin;
     const char *end;
-    if (!m_pimpl->m_file->ReadRecord(begin, end)) {
-      return false;
+    if (!file.ReadRecord(begin, end)) {
+      if (caching.state == ResultCaching::STATE_SCANNING) {
+        StoreResults();
+      }
+      return READ_END;
+    }
+    const auto scanned = file.GetPos() - pos;
+    scanBudget = scanBudget > scanned ? scanBudget - scanned : 0;
+
+    const auto isMatched = !m_filter || m_filter->Match(begin, end, captures);
+    if (!isMatched && m_filter->IsAborted()) {
+      ++m_abortedRecordsNumber;
+    }
+    if (caching.state == ResultCaching::STATE_SCANNING) {
+      AddResult(begin, end, isMatched);
+    }
+    if (m_isStatsCounting) {
+      m_stats.recordsMatched += isMatched;
+    }
+    if (m_context.IsSet()) {
+      m_context.Add(begin, end, isMatched);
+      continue;
     }
-    if (m_pimpl->m_matcher && !m_pimpl->m_matcher->Match(begin, end)) {
+    if (!isMatched) {
       continue;
     }
-    auto len = end - begin;
-    if (len >= bufferSize) {
-      len = bufferSize - 1;
+    record.begin = begin;
+    record.end = end;
+    record.isMatched = true;
+    record.isGap = false;
+    complete(captures != nullptr);
+    return READ_RECORD;
+  }
+}
+
+bool LogReader::GetNextRecord(Record &record) {
+  if (!m_pimpl) {
+    return false;
+  }
+  auto scanBudget = SIZE_MAX;
+  m_pimpl->m_capturesNumber = 0;
+  if (m_pimpl->ReadRecord(record, scanBudget) != Implementation::READ_RECORD) {
+    return false;
+  }
+  m_pimpl->FixCaptures(&record, 1);
+  return true;
+}
+
+bool LogReader::GetNextRecords(Record *records,
+                               const size_t size,
+                               const size_t scanBudget,
+                               size_t &number) {
+  number = 0;
+  if (!m_pimpl) {
+    return false;
+  }
+  auto budget = scanBudget ? scanBudget : SIZE_MAX;
+  m_pimpl->m_capturesNumber = 0;
+  auto isPaused = false;
+  auto isEnd = false;
+  while (number < size && !isPaused && !isEnd) {
+    switch (m_pimpl->ReadRecord(records[number], budget)) {
+      case Implementation::READ_RECORD:
+        ++number;
+        break;
+      case Implementation::READ_PAUSED:
+        isPaused = true;
+        break;
+      case Implementation::READ_END:
+        isEnd = true;
+        break;
+      default:
+        assert(false);
+        isEnd = true;
+        break;
     }
-    memcpy(buffer, begin, len);
-    buffer[len] = 0;
+  }
+  m_pimpl->FixCaptures(records, number);
+  return !isEnd || number > 0;
+}
+
+void LogReader::SetSamplingSeed(const unsigned long long seed) {
+  if (m_pimpl) {
+    m_pimpl->m_samplingSeed = seed;
+  }
+}
+
+bool LogReader::EstimateMatches(const size_t samplesNumber,
+                                Estimate &result) {
+  if (!m_pimpl || !m_pimpl->m_file || !*m_pimpl->m_file || !samplesNumber) {
+    return false;
+  }
+  const auto &file = *m_pimpl->m_file;
+  const auto regionBegin = file.GetPos();
+  const auto regionSize = file.GetEnd() - regionBegin;
+  result = {};
+  result.samplesNumber = samplesNumber;
+  if (!regionSize) {
+    return true;
+  }
+
+  // xorshift64*, seeded by the time stamp counter if the seed is not set.
+  auto state = (m_pimpl->m_samplingSeed ? m_pimpl->m_samplingSeed : __rdtsc()) |
+               1;
+  const auto &random = [&state]() {
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 2685821657736338717ull;
+  };
+
+  // Each record is sampled with probability of its size share, so its
+  // estimate is the region size divided by the record size.
+  double recordsSum = 0;
+  double matchesSum = 0;
+  double matchesSquaresSum = 0;
+  // A sample in a record, which is longer than the window, is missed, as
+  // the whole record is not read for one sample.
+  const size_t window = 1024 * 1024;
+  for (size_t i = 0; i < samplesNumber; ++i) {
+    const char *begin;
+    const char *end;
+    size_t size;
+    if (!file.GetRecordAt(regionBegin + random() % regionSize, window, begin,
+                          end, size)) {
+      continue;
+    }
+    const auto estimate =
+        static_cast<double>(regionSize) / static_cast<double>(size);
+    recordsSum += estimate;
+    if (!m_pimpl->m_filter || m_pimpl->m_filter->Match(begin, end)) {
+      matchesSum += estimate;
+      matchesSquaresSum += estimate * estimate;
+    }
+  }
+
+  const auto number = static_cast<double>(samplesNumber);
+  result.recordsNumber = recordsSum / number;
+  result.matchesNumber = matchesSum / number;
+  const auto variance =
+      samplesNumber > 1
+          ? (matchesSquaresSum - matchesSum * result.matchesNumber) /
+                (number - 1)
+          : 0;
+  const auto error = 1.96 * sqrt((variance > 0 ? variance : 0) / number);
+  result.matchesLowerBound =
+      result.matchesNumber > error ? result.matchesNumber - error : 0;
+  result.matchesUpperBound = result.matchesNumber + error;
+  return true;
+}
+
+bool LogReader::AggregateTemplates() {
+  if (!m_pimpl) {
+    return false;
+  }
+  const auto templates = m_pimpl->GetTemplates();
+  if (!templates) {
+    return false;
+  }
+  Record record;
+  auto scanBudget = SIZE_MAX;
+  while (m_pimpl->ReadRecord(record, scanBudget) ==
+         Implementation::READ_RECORD) {
+    m_pimpl->m_capturesNumber = 0;
+    if (record.isMatched && !templates->Add(record.begin, record.end)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool LogReader::MergeTemplates(const LogReader &other) {
+  if (!m_pimpl || !other.m_pimpl) {
+    return false;
+  }
+  if (!other.m_pimpl->m_templates) {
     return true;
   }
+  const auto templates = m_pimpl->GetTemplates();
+  return templates && templates->Merge(*other.m_pimpl->m_templates);
+}
+
+size_t LogReader::GetTopTemplates(Template *templates,
+                                  const size_t size) const {
+  if (!m_pimpl || !m_pimpl->m_templates) {
+    return 0;
+  }
+  const auto top = static_cast<const Templates::Template **>(
+      malloc(size * sizeof(Templates::Template *)));
+  if (!top) {
+    return 0;
+  }
+  const auto number = m_pimpl->m_templates->GetTop(top, size);
+  for (size_t i = 0; i < number; ++i) {
+    templates[i].begin = top[i]->text;
+    templates[i].end = top[i]->text + top[i]->len;
+    templates[i].recordsNumber = top[i]->count;
+  }
+  free(top);
+  return number;
+}
+
+void LogReader::ResetTemplates() {
+  if (m_pimpl && m_pimpl->m_templates) {
+    m_pimpl->m_templates->Reset();
+  }
+}
+
+void LogReader::SetStatsCounting(const bool isEnabled) {
+  if (!m_pimpl) {
+    return;
+  }
+  m_pimpl->m_isStatsCounting = isEnabled;
+  if (m_pimpl->m_file) {
+    m_pimpl->m_file->SetStatsCounting(isEnabled);
+  }
+  if (m_pimpl->m_filter) {
+    m_pimpl->m_filter->SetStatsCounting(isEnabled);
+  }
+}
+
+bool LogReader::GetStats(Stats &result) const {
+  if (!m_pimpl || !m_pimpl->m_isStatsCounting) {
+    return false;
+  }
+  auto stats = m_pimpl->m_stats;
+  if (m_pimpl->m_file) {
+    m_pimpl->m_file->AddStats(stats);
+  }
+  if (m_pimpl->m_filter) {
+    m_pimpl->m_filter->AddStats(stats);
+  }
+  result.bytesScanned = stats.bytesScanned;
+  result.bytesSkipped = stats.bytesSkipped;
+  result.bytesReleased = stats.bytesReleased;
+  result.recordsRead = stats.recordsRead;
+  result.recordsMatched = stats.recordsMatched;
+  result.quickRejections = stats.quickRejections;
+  result.greedyRetries = stats.greedyRetries;
+  result.literalSearches = stats.literalSearches;
+  result.literalComparisons = stats.literalComparisons;
+  return true;
+}
+
+bool LogReader::GetNextLine(char *buffer, const int bufferSize) {
+  if (bufferSize < 1) {
+    return false;
+  }
+  Record record;
+  if (!GetNextRecord(record)) {
+    return false;
+  }
+  auto len = record.end - record.begin;
+  if (len >= bufferSize) {
+    len = bufferSize - 1;
+  }
+  memcpy(buffer, record.begin, len);
+  buffer[len] = 0;
+  return true;
 }
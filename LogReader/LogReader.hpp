@@ -9,6 +9,95 @@
 //! LogReader implements log records reading.
 class LogReader {
  public:
+  //! Span is a part of record content.
+  struct Span {
+    const char *begin;
+    const char *end;
+  };
+
+  //! Record is a record of log.
+  /**
+   * Content is not copied, it's valid until the file is closed (the file is
+   * closed automatically by the reading call after the one, which finds no
+   * more records).
+   */
+  struct Record {
+    //! Content begin.
+    const char *begin;
+    //! Content end.
+    const char *end;
+    //! Content begin offset in the file in bytes.
+    size_t offset;
+    //! 1-based number of the first record line in the file or zero if line
+    //! numbering is disabled.
+    size_t line;
+    //! True if the record corresponds to the filter, false if it's a context
+    //! record around matched record.
+    bool isMatched;
+    //! True if context is set and there are skipped records between this
+    //! record and the previous returned record.
+    bool isGap;
+    //! Parts of matched record content, which are matched by "*" and "?"
+    //! groups of the filter mask, in order of the mask, or nullptr if
+    //! capturing is disabled. Parts are valid until the next call of
+    //! GetNextRecord or GetNextRecords.
+    /**
+     * @sa SetCapturing
+     */
+    const Span *captures;
+    //! Number of captures.
+    size_t capturesNumber;
+  };
+
+  //! Template is a shape of matched records.
+  struct Template {
+    //! Template text begin, the text is a record where UUIDs, hex numbers
+    //! and decimal numbers are replaced by "<uuid>", "<hex>" and "<num>".
+    //! Text is valid until templates are changed.
+    const char *begin;
+    //! Template text end.
+    const char *end;
+    //! Number of matched records with the template.
+    unsigned long long recordsNumber;
+  };
+
+  //! Estimate is an approximate number of records and matched records.
+  struct Estimate {
+    //! Estimated number of records.
+    double recordsNumber;
+    //! Estimated number of records that correspond to the filter.
+    double matchesNumber;
+    //! Lower bound of the 95% confidence interval of the matches number.
+    double matchesLowerBound;
+    //! Upper bound of the 95% confidence interval of the matches number.
+    double matchesUpperBound;
+    //! Number of checked sample records.
+    size_t samplesNumber;
+  };
+
+  //! Stats is a set of reading and matching counters.
+  struct Stats {
+    //! Number of bytes passed by the reading position.
+    unsigned long long bytesScanned;
+    //! Number of bytes skipped by the skip index without reading.
+    unsigned long long bytesSkipped;
+    //! Number of read bytes released from memory by the scan-once mode.
+    unsigned long long bytesReleased;
+    //! Number of read records.
+    unsigned long long recordsRead;
+    //! Number of records that correspond to the filter.
+    unsigned long long recordsMatched;
+    //! Number of records rejected by the filter length bounds, fixed strings
+    //! at the mask begin and end and required symbols before full check.
+    unsigned long long quickRejections;
+    //! Number of branches checked by the filter after "*" and "?" blocks.
+    unsigned long long greedyRetries;
+    //! Number of searches of filter fixed string blocks.
+    unsigned long long literalSearches;
+    //! Number of positions compared with filter fixed string blocks.
+    unsigned long long literalComparisons;
+  };
+
   LogReader();
   LogReader(LogReader &&) = default;
   LogReader(const LogReader &) = delete;
@@ -16,10 +105,51 @@ class LogReader {
   LogReader &operator=(const LogReader &) = delete;
   ~LogReader();
 
+  //! Sets the maximum number of files, which are kept mapped by the process
+  //! after all readers closed them.
+  /**
+   * Readers of the same file share one file mapping, while the file is not
+   * changed. The mappings of closed files are kept for next readers and are
+   * closed in the least recently used order, or when the file is changed and
+   * opened again. A kept archive keeps its cache of decompressed blocks.
+   * Windows doesn't truncate a mapped file, so a log writer can't truncate a
+   * kept file. By default no files are kept.
+   */
+  static void SetFileCacheSize(size_t numberOfFiles);
+
+  //! Compresses the file of log to the seekable archive.
+  /**
+   * The archive is opened as a usual file of log without a temporary file on
+   * the disk: its blocks are decompressed to memory once for all readers of
+   * the file, the blocks ahead of the reading are decompressed in parallel by
+   * the thread pool. Blocks stay in memory while records of a reader can
+   * refer to them, and up to 32 MB of other blocks of each archive are kept.
+   *
+   * @param[in] filePath File of log path.
+   * @param[in] archivePath Archive path, the file is overwritten.
+   * @return True at success, false at error.
+   */
+  static bool CompressFile(const char *filePath, const char *archivePath);
+
+  //! Builds skip index of the file of log.
+  /**
+   * The index is stored near the file in the file with ".lri" extension and
+   * is used by next readers of the file while the indexed part of the file is
+   * not changed. For each 1 MB block the index has a bloom filter of symbol
+   * trigrams, so blocks without filter fixed strings are skipped without
+   * reading, and numbers of lines, so line numbers are counted without
+   * reading. The index takes about 6% of the file size.
+   *
+   * The index is not used with the record start and with the context.
+   *
+   * @return True at success, false at error.
+   */
+  static bool BuildIndex(const char *filePath);
+
   //! Opens file of log. Returns false at error or if file is already opened.
   bool Open(const char *filePath);
-  //! Closes file and resets filter. Does nothing if file is not open or filter
-  //! is not set.
+  //! Closes file, the filter and other options are kept for the next file.
+  //! Does nothing if file is not open.
   void Close();
 
   //! Sets records filter for log record.
@@ -36,8 +166,217 @@ class LogReader {
    */
   bool SetFilter(const char *);
 
+  //! Sets records filter as a boolean expression of masks.
+  /**
+   * The expression consists of masks in double quotes, operators AND, OR,
+   * NOT and parentheses. NOT has the highest priority, OR has the lowest.
+   * Use slash before a double quote to find it, other slash sequences are
+   * passed to the mask as is.
+   *
+   * Example: "\"*ERROR*\" AND NOT \"*healthcheck*\"" to match error records
+   * except records of health checks.
+   *
+   * Operands are checked until the result is known. The order of operands is
+   * adapted to the observed check time and results, so the fastest to
+   * complete check goes first.
+   *
+   *  @return True at success, false at error.
+   */
+  bool SetFilterExpression(const char *expression);
+
+  //! Sets mask for lines which start records.
+  /**
+   * By default each line is a record. If the record start is set - a record
+   * starts only at a line which begins with a string matching the mask, and
+   * the following lines (like stack traces) are continuation of this record
+   * until the next record start. Mask syntax is the same as for SetFilter, the
+   * rest of the line after the matched prefix is not checked.
+   *
+   * Example: "20??-??-?? " to start records at lines like "2019-04-14 ...".
+   *
+   * @param[in] mask Record start mask or nullptr to make each line a record.
+   * @return True at success, false at error.
+   */
+  bool SetRecordStart(const char *mask);
+
+  //! Restricts records by the time window and moves reading position to the
+  //! window begin.
+  /**
+   * Records are expected to be written in time order and to start with a
+   * timestamp in one of the formats:
+   *   YYYY-MM-DD HH:MM[:SS[.FFFFFF]]
+   *   HH:MM[:SS[.FFFFFF]]
+   * Records without timestamp belong to the previous record with timestamp.
+   * If the window bound has no date - only time of day is compared.
+   *
+   * The window is found by binary search over the file, so it doesn't read
+   * records out of the window.
+   *
+   * Example: SetTimeRange("10:00", "10:05") to read records from 10:00:00
+   * inclusive to 10:05:00 exclusive.
+   *
+   * @param[in] from Window begin (inclusive) or nullptr if the window starts
+   * from the file begin.
+   *
+   * @param[in] to Window end (exclusive) or nullptr if the window ends at the
+   * file end.
+   *
+   * @return True at success, false if the file is not opened or if a bound
+   * could not be parsed.
+   */
+  bool SetTimeRange(const char *from, const char *to);
+
+  //! Sets number of context records to return before and after each record
+  //! that corresponds to the filter.
+  /**
+   * Overlapped contexts are merged, each record is returned once.
+   * By default there is no context.
+   *
+   * @return True at success, false at error.
+   */
+  bool SetContext(size_t before, size_t after);
+
+  //! Enables or disables the use of the process-wide result cache.
+  /**
+   * If enabled - matched records are stored for the file, the filter and the
+   * record start mask, and the next reading with the same query returns
+   * stored records without file scanning. If the file is grown - only the
+   * appended part is scanned. The cache is not used with the time range, with
+   * the context or with the match limit. Disabled by default.
+   *
+   * @sa SetResultCacheSize
+   */
+  void SetResultCaching(bool isEnabled);
+
+  //! Sets the maximum number of queries which results are kept by the
+  //! process. By default results of 64 queries are kept.
+  static void SetResultCacheSize(size_t numberOfQueries);
+
+  //! Enables or disables line numbers in returned records.
+  /**
+   * Lines are counted lazily between returned records, so records, that are
+   * not returned, are not split into lines. Disabled by default.
+   *
+   * @sa Record
+   */
+  void SetLineNumbering(bool isEnabled);
+
+  //! Sets size of the file region after the reading position which is
+  //! requested from the disk in advance.
+  /**
+   * The region is loaded asynchronously while already loaded records are
+   * matched, so reading of a file that is not in the system cache doesn't
+   * stall on each page. Zero disables read-ahead. By default it's 4 MB.
+   */
+  void SetReadAhead(size_t bytes);
+
+  //! Enables scan-once mode, which keeps in memory only the last part of the
+  //! read file region.
+  /**
+   * Pages of read records are removed from the process working set when the
+   * reading position passes the limit, and the rest is removed at the file
+   * end, so a large archival scan doesn't grow the process memory and
+   * doesn't push out pages of the working set of other processes. Records
+   * stay valid, their pages are read again from the system cache if they
+   * are accessed after that. The region which is read ahead is not limited.
+   * Blocks of compressed archives, which are more than half of the limit
+   * behind the reading position, are unlocked, so records of an archive are
+   * valid only while they're within that half.
+   *
+   * Released pages stay in the system cache. Pages of a thread with lowered
+   * memory priority (SetThreadInformation with ThreadMemoryPriority) are
+   * repurposed first, so the reading thread can lower it for the scan.
+   *
+   * @param[in] residentLimit Size of the read region in bytes, which is kept
+   * in memory, zero disables the mode (default).
+   */
+  void SetScanOnce(size_t residentLimit);
+
+  //! Sets UTF-8 mode of masks.
+  /**
+   * In UTF-8 mode "?" of the filter and of the record start is one symbol
+   * (code point) instead of one byte, so it doesn't take a part of a
+   * multi-byte symbol. Records with only ASCII symbols are found with SSE2
+   * and are checked by bytes as without the mode. The mode is disabled by
+   * default.
+   */
+  void SetUtf8(bool isUtf8);
+
+  //! Enables or disables capturing of parts of matched records, which are
+  //! matched by "*" and "?" groups of the filter mask.
+  /**
+   * A group is a sequence of "*" and "?" symbols, so the filter
+   * "* ERROR [*] *" returns three parts: the time, the module and the
+   * message. Parts are pointers to the file content, they are not copied.
+   * Parts are found in the same filter check, which matches the record, and
+   * only for matched records, so not matched records are checked at the same
+   * speed. Records of the result cache and matched records, which are
+   * returned after context records, are checked again. Parts are returned
+   * only if the filter is one mask, not an expression of several masks.
+   * Disabled by default.
+   *
+   * @sa Record
+   */
+  void SetCapturing(bool isEnabled);
+
+  //! Limits time of the filter check for one record.
+  /**
+   * The filter check time is proportional to the record length multiplied by
+   * the filter length in the worst case. If the limit is set - the check is
+   * stopped after the given number of steps and the record is skipped as not
+   * corresponding to the filter. Zero means "no limit" and it's the default.
+   *
+   * @sa GetAbortedRecordsNumber
+   */
+  void SetMatchLimit(size_t steps);
+
+  //! Returns number of records skipped because of the match limit since the
+  //! reader creation.
+  /**
+   * @sa SetMatchLimit
+   */
+  size_t GetAbortedRecordsNumber() const;
+
   //! Returns next (or first) record of log, that corresponds by the provided
-  //! filter.
+  //! filter, or context record around it.
+  /**
+   * @params[out] record Record content and attributes.
+   *
+   * @sa SetFilter
+   * @sa SetContext
+   *
+   * @return True if record successfully extracted. False if there are no more
+   * records or if an error has occurred.
+   */
+  bool GetNextRecord(Record &record);
+
+  //! Returns a batch of next records without blocking the caller for a long
+  //! time.
+  /**
+   * Reads records until the buffer is filled or until the reading position
+   * passes the scan budget, so a reader can be polled from an event loop
+   * together with other sources, without a thread per reader. Records are
+   * the same as GetNextRecord returns.
+   *
+   * @params[out] records Buffer for records.
+   * @param[in] size Buffer size in records.
+   * @param[in] scanBudget Number of file bytes to pass by one call, zero
+   * means no limit.
+   * @params[out] number Number of returned records, may be zero if the budget
+   * is exhausted before the next record.
+   *
+   * @sa GetNextRecord
+   *
+   * @return True if records are returned or if the reading can be continued.
+   * False if there are no more records or if an error has occurred.
+   */
+  bool GetNextRecords(Record *records,
+                      size_t size,
+                      size_t scanBudget,
+                      size_t &number);
+
+  //! Returns next (or first) record of log, that corresponds by the provided
+  //! filter, or context record around it.
   /**
    * @params[out] buffer Address to a buffer for request error.
    *
@@ -45,12 +384,90 @@ class LogReader {
    * record will be truncated by provided size.
    *
    * @se SetFilter
+   * @sa GetNextRecord
    *
    * @return True if record successfully extracted. False if there are no more
    * records or if an error has occurred.
    */
   bool GetNextLine(char *buffer, int bufferSize);
 
+  //! Estimates number of records after the reading position, that correspond
+  //! to the filter, by random samples.
+  /**
+   * Each sample is a record at a random offset of the rest of the reading
+   * region, so only pages with sampled records are read and the time doesn't
+   * depend on the file size. Long records get more samples, so each sample is
+   * weighted by its record size and the estimate isn't biased by lengths of
+   * records. The error decreases as the square root of the samples number.
+   * The reading position is not changed. A sample in a record, which begin
+   * or end is farther than 1 MB from the sampled offset, is missed.
+   *
+   * @sa SetSamplingSeed
+   * @param[in] samplesNumber Number of records to check.
+   * @params[out] result Estimated numbers and the confidence interval.
+   * @return True at success, false if the file is not opened or if samples
+   * number is zero.
+   */
+  bool EstimateMatches(size_t samplesNumber, Estimate &result);
+
+  //! Sets the seed of random offsets of samples.
+  /**
+   * With the same seed samples of the same region are the same, so the
+   * estimate is reproducible. Zero seeds each estimate by the time stamp
+   * counter (default).
+   *
+   * @sa EstimateMatches
+   */
+  void SetSamplingSeed(unsigned long long seed);
+
+  //! Reads the rest of matched records and counts them by templates.
+  /**
+   * Records are not returned, so triage of a large file gets a small summary
+   * by one pass. Context records are not counted. Templates are counted in
+   * addition to already counted templates.
+   *
+   * @sa GetTopTemplates
+   * @return True at success, false at error.
+   */
+  bool AggregateTemplates();
+
+  //! Adds templates counted by other reader, so parts of a file or different
+  //! files can be aggregated by several readers in parallel.
+  /**
+   * @return True at success, false at error.
+   */
+  bool MergeTemplates(const LogReader &);
+
+  //! Returns the most frequent templates of counted records.
+  /**
+   * @params[out] templates Buffer for templates from the most frequent.
+   * @param[in] size Buffer size.
+   * @return Number of returned templates.
+   */
+  size_t GetTopTemplates(Template *templates, size_t size) const;
+
+  //! Removes counted templates.
+  void ResetTemplates();
+
+  //! Enables or disables counting of reading and matching counters.
+  /**
+   * Counters are counted by the file reading, the filter and its masks in
+   * each build, while counting is enabled, so a slow filter can be analyzed
+   * in production. Without counting the reading takes one check of a flag
+   * per counter. Disabled by default.
+   *
+   * @sa GetStats
+   */
+  void SetStatsCounting(bool isEnabled);
+
+  //! Returns reading and matching counters, which are counted while
+  //! counting is enabled, since the reader creation.
+  /**
+   * @sa SetStatsCounting
+   * @return True at success, false if counting is disabled.
+   */
+  bool GetStats(Stats &) const;
+
  private:
   class Implementation;
   Implementation *m_pimpl = nullptr;
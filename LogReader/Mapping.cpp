@@ -0,0 +1,268 @@
+﻿//
+//    Created: 2019/04/19 10:45
+//     Author: Eugene V. Palchukovsky
+//     E-mail: eugene@palchukovsky.com
+//
+
+#include "Prec.hpp"
+#include "Mapping.hpp"
+#include "Archive.hpp"
+#include "Scan.hpp"
+
+using namespace logReader;
+
+struct Mapping::Cache {
+  SRWLOCK lock = SRWLOCK_INIT;
+  Mapping *first{nullptr};
+  Mapping *last{nullptr};
+  size_t unusedNumber = 0;
+  size_t size = defaultCacheSize;
+
+  void PushFront(Mapping &mapping) {
+    mapping.m_prev = nullptr;
+    mapping.m_next = first;
+    if (first) {
+      first->m_prev = &mapping;
+    } else {
+      last = &mapping;
+    }
+    first = &mapping;
+  }
+
+  void Remove(Mapping &mapping) {
+    (mapping.m_prev ? mapping.m_prev->m_next : first) = mapping.m_next;
+    (mapping.m_next ? mapping.m_next->m_prev : last) = mapping.m_prev;
+    mapping.m_prev = mapping.m_next = nullptr;
+  }
+};
+
+Mapping::Cache &Mapping::GetCache() {
+  static Cache cache;
+  return cache;
+}
+
+Mapping::~Mapping() {
+  Archive::Close(m_archive);
+  if (m_view) {
+    UnmapViewOfFile(m_view);
+  }
+  if (m_handle) {
+    CloseHandle(m_handle);
+  }
+}
+
+const Mapping *Mapping::Acquire(const char *filePath) {
+  // Files of log are written and rotated while they are read, and cached
+  // mappings are kept after reading, so writing and deleting are not
+  // restricted. A changed file has other write time or size.
+  const auto file =
+      CreateFile(filePath, GENERIC_READ,
+                 FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                 nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    return nullptr;
+  }
+  struct Scope {  // NOLINT
+    HANDLE file;
+    Mapping *mapping;
+    ~Scope() {
+      if (mapping) {
+        mapping->~Mapping();
+        free(mapping);
+      }
+      CloseHandle(file);
+    }
+  } scope{file, nullptr};
+
+  BY_HANDLE_FILE_INFORMATION info;
+  if (!GetFileInformationByHandle(file, &info)) {
+    return nullptr;
+  }
+  const auto index = (static_cast<uint64_t>(info.nFileIndexHigh) << 32) |
+                     info.nFileIndexLow;
+  const auto lastWriteTime =
+      (static_cast<uint64_t>(info.ftLastWriteTime.dwHighDateTime) << 32) |
+      info.ftLastWriteTime.dwLowDateTime;
+  const auto size = (static_cast<uint64_t>(info.nFileSizeHigh) << 32) |
+                    info.nFileSizeLow;
+  if (!size || size > SIZE_MAX) {
+    return nullptr;
+  }
+
+  auto &cache = GetCache();
+  const auto &find = [&]() -> Mapping * {
+    for (auto it = cache.first; it;) {
+      const auto next = it->m_next;
+      if (it->m_index != index || it->m_volume != info.dwVolumeSerialNumber) {
+        it = next;
+        continue;
+      }
+      if (it->m_lastWriteTime == lastWriteTime && it->m_fileSize == size) {
+        if (!it->m_refsNumber++) {
+          --cache.unusedNumber;
+        }
+        cache.Remove(*it);
+        cache.PushFront(*it);
+        return it;
+      }
+      if (!it->m_refsNumber) {
+        // The file is changed, nobody reads the previous version.
+        cache.Remove(*it);
+        --cache.unusedNumber;
+        it->~Mapping();
+        free(it);
+      }
+      it = next;
+    }
+    return nullptr;
+  };
+
+  AcquireSRWLockExclusive(&cache.lock);
+  auto result = find();
+  ReleaseSRWLockExclusive(&cache.lock);
+  if (result) {
+    return result;
+  }
+
+  scope.mapping = static_cast<Mapping *>(malloc(sizeof(Mapping)));
+  if (!scope.mapping) {
+    return nullptr;
+  }
+  auto &mapping = *new (scope.mapping) Mapping();
+  mapping.m_volume = info.dwVolumeSerialNumber;
+  mapping.m_index = index;
+  mapping.m_lastWriteTime = lastWriteTime;
+  mapping.m_fileSize = size;
+  mapping.m_size = static_cast<size_t>(size);
+  mapping.m_handle = CreateFileMapping(file, nullptr, PAGE_READONLY,
+                                       info.nFileSizeHigh, info.nFileSizeLow,
+                                       nullptr);
+  if (!mapping.m_handle) {
+    return nullptr;
+  }
+  mapping.m_view = static_cast<const char *>(
+      MapViewOfFile(mapping.m_handle, FILE_MAP_READ, 0, 0, 0));
+  if (!mapping.m_view) {
+    return nullptr;
+  }
+  mapping.m_content = mapping.m_view;
+  // A file of log can start with the archive signature, it's read as is if
+  // it's not a valid archive.
+  if (Archive::IsArchive(mapping.m_view, mapping.m_size)) {
+    mapping.m_archive = Archive::Open(mapping.m_view, mapping.m_size);
+    if (!mapping.m_archive) {
+      return nullptr;
+    }
+    mapping.m_content = mapping.m_archive->GetContent();
+    mapping.m_size = mapping.m_archive->GetContentSize();
+  }
+  mapping.m_refsNumber = 1;
+
+  AcquireSRWLockExclusive(&cache.lock);
+  // Another reader could map the same file at the same time.
+  result = find();
+  if (!result) {
+    result = scope.mapping;
+    scope.mapping = nullptr;
+    cache.PushFront(*result);
+  }
+  ReleaseSRWLockExclusive(&cache.lock);
+  return result;
+}
+
+const Mapping *Mapping::Acquire(const Mapping &mapping) {
+  auto &cache = GetCache();
+  AcquireSRWLockExclusive(&cache.lock);
+  assert(mapping.m_refsNumber > 0);
+  ++const_cast<Mapping &>(mapping).m_refsNumber;
+  ReleaseSRWLockExclusive(&cache.lock);
+  return &mapping;
+}
+
+void Mapping::Release(const Mapping *constMapping) {
+  if (!constMapping) {
+    return;
+  }
+  auto &cache = GetCache();
+  AcquireSRWLockExclusive(&cache.lock);
+  // Cache owns each mapping, readers get only constant pointers.
+  auto &mapping = *const_cast<Mapping *>(constMapping);
+  assert(mapping.m_refsNumber > 0);
+  if (!--mapping.m_refsNumber) {
+    ++cache.unusedNumber;
+    Evict(cache);
+  }
+  ReleaseSRWLockExclusive(&cache.lock);
+}
+
+void Mapping::SetCacheSize(const size_t size) {
+  auto &cache = GetCache();
+  AcquireSRWLockExclusive(&cache.lock);
+  cache.size = size;
+  Evict(cache);
+  ReleaseSRWLockExclusive(&cache.lock);
+}
+
+void Mapping::Evict(Cache &cache) {
+  for (auto it = cache.last; it && cache.unusedNumber > cache.size;) {
+    const auto prev = it->m_prev;
+    if (!it->m_refsNumber) {
+      cache.Remove(*it);
+      --cache.unusedNumber;
+      it->~Mapping();
+      free(it);
+    }
+    it = prev;
+  }
+}
+
+void Mapping::GetBlock(const size_t pos, size_t &begin, size_t &end) const {
+  if (m_archive) {
+    m_archive->GetBlock(pos, begin, end);
+    return;
+  }
+  begin = 0;
+  end = m_size;
+}
+
+bool Mapping::Lock(const size_t begin, const size_t end) const {
+  return !m_archive || begin >= end || m_archive->Lock(begin, end);
+}
+
+void Mapping::Unlock(const size_t begin, const size_t end) const {
+  if (m_archive && begin < end) {
+    m_archive->Unlock(begin, end);
+  }
+}
+
+void Mapping::Prefetch(const size_t begin, const size_t end) const {
+  if (begin >= end) {
+    return;
+  }
+  if (m_archive) {
+    m_archive->Prefetch(begin, end);
+    return;
+  }
+  // Pages are read asynchronously, the error is not important as it's only a
+  // hint.
+  WIN32_MEMORY_RANGE_ENTRY range{const_cast<char *>(m_content + begin),
+                                 end - begin};
+  PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+}
+
+bool Mapping::GetFingerprint(const size_t size, uint64_t &result) const {
+  assert(size <= m_size);
+  const auto partSize =
+      size < fingerprintPartSize ? size : size_t(fingerprintPartSize);
+  if (!Lock(0, partSize)) {
+    return false;
+  }
+  if (!Lock(size - partSize, size)) {
+    Unlock(0, partSize);
+    return false;
+  }
+  result = logReader::GetFingerprint(m_content, size);
+  Unlock(size - partSize, size);
+  Unlock(0, partSize);
+  return true;
+}
@@ -0,0 +1,129 @@
+﻿//
+//    Created: 2019/04/19 10:40
+//     Author: Eugene V. Palchukovsky
+//     E-mail: eugene@palchukovsky.com
+//
+
+#pragma once
+
+namespace logReader {
+
+class Archive;
+
+//! Mapping is a read-only view of a file, which is shared by all readers of
+//! the file in the process.
+/**
+ * Mappings are cached by the file identity (volume and file index), the last
+ * write time and the size, so a changed file gets a new mapping and unused
+ * mappings of its previous versions are closed. Unused mappings are kept open
+ * up to the cache size and are closed in the least recently used order.
+ * Windows doesn't truncate a mapped file, so by default the cache is empty
+ * and a mapping is closed when the last reader releases it. Thread-safe.
+ *
+ * The content of an archive is shared the same way, its blocks are extracted
+ * once for all readers. Only locked regions of the archive content are
+ * readable, the whole content of a plain file is always readable.
+ *
+ * @sa Archive
+ */
+class Mapping {
+ public:
+  //! Default number of unused mappings which are kept open.
+  enum : size_t { defaultCacheSize = 0 };
+
+  Mapping(Mapping &&) = delete;
+  Mapping(const Mapping &) = delete;
+  Mapping &operator=(Mapping &&) = delete;
+  Mapping &operator=(const Mapping &) = delete;
+
+  //! Acquire returns the mapping of the file and creates it if there is no
+  //! actual mapping in the cache.
+  /**
+   * @return Mapping which has to be released by Release, or nullptr at error
+   * or if the file is empty.
+   */
+  static const Mapping *Acquire(const char *filePath);
+
+  //! Acquire acquires one more reference to the acquired mapping.
+  static const Mapping *Acquire(const Mapping &);
+
+  //! Release releases the mapping, which is acquired by Acquire.
+  static void Release(const Mapping *);
+
+  //! SetCacheSize sets the maximum number of unused mappings which are kept
+  //! open, and closes extra mappings.
+  static void SetCacheSize(size_t size);
+
+  //! GetBegin returns the file content begin.
+  const char *GetBegin() const { return m_content; }
+
+  //! GetSize returns the file content size in bytes.
+  size_t GetSize() const { return m_size; }
+
+  //! IsArchive returns true if the content is decompressed from an archive.
+  bool IsArchive() const { return m_archive != nullptr; }
+
+  //! GetBlock returns borders of the content block with the position, which
+  //! is locked as a whole. The content of a plain file is one block.
+  void GetBlock(size_t pos, size_t &begin, size_t &end) const;
+
+  //! Lock makes the content region readable until Unlock.
+  /**
+   * Blocks of an archive are extracted if they are not extracted yet. Does
+   * nothing for a plain file.
+   *
+   * @return True at success, false at error (the region is not locked).
+   */
+  bool Lock(size_t begin, size_t end) const;
+
+  //! Unlock unlocks the content region, which is locked by Lock.
+  void Unlock(size_t begin, size_t end) const;
+
+  //! Prefetch requests the content region to be loaded in memory before it's
+  //! read, asynchronously.
+  void Prefetch(size_t begin, size_t end) const;
+
+  //! GetFingerprint returns the fingerprint of the content region from the
+  //! begin, like logReader::GetFingerprint.
+  /**
+   * @return True at success, false at error.
+   */
+  bool GetFingerprint(size_t size, uint64_t &result) const;
+
+  //! GetVolume returns the serial number of the file volume.
+  uint32_t GetVolume() const { return m_volume; }
+
+  //! GetFileIndex returns the file identifier, which is unique on the volume.
+  uint64_t GetFileIndex() const { return m_index; }
+
+ private:
+  struct Cache;
+
+  Mapping() = default;
+  ~Mapping();
+
+  static Cache &GetCache();
+
+  //! Evict closes the least recently used unused mappings over the cache
+  //! size. Has to be called under the cache lock.
+  static void Evict(Cache &);
+
+  uint32_t m_volume = 0;
+  uint64_t m_index = 0;
+  uint64_t m_lastWriteTime = 0;
+  uint64_t m_fileSize = 0;
+  size_t m_size = 0;
+  void *m_handle{nullptr};
+  const char *m_view{nullptr};
+  //! The archive of the view or nullptr if the file is not an archive.
+  Archive *m_archive{nullptr};
+  //! The view or the archive content.
+  const char *m_content{nullptr};
+  //! Number of readers, which use the mapping.
+  size_t m_refsNumber = 0;
+  //! Cache list links, the list is ordered from the recently used.
+  Mapping *m_prev{nullptr};
+  Mapping *m_next{nullptr};
+};
+
+}  // namespace logReader
@@ -7,14 +7,41 @@
 #include "Prec.hpp"
 #include "MaskMatcher.hpp"
 #include "Rules.hpp"
+#include "Scan.hpp"
 
 using namespace logReader;
 
+namespace {
+
+//! Maximum size of the failed branches bit set in words, which is kept
+//! between checks, a larger bit set of a long record is freed after it.
+const size_t keptFailedSize = 16 * 1024;
+
+//! Returns estimated frequency class of the symbol in log text, the rarest
+//! symbols have the lowest class.
+int GetFrequencyClass(const uint8_t symbol) {
+  if (symbol == ' ' || (symbol >= '0' && symbol <= '9') ||
+      (symbol >= 'a' && symbol <= 'z')) {
+    return 3;
+  }
+  if (symbol >= 'A' && symbol <= 'Z') {
+    return 2;
+  }
+  if (symbol > ' ' && symbol < 0x7F) {
+    // Punctuation.
+    return 1;
+  }
+  return 0;
+}
+
+}  // namespace
+
 void MaskMatcher::RuleSet::CleanUp() {
   assert(!set || size > 0);
   assert(set || size == 0);
   for (size_t i = 0; i < size; ++i) {
     set[i]->~Rule();
+    free(set[i]);
   }
   free(set);
   set = nullptr;
@@ -29,6 +56,7 @@ bool MaskMatcher::Compile(const char *mask) {
   const auto maskLen = strlen(mask);
   if (maskLen == 0) {
     m_rules.CleanUp();
+    Analyze();
     return true;
   }
 
@@ -95,6 +123,9 @@ bool MaskMatcher::Compile(const char *mask) {
           } else if (!scope.rules.AddRule<AnySymbolWithLen0OrNRule>(1)) {
             return false;
           }
+        } else {
+          // "?" after "*" changes nothing, so the next "?" is also after "*".
+          continue;
         }
         break;
 
@@ -116,6 +147,7 @@ bool MaskMatcher::Compile(const char *mask) {
         break;
 
       default:
+        len = 0;
         continueString(it);
         break;
     }
@@ -128,94 +160,384 @@ bool MaskMatcher::Compile(const char *mask) {
   const auto tmp = m_rules;
   m_rules = scope.rules;
   scope.rules = tmp;
+  SetStatsCounting(m_isStatsCounting);
+  Analyze();
   return true;
 }
 
-MaskMatcher::~MaskMatcher() { m_rules.CleanUp(); }
+MaskMatcher::~MaskMatcher() {
+  CleanUpMatching();
+  m_rules.CleanUp();
+}
+
+void MaskMatcher::Analyze() {
+  m_prefix = m_suffix = nullptr;
+  m_prefixLen = m_suffixLen = 0;
+  m_rulesBegin = 0;
+  m_rulesEnd = m_rules.size;
+  if (m_rules.size > 0 && m_rules.set[0]->GetFixedString()) {
+    m_prefix = m_rules.set[0]->GetFixedString();
+    m_prefixLen = m_rules.set[0]->GetMinLen();
+    m_rulesBegin = 1;
+  }
+  if (m_rules.size > m_rulesBegin &&
+      m_rules.set[m_rules.size - 1]->GetFixedString()) {
+    m_suffix = m_rules.set[m_rules.size - 1]->GetFixedString();
+    m_suffixLen = m_rules.set[m_rules.size - 1]->GetMinLen();
+    m_rulesEnd = m_rules.size - 1;
+  }
+
+  m_minLen = m_maxLen = 0;
+  m_capturesNumber = 0;
+  memset(m_requiredSymbols, 0, sizeof(m_requiredSymbols));
+  m_checkedSymbolsNumber = 0;
+  for (size_t i = 0; i < m_rules.size; ++i) {
+    const auto &rule = *m_rules.set[i];
+    m_minLen += rule.GetMinLen();
+    const auto string = rule.GetFixedString();
+    // In UTF-8 mode a symbol of "?" can take up to 4 bytes.
+    const auto maxLen = !string && m_isUtf8 && rule.GetMaxLen() != SIZE_MAX
+                            ? rule.GetMaxLen() * 4
+                            : rule.GetMaxLen();
+    m_maxLen = maxLen == SIZE_MAX || m_maxLen == SIZE_MAX ? SIZE_MAX
+                                                          : m_maxLen + maxLen;
+    if (!string) {
+      ++m_capturesNumber;
+      continue;
+    }
+    const auto isChecked = i >= m_rulesBegin && i < m_rulesEnd;
+    for (size_t j = 0; j < rule.GetMinLen(); ++j) {
+      const auto symbol = static_cast<uint8_t>(string[j]);
+      auto &word = m_requiredSymbols[symbol / 64];
+      const auto bit = 1ull << (symbol % 64);
+      if (word & bit) {
+        continue;
+      }
+      word |= bit;
+      // Symbols of the prefix and of the suffix are already checked by them.
+      if (!isChecked ||
+          (m_prefix && memchr(m_prefix, symbol, m_prefixLen)) ||
+          (m_suffix && memchr(m_suffix, symbol, m_suffixLen))) {
+        continue;
+      }
+      // The list is sorted from the rarest symbol, the most frequent symbol
+      // is replaced if the list is full.
+      auto pos = m_checkedSymbolsNumber;
+      for (; pos > 0 && GetFrequencyClass(static_cast<uint8_t>(
+                            m_checkedSymbols[pos - 1])) >
+                            GetFrequencyClass(symbol);
+           --pos) {
+        if (pos < maxCheckedSymbols) {
+          m_checkedSymbols[pos] = m_checkedSymbols[pos - 1];
+        }
+      }
+      if (pos < maxCheckedSymbols) {
+        m_checkedSymbols[pos] = static_cast<char>(symbol);
+        if (m_checkedSymbolsNumber < maxCheckedSymbols) {
+          ++m_checkedSymbolsNumber;
+        }
+      }
+    }
+  }
+  m_memoizedRule = SIZE_MAX;
+  for (size_t i = m_rulesBegin; i < m_rulesEnd; ++i) {
+    const auto &rule = *m_rules.set[i];
+    if (rule.GetMinLen() != rule.GetMaxLen() && rule.GetMaxLen() != SIZE_MAX) {
+      // Greedy rule with field limit checks the same branches of the next
+      // rules from different positions.
+      m_memoizedRule = i + 1;
+      break;
+    }
+  }
+}
+
+void MaskMatcher::SetUtf8(const bool isUtf8) {
+  m_isUtf8 = isUtf8;
+  Analyze();
+}
+
+void MaskMatcher::SetStatsCounting(const bool isEnabled) {
+  m_isStatsCounting = isEnabled;
+  for (size_t i = 0; i < m_rules.size; ++i) {
+    m_rules.set[i]->SetStatsCounting(isEnabled);
+  }
+}
+
+void MaskMatcher::AddStats(Stats &stats) const {
+  stats.greedyRetries += m_greedyRetriesNumber;
+  stats.quickRejections += m_quickRejectionsNumber;
+  for (size_t i = 0; i < m_rules.size; ++i) {
+    m_rules.set[i]->AddStats(stats);
+  }
+}
+
+bool MaskMatcher::Match(const char *begin, const char *end) const {
+  return Match(begin, end, nullptr);
+}
+
+bool MaskMatcher::Match(const char *begin,
+                        const char *end,
+                        Span *captures) const {
+  assert(!m_rules.set || m_rules.size > 0);
+  assert(m_rules.set || m_rules.size == 0);
+  assert(begin <= end);
+  m_matching.steps = 0;
+  m_matching.isAborted = false;
+  if (!m_rules.set) {
+    // Empty rule set (like mask with empty string) means "only empty
+    // string matches".
+    return begin == end;
+  }
+
+  const auto len = static_cast<size_t>(end - begin);
+  if (len < m_minLen || len > m_maxLen ||
+      (m_prefix && memcmp(begin, m_prefix, m_prefixLen)) ||
+      (m_suffix && memcmp(end - m_suffixLen, m_suffix, m_suffixLen)) ||
+      (m_checkedSymbolsNumber &&
+       !HasSymbols(begin + m_prefixLen, end - m_suffixLen, m_checkedSymbols,
+                   m_checkedSymbolsNumber))) {
+    if (m_isStatsCounting) {
+      ++m_quickRejectionsNumber;
+    }
+    return false;
+  }
+  // Quickly rejected content doesn't prepare the state of branches checking.
+  PrepareMatching(begin, end);
+  m_matching.captures = captures;
+  m_matching.capturesLeft = m_capturesNumber;
+  m_matching.end = end - m_suffixLen;
+  const auto result = CheckRule(m_rulesBegin, begin + m_prefixLen);
 
-size_t MaskMatcher::CheckRule(const size_t rule,
-                              const char *&begin,
-                              const char *strictBegin,
-                              const char *end) const {
-  auto fieldEnd = end;
-  assert(rule < m_rules.size);
+  auto &matching = m_matching;
+  if (matching.failedSize > keptFailedSize) {
+    free(matching.failed);
+    matching.failed = nullptr;
+    matching.failedSize = 0;
+  } else if (matching.failedBegin < matching.failedEnd) {
+    const auto failedEnd =
+        matching.failed +
+        (m_rules.size - m_memoizedRule) * matching.failedRowSize;
+    for (auto row = matching.failed; row < failedEnd;
+         row += matching.failedRowSize) {
+      memset(row + matching.failedBegin, 0,
+             (matching.failedEnd - matching.failedBegin) * sizeof(*row));
+    }
+  }
+  return result;
+}
+
+bool MaskMatcher::CheckRule(const size_t rule, const char *begin) const {
+  auto &matching = m_matching;
+  if (rule >= m_rulesEnd) {
+    return begin == matching.end;
+  }
+  if (++matching.steps > m_stepsLimit && m_stepsLimit) {
+    matching.isAborted = true;
+    return false;
+  }
+
+  uint64_t *failedWord = nullptr;
+  uint64_t failedBit = 0;
+  if (rule >= m_memoizedRule && matching.failed) {
+    const auto pos = static_cast<size_t>(begin - matching.begin);
+    failedWord = matching.failed + (rule - m_memoizedRule) *
+                                       matching.failedRowSize +
+                 pos / 64;
+    failedBit = 1ull << (pos % 64);
+    if (*failedWord & failedBit) {
+      return false;
+    }
+  }
+
+  auto fieldBegin = begin;
+  auto fieldEnd = matching.end;
+  auto result = false;
   static_assert(Rule::numberOfResults == 3, "List changed.");
-  switch (m_rules.set[rule]->Check(begin, strictBegin, fieldEnd)) {
+  switch (m_rules.set[rule]->Check(fieldBegin, begin, fieldEnd)) {
     case Rule::RESULT_COMPLETED_FULL:
       // The current rule is very simple and it completed with the fixed field
       // borders. Starting to check next rule from this field end (rule's
       // written it in begin).
       assert(begin <= fieldEnd);
-      return rule + 1;
+      result = CheckRule(rule + 1, fieldBegin);
+      if (result && !m_rules.set[rule]->GetFixedString()) {
+        // Empty group at the content end.
+        Capture(begin, fieldBegin);
+      }
+      break;
 
-    case Rule::RESULT_COMPLETED_GREEDY: {
+    case Rule::RESULT_COMPLETED_GREEDY:
       // The current rule is greedy so it has to check each possible branch to
       // check with requirements of this greedy rule.
-      if (rule + 1 >= m_rules.size) {
-        // As this is greedy and last rule - it passed for sure.
-        begin = fieldEnd;
-        return rule + 1;
-      }
-      for (;;) {
-        const auto it = begin;
-        auto nextRuleId = rule + 1;
-        if (Match(nextRuleId, begin, fieldEnd, end)) {
-          begin = end;
-          return m_rules.size;
-        }
-        if (it == begin || begin >= fieldEnd) {
-          // No one next rule has found something in this branch from the start.
-          // Negative results too. It means there are no chances to find
-          // something in the rest.
-          return false;
-        }
-        // It has completed branch, but the rule set is over not at the symbol
-        // sequence end.It means one or more greedy rules don't eat enough.
-        // Checking each branch that starts in the current field "strict begin".
-        // New begin has begin for the next field after the last successful.
-        // Continue.
-      }
-    }
+      result = CheckBranches(rule, begin, GetFieldEnd(rule, begin, fieldEnd));
+      break;
 
-    default:
-      assert(false);
     case Rule::RESULT_FAILED:
       // Branch is completed with error.
-      return 0;
+      break;
+
+    default:
+      assert(false);
+      break;
+  }
+
+  if (!result && failedWord && !matching.isAborted) {
+    *failedWord |= failedBit;
+    const auto word =
+        static_cast<size_t>(failedWord - matching.failed) %
+        matching.failedRowSize;
+    if (matching.failedBegin >= matching.failedEnd) {
+      matching.failedBegin = word;
+      matching.failedEnd = word + 1;
+    } else if (word < matching.failedBegin) {
+      matching.failedBegin = word;
+    } else if (word >= matching.failedEnd) {
+      matching.failedEnd = word + 1;
+    }
   }
+  return result;
 }
 
-bool MaskMatcher::Match(size_t &rule,
-                        const char *&begin,
-                        const char *strictBegin,
-                        const char *end) const {
-  assert(rule < m_rules.size);
-  assert(begin <= strictBegin);
-  assert(strictBegin <= end);
-  for (;;) {
-    rule = CheckRule(rule, begin, strictBegin, end);
-    if (rule >= m_rules.size) {
-      assert(begin <= end);
-      return begin == end;
+bool MaskMatcher::CheckBranches(const size_t rule,
+                                const char *begin,
+                                const char *fieldEnd) const {
+  auto &matching = m_matching;
+  const auto nextRule = rule + 1;
+  if (nextRule >= m_rulesEnd) {
+    // As this is greedy and last rule - it passed if it can take the rest.
+    if (fieldEnd != matching.end) {
+      return false;
     }
-    if (!rule) {
+    Capture(begin, fieldEnd);
+    return true;
+  }
+
+  const char **checkedFrom = nullptr;
+  if (m_rules.set[rule]->GetMaxLen() == SIZE_MAX && matching.checkedFrom) {
+    // Without field limit each branch from a position is a branch from
+    // a previous position too, so it's enough to check each branch only once.
+    assert(fieldEnd == matching.end);
+    checkedFrom = &matching.checkedFrom[rule];
+    if (*checkedFrom) {
+      if (begin >= *checkedFrom) {
+        return false;
+      }
+      fieldEnd = *checkedFrom - 1;
+    }
+  }
+
+  auto &next = *m_rules.set[nextRule];
+  const auto nextLen = next.GetMinLen();
+  const auto isNextFixed = nextLen > 0 && nextLen == next.GetMaxLen();
+  for (auto it = begin; it <= fieldEnd; ++it) {
+    if (m_isStatsCounting) {
+      ++m_greedyRetriesNumber;
+    }
+    if (!isNextFixed) {
+      if (CheckRule(nextRule, it)) {
+        Capture(begin, it);
+        return true;
+      }
+    } else {
+      // Jumping to the next position where the next fixed field is found.
+      auto nextBegin = it;
+      auto nextEnd = matching.end;
+      if (next.Check(nextBegin, fieldEnd, nextEnd) !=
+          Rule::RESULT_COMPLETED_FULL) {
+        break;
+      }
+      it = nextBegin - nextLen;
+      if (++matching.steps > m_stepsLimit && m_stepsLimit) {
+        matching.isAborted = true;
+        return false;
+      }
+      if (CheckRule(nextRule + 1, nextBegin)) {
+        Capture(begin, it);
+        return true;
+      }
+    }
+    if (matching.isAborted) {
       return false;
     }
-    strictBegin = begin;
   }
+
+  if (checkedFrom) {
+    *checkedFrom = begin;
+  }
+  return false;
 }
 
-bool MaskMatcher::Match(const char *begin, const char *end) const {
-  assert(!m_rules.set || m_rules.size > 0);
-  assert(m_rules.set || m_rules.size == 0);
-  if (!m_rules.set) {
-    // Empty rule set (like mask with empty string) means "only empty
-    // string matches".
-    return begin == end;
+const char *MaskMatcher::GetFieldEnd(const size_t rule,
+                                     const char *begin,
+                                     const char *fieldEnd) const {
+  auto &matching = m_matching;
+  const auto maxLen = m_rules.set[rule]->GetMaxLen();
+  if (!m_isUtf8 || maxLen == SIZE_MAX ||
+      matching.content == Matching::CONTENT_ASCII) {
+    return fieldEnd;
   }
-  for (size_t i = 0; i < m_rules.size; ++i) {
-    m_rules.set[i]->Reset();
+  if (matching.content == Matching::CONTENT_UNKNOWN) {
+    // Content is checked only when it's required, as the most of content is
+    // rejected before the first field with limit.
+    matching.content = IsAscii(matching.begin, matching.end)
+                           ? Matching::CONTENT_ASCII
+                           : Matching::CONTENT_UTF8;
+    if (matching.content == Matching::CONTENT_ASCII) {
+      return fieldEnd;
+    }
+  }
+  return SkipCodePoints(begin, matching.end, maxLen);
+}
+
+void MaskMatcher::Capture(const char *begin, const char *end) const {
+  auto &matching = m_matching;
+  if (!matching.captures) {
+    return;
+  }
+  assert(matching.capturesLeft > 0);
+  matching.captures[--matching.capturesLeft] = {begin, end};
+}
+
+void MaskMatcher::PrepareMatching(const char *begin, const char *end) const {
+  auto &matching = m_matching;
+  matching.begin = begin;
+  matching.end = end;
+  matching.steps = 0;
+  matching.isAborted = false;
+  matching.content = Matching::CONTENT_UNKNOWN;
+  matching.failedBegin = matching.failedEnd = 0;
+
+  if (matching.checkedFromSize < m_rules.size) {
+    free(matching.checkedFrom);
+    matching.checkedFrom =
+        static_cast<const char **>(malloc(m_rules.size * sizeof(char *)));
+    matching.checkedFromSize = matching.checkedFrom ? m_rules.size : 0;
+  }
+  if (matching.checkedFrom) {
+    memset(matching.checkedFrom, 0, m_rules.size * sizeof(char *));
+  }
+
+  if (m_memoizedRule >= m_rules.size) {
+    matching.failedRowSize = 0;
+    return;
   }
-  size_t rule = 0;
-  return Match(rule, begin, begin, end);
+  // Bit for each position from begin to end inclusive.
+  matching.failedRowSize = static_cast<size_t>(end - begin) / 64 + 1;
+  const auto size =
+      (m_rules.size - m_memoizedRule) * matching.failedRowSize;
+  if (matching.failedSize < size) {
+    // Memory is already clean here, but not the new one.
+    free(matching.failed);
+    matching.failed = static_cast<uint64_t *>(calloc(size, sizeof(uint64_t)));
+    matching.failedSize = matching.failed ? size : 0;
+  }
+}
+
+void MaskMatcher::CleanUpMatching() {
+  free(m_matching.checkedFrom);
+  m_matching.checkedFrom = nullptr;
+  m_matching.checkedFromSize = 0;
+  free(m_matching.failed);
+  m_matching.failed = nullptr;
+  m_matching.failedSize = 0;
 }
@@ -6,10 +6,14 @@
 
 #pragma once
 
+#include "LogReader.hpp"
 #include "Rules.hpp"
 
 namespace logReader {
 
+//! Span is a part of content, the type of record captures.
+using Span = LogReader::Span;
+
 //! MaskMatcher checks a string for a given mask.
 /**
  * @sa Compile.
@@ -47,54 +51,151 @@ class MaskMatcher {
   //! AddRule adds a new rule to the end of the rule sequence.
   template <typename Rule, typename... Args>
   bool AddRule(Args... args) {
-    return m_rules.AddRule<Rule>(args...);
+    if (!m_rules.AddRule<Rule>(args...)) {
+      return false;
+    }
+    Analyze();
+    return true;
   }
 
   //! Match checks is connect matches to compiled mask or not.
   /**
+   * Content length is compared with the mask length bounds and fixed strings
+   * at the mask begin and at the mask end are compared with the content
+   * begin and end first, then the content is checked with SSE2 for a few of
+   * the rarest symbols of other fixed strings, so the most of not matching
+   * content is rejected without branches checking.
+   *
+   * Each branch (rule and content position) is checked not more than once, so
+   * the time is O(n * m) in the worst case, where "n" is the content length
+   * and "m" is the mask length.
+   *
    * @param[in] begin Content begin.
    * @param[in] end Content end.
-   * @return True if content matches, false otherwise.
+   * @return True if content matches, false otherwise or if the check is
+   * aborted by the steps limit.
+   * @sa SetStepsLimit
    */
   bool Match(const char *begin, const char *end) const;
 
- private:
-  //! Match tries to match branch from "begin" for rule set started from "rule".
+  //! Match checks content and returns parts of matched content, which are
+  //! matched by "*" and "?" groups of the mask.
   /**
-   * @param[in,out] rule First rule in sequence. Returns stop-rule, may be out
-   * of rule set range if the rule is the last.
-   *
-   * @param[in,out] begin Branch start. Returns next branch begin.
-   *
-   * @param[in] strictBegin The last position where actual first field can
-   * start.
+   * A group is a sequence of "*" and "?" symbols, like "*", "??" or "?*".
+   * Parts are found on the way back from the matched branch, so checks of
+   * not matching content take the same time as without parts.
    *
+   * @param[in] begin Content begin.
    * @param[in] end Content end.
-   *
-   * @return True if content matches, false otherwise.
+   * @param[out] captures Buffer for GetCapturesNumber() parts in order of
+   * the mask, which is filled if content matches.
+   * @return True if content matches, false otherwise or if the check is
+   * aborted by the steps limit.
+   * @sa Match
+   */
+  bool Match(const char *begin, const char *end, Span *captures) const;
+
+  //! GetCapturesNumber returns number of "*" and "?" groups of the mask.
+  size_t GetCapturesNumber() const { return m_capturesNumber; }
+
+  //! SetUtf8 sets content encoding.
+  /**
+   * In UTF-8 mode "?" is one code point instead of one byte, so "?" doesn't
+   * take a part of a multi-byte symbol. Content without multi-byte symbols
+   * is found by one pass with SSE2 and is checked by bytes as without UTF-8
+   * mode. The mode is disabled by default.
    */
-  bool Match(size_t &rule,
-             const char *&begin,
-             const char *strictBegin,
-             const char *end) const;
+  void SetUtf8(bool isUtf8);
+  //! IsUtf8 returns true if UTF-8 mode is enabled.
+  bool IsUtf8() const { return m_isUtf8; }
 
-  //! Check checks the first rule, continues to check if it is matched.
+  //! SetStepsLimit sets the maximum number of steps for one Match call.
   /**
-   * @param[in] rule First rule in sequence.
+   * Match is aborted if it takes more steps, so the time is limited for any
+   * content length. Zero means "no limit" and it's the default.
    *
-   * @param[in,out] begin Branch start. Returns next branch begin.
-   *
-   * @param[in] strictBegin The last position where actual first field can
-   * start.
-   *
-   * @param[in] end Content end.
-   *
-   * @return Stop-rule, may be out of rule set range if the rule is the last.
+   * @sa IsAborted
    */
-  size_t CheckRule(size_t rule,
-                   const char *&begin,
-                   const char *strictBegin,
-                   const char *end) const;
+  void SetStepsLimit(const size_t limit) { m_stepsLimit = limit; }
+
+  //! IsAborted returns true if the last Match call is aborted by the steps
+  //! limit.
+  bool IsAborted() const { return m_matching.isAborted; }
+
+  //! GetStepsNumber returns the number of steps of the last Match call.
+  size_t GetStepsNumber() const { return m_matching.steps; }
+
+  //! GetMinLen returns the minimal length of matching content.
+  size_t GetMinLen() const { return m_minLen; }
+  //! GetMaxLen returns the maximal length of matching content in bytes or
+  //! SIZE_MAX if the length is not limited.
+  size_t GetMaxLen() const { return m_maxLen; }
+  //! IsRequired returns true if each matching content has the symbol.
+  bool IsRequired(const char symbol) const {
+    const auto byte = static_cast<uint8_t>(symbol);
+    return (m_requiredSymbols[byte / 64] & (1ull << (byte % 64))) != 0;
+  }
+
+  //! GetRulesNumber returns number of rules of the compiled mask.
+  size_t GetRulesNumber() const { return m_rules.size; }
+  //! GetRule returns a rule of the compiled mask by index.
+  const Rule &GetRule(const size_t index) const {
+    assert(index < m_rules.size);
+    return *m_rules.set[index];
+  }
+
+  //! SetStatsCounting enables or disables counters of the matcher and of its
+  //! rules.
+  void SetStatsCounting(bool isEnabled);
+
+  //! AddStats adds matcher counters to the statistics.
+  void AddStats(Stats &) const;
+
+ private:
+  //! CheckRule checks a branch: the rule sequence from the rule for the content
+  //! from the position to the content end.
+  /**
+   * @param[in] rule First rule in sequence, may be out of rule set range.
+   * @param[in] begin Branch start.
+   * @return True if the branch matches, false otherwise.
+   */
+  bool CheckRule(size_t rule, const char *begin) const;
+
+  //! CheckBranches checks each branch after a greedy rule.
+  /**
+   * @param[in] rule The greedy rule.
+   * @param[in] begin The greedy rule field begin.
+   * @param[in] fieldEnd The last position where the greedy rule field can
+   * end.
+   * @return True if one of branches matches, false otherwise.
+   */
+  bool CheckBranches(size_t rule,
+                     const char *begin,
+                     const char *fieldEnd) const;
+
+  //! Analyze analyzes compiled rules.
+  void Analyze();
+
+  //! PrepareMatching resets matching state for the next content.
+  void PrepareMatching(const char *begin, const char *end) const;
+
+  //! GetFieldEnd returns the last position where the greedy rule field with
+  //! limit can end, counting symbols by code points in UTF-8 mode.
+  /**
+   * @param[in] rule The greedy rule.
+   * @param[in] begin The greedy rule field begin.
+   * @param[in] fieldEnd The field end by bytes.
+   */
+  const char *GetFieldEnd(size_t rule,
+                          const char *begin,
+                          const char *fieldEnd) const;
+
+  //! Capture stores the part of content, which is matched by the rule, at
+  //! the way back from the matched branch.
+  void Capture(const char *begin, const char *end) const;
+
+  //! CleanUpMatching frees matching state memory.
+  void CleanUpMatching();
 
   struct RuleSet {
     size_t size = 0;
@@ -106,6 +207,72 @@ class MaskMatcher {
     bool ReplaceRule(size_t, Args...);
     void CleanUp();
   } m_rules;
+
+  //! Matching is a state of the current Match call.
+  struct Matching {
+    enum Content {
+      //! Content is not checked yet.
+      CONTENT_UNKNOWN,
+      //! Content has only ASCII symbols, each symbol is one byte.
+      CONTENT_ASCII,
+      //! Content has multi-byte UTF-8 symbols.
+      CONTENT_UTF8,
+    };
+
+    const char *begin;
+    const char *end;
+    Content content = CONTENT_UNKNOWN;
+    size_t steps = 0;
+    bool isAborted = false;
+    //! Buffer for parts of content matched by groups or nullptr. It's filled
+    //! from the end, as the last group is matched first.
+    Span *captures{nullptr};
+    size_t capturesLeft = 0;
+    //! For each greedy rule without field limit - the first position, the
+    //! field from which is already checked without success. Has size of rule
+    //! set, may be nullptr if there is no memory.
+    const char **checkedFrom{nullptr};
+    size_t checkedFromSize = 0;
+    //! Bit set of failed branches for each rule from m_memoizedRule. May be
+    //! nullptr if there is no memory.
+    uint64_t *failed{nullptr};
+    size_t failedSize = 0;
+    size_t failedRowSize = 0;
+    //! Bounds of failed branches words to clean up.
+    size_t failedBegin = 0;
+    size_t failedEnd = 0;
+  };
+  mutable Matching m_matching;
+  //! The first rule which can check the same branch several times (after a
+  //! greedy rule with field limit), branches from this rule are memoized.
+  size_t m_memoizedRule = SIZE_MAX;
+  //! Fixed string which is anchored to the content begin, or nullptr.
+  const char *m_prefix{nullptr};
+  size_t m_prefixLen = 0;
+  //! Fixed string which is anchored to the content end, or nullptr.
+  const char *m_suffix{nullptr};
+  size_t m_suffixLen = 0;
+  //! Rules which are checked by branches, without prefix and suffix rules.
+  size_t m_rulesBegin = 0;
+  size_t m_rulesEnd = 0;
+  size_t m_stepsLimit = 0;
+  bool m_isUtf8 = false;
+  //! Number of "*" and "?" groups.
+  size_t m_capturesNumber = 0;
+  //! Content length bounds.
+  size_t m_minLen = 0;
+  size_t m_maxLen = 0;
+  //! Set of symbols which each matching content has.
+  uint64_t m_requiredSymbols[4] = {};
+  //! The rarest required symbols, which are not in the prefix or in the
+  //! suffix, so they are searched in the content before rules checking.
+  enum : size_t { maxCheckedSymbols = 4 };
+  char m_checkedSymbols[maxCheckedSymbols] = {};
+  size_t m_checkedSymbolsNumber = 0;
+
+  bool m_isStatsCounting = false;
+  mutable uint64_t m_greedyRetriesNumber = 0;
+  mutable uint64_t m_quickRejectionsNumber = 0;
 };
 
 template <typename RuleImpl, typename... Args>
@@ -171,6 +338,7 @@ bool MaskMatcher::RuleSet::ReplaceRule(const size_t index, Args... args) {
     return false;
   }
   set[index]->~Rule();
+  free(set[index]);
   set[index] = rule;
   return true;
 }
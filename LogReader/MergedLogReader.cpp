@@ -0,0 +1,278 @@
+﻿//
+//    Created: 2019/04/25 10:15
+//     Author: Eugene V. Palchukovsky
+//     E-mail: eugene@palchukovsky.com
+//
+
+#include "Prec.hpp"
+#include "MergedLogReader.hpp"
+#include "Timestamp.hpp"
+
+using namespace logReader;
+
+class MergedLogReader::Implementation {
+ public:
+  //! Source is a file with its next record.
+  struct Source {
+    LogReader *reader;
+    //! True if the reader is created by the merged reader.
+    bool isOwned;
+    LogReader::Record record;
+    //! Timestamp of the record or of the previous record with timestamp,
+    //! time of day without date gets the last known date.
+    Timestamp timestamp;
+    size_t index;
+  };
+
+  Source **m_sources = nullptr;
+  size_t m_sourcesNumber = 0;
+  //! Binary min-heap of sources with read records. The record of the top
+  //! source is returned and the next record of the source is read by the
+  //! next call, so the returned record is valid until then.
+  Source **m_heap = nullptr;
+  size_t m_heapSize = 0;
+  //! The last read timestamp with date. Time of day without date is not
+  //! comparable with dated time consistently, so all timestamps get a date
+  //! as soon as any record has it.
+  Timestamp m_lastDated;
+  bool m_isStarted = false;
+
+  Implementation() = default;
+  Implementation(Implementation &&) = delete;
+  Implementation(const Implementation &) = delete;
+  Implementation &operator=(Implementation &&) = delete;
+  Implementation &operator=(const Implementation &) = delete;
+  ~Implementation() { Close(); }
+
+  void Close() {
+    for (size_t i = 0; i < m_sourcesNumber; ++i) {
+      DestroySource(m_sources[i]);
+    }
+    free(m_sources);
+    free(m_heap);
+    m_sources = m_heap = nullptr;
+    m_sourcesNumber = m_heapSize = 0;
+    m_lastDated = Timestamp();
+    m_isStarted = false;
+  }
+
+  //! Adds the source of the reader, destroys the reader at error if it's
+  //! owned.
+  bool AddSource(LogReader &reader, const bool isOwned) {
+    const auto source = static_cast<Source *>(malloc(sizeof(Source)));
+    if (!source) {
+      DestroyReader(reader, isOwned);
+      return false;
+    }
+    new (source) Source();
+    source->reader = &reader;
+    source->isOwned = isOwned;
+    const auto number = m_sourcesNumber + 1;
+    const auto sources = static_cast<Source **>(
+        realloc(m_sources, number * sizeof(Source *)));
+    if (sources) {
+      m_sources = sources;
+    }
+    const auto heap =
+        static_cast<Source **>(realloc(m_heap, number * sizeof(Source *)));
+    if (heap) {
+      m_heap = heap;
+    }
+    if (!sources || !heap) {
+      DestroySource(source);
+      return false;
+    }
+    source->index = m_sourcesNumber;
+    m_sources[m_sourcesNumber++] = source;
+    return true;
+  }
+
+  static void DestroySource(Source *source) {
+    DestroyReader(*source->reader, source->isOwned);
+    source->~Source();
+    free(source);
+  }
+
+  static void DestroyReader(LogReader &reader, const bool isOwned) {
+    if (isOwned) {
+      reader.~LogReader();
+      free(&reader);
+    }
+  }
+
+  //! Reads the next record of the source, time of day without date gets the
+  //! date of the previous record of the source.
+  static bool Read(Source &source) {
+    if (!source.reader->GetNextRecord(source.record)) {
+      return false;
+    }
+    auto &timestamp = source.timestamp;
+    const auto prev = timestamp;
+    timestamp.Parse(source.record.begin, source.record.end);
+    timestamp.InheritDate(prev);
+    return true;
+  }
+
+  //! Reads the first records of all sources. Time of day without date gets
+  //! the earliest date of them, so the result doesn't depend on files order.
+  void Start() {
+    size_t number = 0;
+    for (size_t i = 0; i < m_sourcesNumber; ++i) {
+      auto &source = *m_sources[i];
+      if (!Read(source)) {
+        continue;
+      }
+      m_heap[number++] = &source;
+      if (source.timestamp.HasDate() &&
+          (!m_lastDated.HasDate() || source.timestamp < m_lastDated)) {
+        m_lastDated = source.timestamp;
+      }
+    }
+    // Push writes only positions up to the pushed one.
+    for (size_t i = 0; i < number; ++i) {
+      auto &source = *m_heap[i];
+      source.timestamp.InheritDate(m_lastDated);
+      Push(source);
+    }
+    m_isStarted = m_sourcesNumber > 0;
+  }
+
+  //! Reads the next record of the top source, time of day without date gets
+  //! the last known date.
+  bool ReadTop() {
+    auto &source = *m_heap[0];
+    if (!Read(source)) {
+      return false;
+    }
+    auto &timestamp = source.timestamp;
+    if (!timestamp.HasDate()) {
+      timestamp.InheritDate(m_lastDated);
+      return true;
+    }
+    if (!m_lastDated.HasDate()) {
+      // The first date: all heap timestamps are without date and get the
+      // same one, so their order is not changed.
+      for (size_t i = 1; i < m_heapSize; ++i) {
+        m_heap[i]->timestamp.InheritDate(timestamp);
+      }
+    }
+    m_lastDated = timestamp;
+    return true;
+  }
+
+  static bool IsEarlier(const Source &lhs, const Source &rhs) {
+    const auto result = lhs.timestamp.Compare(rhs.timestamp);
+    return result < 0 || (result == 0 && lhs.index < rhs.index);
+  }
+
+  void Push(Source &source) {
+    auto pos = m_heapSize++;
+    for (; pos; pos = (pos - 1) / 2) {
+      const auto parent = m_heap[(pos - 1) / 2];
+      if (!IsEarlier(source, *parent)) {
+        break;
+      }
+      m_heap[pos] = parent;
+    }
+    m_heap[pos] = &source;
+  }
+
+  //! Moves the top source down to its place.
+  void SiftDown() {
+    const auto source = m_heap[0];
+    size_t pos = 0;
+    for (;;) {
+      auto child = pos * 2 + 1;
+      if (child >= m_heapSize) {
+        break;
+      }
+      if (child + 1 < m_heapSize &&
+          IsEarlier(*m_heap[child + 1], *m_heap[child])) {
+        ++child;
+      }
+      if (!IsEarlier(*m_heap[child], *source)) {
+        break;
+      }
+      m_heap[pos] = m_heap[child];
+      pos = child;
+    }
+    m_heap[pos] = source;
+  }
+};
+
+MergedLogReader::MergedLogReader()
+    : m_pimpl(static_cast<Implementation *>(malloc(sizeof(Implementation)))) {
+  if (!m_pimpl) {
+    return;
+  }
+  new (m_pimpl) Implementation();
+}
+
+MergedLogReader::~MergedLogReader() {
+  if (m_pimpl) {
+    m_pimpl->~Implementation();
+    free(m_pimpl);
+  }
+}
+
+bool MergedLogReader::Open(const char *filePath, const char *mask) {
+  if (!m_pimpl || m_pimpl->m_isStarted) {
+    return false;
+  }
+  const auto reader = static_cast<LogReader *>(malloc(sizeof(LogReader)));
+  if (!reader) {
+    return false;
+  }
+  new (reader) LogReader();
+  if (!reader->Open(filePath) || (mask && !reader->SetFilter(mask))) {
+    Implementation::DestroyReader(*reader, true);
+    return false;
+  }
+  return m_pimpl->AddSource(*reader, true);
+}
+
+bool MergedLogReader::Open(LogReader &reader) {
+  return m_pimpl && !m_pimpl->m_isStarted &&
+         m_pimpl->AddSource(reader, false);
+}
+
+void MergedLogReader::Close() {
+  if (m_pimpl) {
+    m_pimpl->Close();
+  }
+}
+
+size_t MergedLogReader::GetFilesNumber() const {
+  return m_pimpl ? m_pimpl->m_sourcesNumber : 0;
+}
+
+LogReader &MergedLogReader::GetReader(const size_t fileIndex) {
+  assert(fileIndex < GetFilesNumber());
+  return *m_pimpl->m_sources[fileIndex]->reader;
+}
+
+bool MergedLogReader::GetNextRecord(LogReader::Record &record,
+                                    size_t &fileIndex) {
+  if (!m_pimpl) {
+    return false;
+  }
+  auto &impl = *m_pimpl;
+  if (!impl.m_isStarted) {
+    impl.Start();
+  } else if (impl.m_heapSize) {
+    // The top record is returned by the previous call.
+    if (!impl.ReadTop()) {
+      impl.m_heap[0] = impl.m_heap[--impl.m_heapSize];
+    }
+    if (impl.m_heapSize) {
+      impl.SiftDown();
+    }
+  }
+  if (!impl.m_heapSize) {
+    return false;
+  }
+  const auto &source = *impl.m_heap[0];
+  record = source.record;
+  fileIndex = source.index;
+  return true;
+}
@@ -0,0 +1,83 @@
+﻿//
+//    Created: 2019/04/25 09:40
+//     Author: Eugene V. Palchukovsky
+//     E-mail: eugene@palchukovsky.com
+//
+
+#pragma once
+
+#include "LogReader.hpp"
+
+//! MergedLogReader reads records of several files of log in time order.
+/**
+ * Each file is read by its own LogReader with its own filter, and matched
+ * records of all files are merged by the timestamp at the record begin (see
+ * LogReader::SetTimeRange for formats). A record without timestamp gets the
+ * timestamp of the previous record of its file. Time of day without date gets
+ * the date of the previous dated record of its file, or the last known date
+ * of all files (the earliest date of the first records at the start), so
+ * time of day is never compared with dated time.
+ * Records with equal time are returned in order of files opening.
+ *
+ * Only the next record of each file is kept, so memory doesn't depend on
+ * files size. Each reader requests its file region after the reading position
+ * from the disk in advance (see LogReader::SetReadAhead), so all files are
+ * loaded concurrently while records are matched.
+ */
+class MergedLogReader {
+ public:
+  MergedLogReader();
+  MergedLogReader(MergedLogReader &&) = delete;
+  MergedLogReader(const MergedLogReader &) = delete;
+  MergedLogReader &operator=(MergedLogReader &&) = delete;
+  MergedLogReader &operator=(const MergedLogReader &) = delete;
+  ~MergedLogReader();
+
+  //! Opens one more file of log with its filter.
+  /**
+   * Files can't be opened after the first record is read.
+   *
+   * @param[in] filePath File path.
+   * @param[in] mask Filter of the file records (see LogReader::SetFilter) or
+   * nullptr to read all records.
+   * @return True at success, false at error.
+   */
+  bool Open(const char *filePath, const char *mask);
+
+  //! Adds the reader with opened file and with its own options.
+  /**
+   * The reader is not owned, it has to exist until files are closed. So
+   * readers with compiled filters can be reused by next merges.
+   *
+   * @return True at success, false at error.
+   */
+  bool Open(LogReader &);
+
+  //! Closes all files.
+  void Close();
+
+  //! Returns number of opened files.
+  size_t GetFilesNumber() const;
+
+  //! Returns reader of the file to set other options of the file reading.
+  /**
+   * Options have to be set before the first record is read.
+   *
+   * @param[in] fileIndex 0-based index of the file in order of opening.
+   */
+  LogReader &GetReader(size_t fileIndex);
+
+  //! Returns the next record of all files in time order.
+  /**
+   * @params[out] record Record content and attributes, content is valid
+   * until the next call.
+   * @params[out] fileIndex Index of the record file.
+   * @return True if record successfully extracted. False if there are no more
+   * records or if an error has occurred.
+   */
+  bool GetNextRecord(LogReader::Record &record, size_t &fileIndex);
+
+ private:
+  class Implementation;
+  Implementation *m_pimpl = nullptr;
+};
@@ -5,7 +5,15 @@
 
 #pragma once
 
+#ifdef _WIN32
 #include <Windows.h>
+#include <compressapi.h>
+#include <intrin.h>
+#endif
+#include <emmintrin.h>
 #include <cassert>
+#include <cmath>
+#include <cstdint>
 #include <cstdlib>
 #include <cstring>
+#include <new>
@@ -0,0 +1,185 @@
+﻿//
+//    Created: 2019/04/20 11:20
+//     Author: Eugene V. Palchukovsky
+//     E-mail: eugene@palchukovsky.com
+//
+
+#include "Prec.hpp"
+#include "QueryResults.hpp"
+#include "Mapping.hpp"
+
+using namespace logReader;
+
+struct QueryResults::Cache {
+  SRWLOCK lock = SRWLOCK_INIT;
+  QueryResults *first{nullptr};
+  QueryResults *last{nullptr};
+  size_t number = 0;
+  size_t size = defaultCacheSize;
+
+  void PushFront(QueryResults &results) {
+    results.m_prev = nullptr;
+    results.m_next = first;
+    if (first) {
+      first->m_prev = &results;
+    } else {
+      last = &results;
+    }
+    first = &results;
+    results.m_isCached = true;
+    ++number;
+  }
+
+  void Remove(QueryResults &results) {
+    (results.m_prev ? results.m_prev->m_next : first) = results.m_next;
+    (results.m_next ? results.m_next->m_prev : last) = results.m_prev;
+    results.m_prev = results.m_next = nullptr;
+    results.m_isCached = false;
+    --number;
+  }
+};
+
+QueryResults::Cache &QueryResults::GetCache() {
+  static Cache cache;
+  return cache;
+}
+
+bool QueryResults::Is(const Query &query) const {
+  return m_fileIndex == query.fileIndex && m_volume == query.volume &&
+         m_isUtf8 == query.isUtf8 &&
+         m_isFilterExpression == query.isFilterExpression &&
+         !strcmp(m_filter, query.filter) &&
+         (m_recordStart && query.recordStart
+              ? !strcmp(m_recordStart, query.recordStart)
+              : m_recordStart == query.recordStart);
+}
+
+const QueryResults *QueryResults::Acquire(const Query &query,
+                                          const Mapping &mapping) {
+  auto &cache = GetCache();
+  AcquireSRWLockExclusive(&cache.lock);
+  auto it = cache.first;
+  for (; it && !it->Is(query); it = it->m_next) {
+  }
+  if (it) {
+    cache.Remove(*it);
+    cache.PushFront(*it);
+    ++it->m_refsNumber;
+  }
+  ReleaseSRWLockExclusive(&cache.lock);
+  if (!it) {
+    return nullptr;
+  }
+
+  // Results are immutable, so the fingerprint is checked without lock.
+  uint64_t fingerprint;
+  if (it->m_scannedEnd > mapping.GetSize() ||
+      !mapping.GetFingerprint(it->m_scannedEnd, fingerprint) ||
+      it->m_fingerprint != fingerprint) {
+    Release(it);
+    return nullptr;
+  }
+  return it;
+}
+
+bool QueryResults::Store(const Query &query,
+                         const Mapping &mapping,
+                         const size_t scannedEnd,
+                         const QueryResults *prev,
+                         const Match *matches,
+                         const size_t matchesNumber) {
+  uint64_t fingerprint;
+  if (!mapping.GetFingerprint(scannedEnd, fingerprint)) {
+    return false;
+  }
+  const auto prevMatchesNumber = prev ? prev->m_matchesNumber : 0;
+  const auto filterSize = strlen(query.filter) + 1;
+  const auto recordStartSize =
+      query.recordStart ? strlen(query.recordStart) + 1 : 0;
+  const auto number = prevMatchesNumber + matchesNumber;
+  // One allocation for the object, matches and masks.
+  const auto buffer = static_cast<char *>(
+      malloc(sizeof(QueryResults) + number * sizeof(Match) + filterSize +
+             recordStartSize));
+  if (!buffer) {
+    return false;
+  }
+  auto &results = *new (buffer) QueryResults();
+  const auto resultsMatches =
+      reinterpret_cast<Match *>(buffer + sizeof(QueryResults));
+  if (prevMatchesNumber) {
+    memcpy(resultsMatches, prev->m_matches,
+           prevMatchesNumber * sizeof(Match));
+  }
+  if (matchesNumber) {
+    memcpy(resultsMatches + prevMatchesNumber, matches,
+           matchesNumber * sizeof(Match));
+  }
+  const auto filter = reinterpret_cast<char *>(resultsMatches + number);
+  memcpy(filter, query.filter, filterSize);
+  if (query.recordStart) {
+    memcpy(filter + filterSize, query.recordStart, recordStartSize);
+    results.m_recordStart = filter + filterSize;
+  }
+  results.m_volume = query.volume;
+  results.m_fileIndex = query.fileIndex;
+  results.m_filter = filter;
+  results.m_isFilterExpression = query.isFilterExpression;
+  results.m_isUtf8 = query.isUtf8;
+  results.m_scannedEnd = scannedEnd;
+  results.m_fingerprint = fingerprint;
+  results.m_matches = resultsMatches;
+  results.m_matchesNumber = number;
+
+  auto &cache = GetCache();
+  AcquireSRWLockExclusive(&cache.lock);
+  auto it = cache.first;
+  for (; it && !it->Is(query); it = it->m_next) {
+  }
+  if (it) {
+    cache.Remove(*it);
+    Destroy(*it);
+  }
+  cache.PushFront(results);
+  Evict(cache);
+  ReleaseSRWLockExclusive(&cache.lock);
+  return true;
+}
+
+void QueryResults::Release(const QueryResults *constResults) {
+  if (!constResults) {
+    return;
+  }
+  auto &cache = GetCache();
+  AcquireSRWLockExclusive(&cache.lock);
+  // Cache owns each results object, readers get only constant pointers.
+  auto &results = *const_cast<QueryResults *>(constResults);
+  assert(results.m_refsNumber > 0);
+  --results.m_refsNumber;
+  Destroy(results);
+  ReleaseSRWLockExclusive(&cache.lock);
+}
+
+void QueryResults::SetCacheSize(const size_t size) {
+  auto &cache = GetCache();
+  AcquireSRWLockExclusive(&cache.lock);
+  cache.size = size;
+  Evict(cache);
+  ReleaseSRWLockExclusive(&cache.lock);
+}
+
+void QueryResults::Destroy(QueryResults &results) {
+  if (results.m_refsNumber || results.m_isCached) {
+    return;
+  }
+  results.~QueryResults();
+  free(&results);
+}
+
+void QueryResults::Evict(Cache &cache) {
+  while (cache.number > cache.size) {
+    auto &results = *cache.last;
+    cache.Remove(results);
+    Destroy(results);
+  }
+}
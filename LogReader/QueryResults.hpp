@@ -0,0 +1,123 @@
+﻿//
+//    Created: 2019/04/20 11:15
+//     Author: Eugene V. Palchukovsky
+//     E-mail: eugene@palchukovsky.com
+//
+
+#pragma once
+
+namespace logReader {
+
+class Mapping;
+
+//! QueryResults is a process-wide cache of matched records of queries.
+/**
+ * Results are stored for the file region from the begin to the scanned end
+ * and are valid while this region is not changed, so a grown file is scanned
+ * only from the scanned end. Each results object is immutable, new results
+ * of the same query replace the previous in the cache. Results are dropped in
+ * the least recently used order over the cache size. Thread-safe.
+ */
+class QueryResults {
+ public:
+  //! Default number of queries which results are kept.
+  enum : size_t { defaultCacheSize = 64 };
+
+  //! Match is a matched record borders, offsets in bytes from the file begin.
+  struct Match {
+    size_t begin;
+    size_t end;
+  };
+
+  //! Query is a key of results.
+  struct Query {
+    uint32_t volume;
+    uint64_t fileIndex;
+    //! Filter mask or expression.
+    const char *filter;
+    bool isFilterExpression;
+    //! Record start mask or nullptr.
+    const char *recordStart;
+    bool isUtf8;
+  };
+
+  QueryResults(QueryResults &&) = delete;
+  QueryResults(const QueryResults &) = delete;
+  QueryResults &operator=(QueryResults &&) = delete;
+  QueryResults &operator=(const QueryResults &) = delete;
+
+  //! Acquire returns results of the query if the file content till the
+  //! scanned end is not changed.
+  /**
+   * @return Results which have to be released by Release, or nullptr if there
+   * are no actual results.
+   */
+  static const QueryResults *Acquire(const Query &, const Mapping &);
+
+  //! Store stores results of the query for the file content till the scanned
+  //! end.
+  /**
+   * @param[in] prev Results which are continued by matches or nullptr.
+   * @param[in] matches Matches after the previous results scanned end.
+   * @return True at success, false at error.
+   */
+  static bool Store(const Query &,
+                    const Mapping &,
+                    size_t scannedEnd,
+                    const QueryResults *prev,
+                    const Match *matches,
+                    size_t matchesNumber);
+
+  //! Release releases results, which are acquired by Acquire.
+  static void Release(const QueryResults *);
+
+  //! SetCacheSize sets the maximum number of queries which results are kept
+  //! and drops extra results.
+  static void SetCacheSize(size_t size);
+
+  //! GetScannedEnd returns offset till which the file is scanned, it's a
+  //! record begin.
+  size_t GetScannedEnd() const { return m_scannedEnd; }
+
+  const Match *GetMatches() const { return m_matches; }
+  size_t GetMatchesNumber() const { return m_matchesNumber; }
+
+ private:
+  struct Cache;
+
+  QueryResults() = default;
+  ~QueryResults() = default;
+
+  static Cache &GetCache();
+
+  //! Is returns true if results are for the query.
+  bool Is(const Query &) const;
+
+  //! Destroy frees results if they are not used and not cached.
+  static void Destroy(QueryResults &);
+
+  //! Evict drops the least recently used results over the cache size. Has to
+  //! be called under the cache lock.
+  static void Evict(Cache &);
+
+  uint32_t m_volume = 0;
+  uint64_t m_fileIndex = 0;
+  //! Query masks, the memory is allocated with the object.
+  const char *m_filter{nullptr};
+  const char *m_recordStart{nullptr};
+  bool m_isFilterExpression = false;
+  bool m_isUtf8 = false;
+  size_t m_scannedEnd = 0;
+  uint64_t m_fingerprint = 0;
+  //! Matches, the memory is allocated with the object.
+  const Match *m_matches{nullptr};
+  size_t m_matchesNumber = 0;
+  //! Number of readers, which use the results.
+  size_t m_refsNumber = 0;
+  bool m_isCached = false;
+  //! Cache list links, the list is ordered from the recently used.
+  QueryResults *m_prev{nullptr};
+  QueryResults *m_next{nullptr};
+};
+
+}  // namespace logReader
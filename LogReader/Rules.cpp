@@ -65,18 +65,9 @@ FixedStringRule::Result FixedStringRule::Check(const char *&begin,
     return RESULT_FAILED;
   }
 
-  if (m_lastPos && begin < m_lastPos) {
-    if (m_lastResult == RESULT_COMPLETED_FULL) {
-      // To don't search position that was already found before in another
-      // branch.
-      begin = end = m_lastPos;
-      return RESULT_COMPLETED_FULL;
-    }
-    assert(m_lastResult == RESULT_FAILED);
-    // To search from place that was not investigated yet.
-    begin = m_lastPos;
-  }
-
+  // Compared positions are counted by the search end, so the comparison
+  // loop has no counter.
+  const auto first = begin;
   for (; static_cast<size_t>(end - begin) >= m_len; ++begin) {
     size_t i = 0;
     do {
@@ -85,18 +76,21 @@ FixedStringRule::Result FixedStringRule::Check(const char *&begin,
       }
     } while (++i < m_len);
     if (i == m_len) {
-      m_lastPos = begin = end = begin + m_len;
-      m_lastResult = RESULT_COMPLETED_FULL;
+      Count(first, begin + 1);
+      begin = end = begin + m_len;
       return RESULT_COMPLETED_FULL;
     }
     if (strictBegin <= begin) {
-      break;
+      Count(first, begin + 1);
+      return RESULT_FAILED;
     }
   }
 
-  m_lastPos = begin;
-  m_lastResult = RESULT_FAILED;
+  Count(first, begin);
   return RESULT_FAILED;
 }
 
-void FixedStringRule::Reset() { m_lastPos = nullptr; }
+void FixedStringRule::AddStats(Stats &stats) const {
+  stats.literalSearches += m_searchesNumber;
+  stats.literalComparisons += m_comparisonsNumber;
+}
@@ -6,6 +6,8 @@
 
 #pragma once
 
+#include "Stats.hpp"
+
 namespace logReader {
 
 //! Rule describes one rule in a expression.
@@ -34,10 +36,8 @@ class Rule {
 
   //! Check checks sequence of symbols.
   /**
-   * A rule can change own state inside one match operation. Method Reset will
-   * be called before the next match operation will be stared.
-   *
-   * @sa Reset
+   * Result doesn't depend on previous checks, so the same branch is checked
+   * by the same rule with the same result.
    *
    * @param[in,out] begin Accepts content begin, returns next field begin.
    *
@@ -49,8 +49,20 @@ class Rule {
                        const char *strictBegin,
                        const char *&end) = 0;
 
-  //! Reset prepares rule for the next check.
-  virtual void Reset(){};
+  //! GetMinLen returns the minimal length of the field.
+  virtual size_t GetMinLen() const = 0;
+  //! GetMaxLen returns the maximal length of the field or SIZE_MAX if the
+  //! field length is not limited.
+  virtual size_t GetMaxLen() const = 0;
+  //! GetFixedString returns the field content with GetMinLen() length if the
+  //! field is a fixed string, nullptr otherwise.
+  virtual const char *GetFixedString() const { return nullptr; }
+
+  //! SetStatsCounting enables or disables rule counters.
+  virtual void SetStatsCounting(bool) {}
+
+  //! AddStats adds rule counters to the statistics.
+  virtual void AddStats(Stats &) const {}
 };
 
 //! AnySymbolWithLen0OrMoreRule implements the rule "block can have several
@@ -67,6 +79,8 @@ class AnySymbolWithLen0OrMoreRule final : public Rule {
   ~AnySymbolWithLen0OrMoreRule() override = default;
   bool HasError() const override;
   Result Check(const char *&, const char *, const char *&) override;
+  size_t GetMinLen() const override { return 0; }
+  size_t GetMaxLen() const override { return SIZE_MAX; }
 };
 
 //! AnySymbolWithLen0OrNRule implements the rule "block can have up to N
@@ -82,6 +96,8 @@ class AnySymbolWithLen0OrNRule final : public Rule {
   ~AnySymbolWithLen0OrNRule() override = default;
   bool HasError() const override;
   Result Check(const char *&, const char *, const char *&) override;
+  size_t GetMinLen() const override { return 0; }
+  size_t GetMaxLen() const override { return m_maxLen; }
 
  private:
   size_t m_maxLen;
@@ -99,13 +115,29 @@ class FixedStringRule final : public Rule {
   ~FixedStringRule() override;
   bool HasError() const override;
   Result Check(const char *&, const char *, const char *&) override;
-  void Reset() override;
+  size_t GetMinLen() const override { return m_len; }
+  size_t GetMaxLen() const override { return m_len; }
+  const char *GetFixedString() const override { return m_template; }
+  void SetStatsCounting(const bool isEnabled) override {
+    m_isStatsCounting = isEnabled;
+  }
+  void AddStats(Stats &) const override;
 
  private:
+  //! Count counts the search, which has compared positions from the first
+  //! position to the last position exclusive.
+  void Count(const char *first, const char *last) {
+    if (m_isStatsCounting) {
+      ++m_searchesNumber;
+      m_comparisonsNumber += static_cast<uint64_t>(last - first);
+    }
+  }
+
   const size_t m_len;
   char *m_template;
-  const char *m_lastPos = nullptr;
-  Result m_lastResult = numberOfResults;
+  bool m_isStatsCounting = false;
+  uint64_t m_searchesNumber = 0;
+  uint64_t m_comparisonsNumber = 0;
 };
 
 }  // namespace logReader
@@ -0,0 +1,177 @@
+﻿//
+//    Created: 2019/04/14 11:42
+//     Author: Eugene V. Palchukovsky
+//     E-mail: eugene@palchukovsky.com
+//
+
+#include "Prec.hpp"
+#include "Scan.hpp"
+
+using namespace logReader;
+
+namespace {
+
+#ifdef _MSC_VER
+
+bool FindFirstBit(const unsigned long mask, unsigned long &index) {
+  return _BitScanForward(&index, mask) != 0;
+}
+
+bool HasPopcnt() {
+  int info[4];
+  __cpuid(info, 1);
+  return (info[2] & (1 << 23)) != 0;
+}
+
+size_t CountBits(uint64_t bits) {
+  static const bool hasPopcnt = HasPopcnt();
+  if (hasPopcnt) {
+    return static_cast<size_t>(__popcnt64(bits));
+  }
+  bits -= (bits >> 1) & 0x5555555555555555ull;
+  bits = (bits & 0x3333333333333333ull) + ((bits >> 2) & 0x3333333333333333ull);
+  bits = (bits + (bits >> 4)) & 0x0F0F0F0F0F0F0F0Full;
+  return static_cast<size_t>((bits * 0x0101010101010101ull) >> 56);
+}
+
+#else
+
+// GCC and Clang builtins, POPCNT is used only if the target has it.
+bool FindFirstBit(const unsigned long mask, unsigned long &index) {
+  if (!mask) {
+    return false;
+  }
+  index = static_cast<unsigned long>(__builtin_ctzl(mask));
+  return true;
+}
+
+size_t CountBits(const uint64_t bits) {
+  return static_cast<size_t>(__builtin_popcountll(bits));
+}
+
+#endif
+
+}  // namespace
+
+const char *logReader::FindLineEnd(const char *begin, const char *end) {
+  assert(begin <= end);
+  const auto cr = _mm_set1_epi8('\r');
+  const auto lf = _mm_set1_epi8('\n');
+  for (; end - begin >= 16; begin += 16) {
+    const auto chunk =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(begin));
+    const auto mask = static_cast<unsigned long>(_mm_movemask_epi8(
+        _mm_or_si128(_mm_cmpeq_epi8(chunk, cr), _mm_cmpeq_epi8(chunk, lf))));
+    unsigned long index;
+    if (FindFirstBit(mask, index)) {
+      return begin + index;
+    }
+  }
+  for (; begin < end && !IsLineEnd(*begin); ++begin) {
+  }
+  return begin;
+}
+
+size_t logReader::CountLines(const char *begin,
+                             const char *end,
+                             const char *contentEnd) {
+  assert(begin <= end);
+  assert(end <= contentEnd);
+  const auto cr = _mm_set1_epi8('\r');
+  const auto lf = _mm_set1_epi8('\n');
+  const auto &find = [](const char *it, const __m128i &pattern) {
+    return static_cast<uint64_t>(static_cast<uint16_t>(_mm_movemask_epi8(
+        _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(it)),
+                       pattern))));
+  };
+  const auto &findAll = [&find](const char *it, const __m128i &pattern) {
+    return find(it, pattern) | find(it + 16, pattern) << 16 |
+           find(it + 32, pattern) << 32 | find(it + 48, pattern) << 48;
+  };
+  size_t result = 0;
+  for (; end - begin >= 64; begin += 64) {
+    const auto lfs = findAll(begin, lf);
+    // CR is a line end only if the next symbol is not LF.
+    auto isLfNext = lfs >> 1;
+    if (begin + 64 < contentEnd && begin[64] == '\n') {
+      isLfNext |= 1ull << 63;
+    }
+    result += CountBits(lfs) + CountBits(findAll(begin, cr) & ~isLfNext);
+  }
+  for (; begin < end; ++begin) {
+    if (*begin == '\n' ||
+        (*begin == '\r' && (begin + 1 >= contentEnd || begin[1] != '\n'))) {
+      ++result;
+    }
+  }
+  return result;
+}
+
+bool logReader::IsAscii(const char *begin, const char *end) {
+  assert(begin <= end);
+  const auto &load = [](const char *it) {
+    return _mm_loadu_si128(reinterpret_cast<const __m128i *>(it));
+  };
+  for (; end - begin >= 64; begin += 64) {
+    // The highest bit of any symbol in 64 symbols.
+    const auto chunk =
+        _mm_or_si128(_mm_or_si128(load(begin), load(begin + 16)),
+                     _mm_or_si128(load(begin + 32), load(begin + 48)));
+    if (_mm_movemask_epi8(chunk)) {
+      return false;
+    }
+  }
+  for (; begin < end; ++begin) {
+    if (*begin & 0x80) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool logReader::HasSymbols(const char *begin,
+                           const char *end,
+                           const char *symbols,
+                           const size_t number) {
+  assert(begin <= end);
+  assert(number > 0 && number <= 4);
+  __m128i patterns[4];
+  for (size_t i = 0; i < number; ++i) {
+    patterns[i] = _mm_set1_epi8(symbols[i]);
+  }
+  const auto all = (1u << number) - 1;
+  auto found = 0u;
+  for (; end - begin >= 16 && found != all; begin += 16) {
+    const auto chunk =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(begin));
+    for (size_t i = 0; i < number; ++i) {
+      if (_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, patterns[i]))) {
+        found |= 1u << i;
+      }
+    }
+  }
+  for (; begin < end && found != all; ++begin) {
+    for (size_t i = 0; i < number; ++i) {
+      if (*begin == symbols[i]) {
+        found |= 1u << i;
+      }
+    }
+  }
+  return found == all;
+}
+
+uint64_t logReader::GetFingerprint(const char *content, const size_t size) {
+  // FNV-1a of the region begin and end.
+  const size_t partSize = fingerprintPartSize;
+  auto result = 14695981039346656037ull;
+  const auto &add = [&result](const char *begin, const char *end) {
+    for (auto it = begin; it < end; ++it) {
+      result = (result ^ static_cast<unsigned char>(*it)) * 1099511628211ull;
+    }
+  };
+  const auto headEnd = content + (size < partSize ? size : partSize);
+  add(content, headEnd);
+  add(size < 2 * partSize ? headEnd : content + size - partSize,
+      content + size);
+  return result ^ size;
+}
@@ -0,0 +1,115 @@
+﻿//
+//    Created: 2019/04/14 11:40
+//     Author: Eugene V. Palchukovsky
+//     E-mail: eugene@palchukovsky.com
+//
+
+#pragma once
+
+namespace logReader {
+
+//! IsLineEnd returns true if the symbol is a line end symbol.
+inline bool IsLineEnd(const char ch) { return ch == '\r' || ch == '\n'; }
+
+//! FindLineEnd finds the first line end symbol.
+/**
+ * Checks 16 symbols per step with SSE2.
+ *
+ * @param[in] begin Content begin.
+ * @param[in] end Content end.
+ * @return The first line end symbol or the content end if there is no line
+ * end.
+ */
+const char *FindLineEnd(const char *begin, const char *end);
+
+//! CountLines counts line ends.
+/**
+ * A line end is a line feed or a carriage return, which isn't followed by a
+ * line feed, so a CR LF pair is one line end as well as a bare CR. Checks 64
+ * symbols per step with SSE2 and counts them with POPCNT if the processor
+ * supports it.
+ *
+ * @param[in] begin Range begin.
+ * @param[in] end Range end.
+ * @param[in] contentEnd Content end, the symbol after the range is checked
+ * if the range ends before it.
+ * @return Number of line ends in the range.
+ */
+size_t CountLines(const char *begin, const char *end, const char *contentEnd);
+
+//! Size of the content begin and of the content end, which are hashed by
+//! GetFingerprint.
+enum : size_t { fingerprintPartSize = 4 * 1024 };
+
+//! GetFingerprint returns hash of the content begin and end.
+/**
+ * Hashes not more than 4 KB from the begin and 4 KB from the end, so the
+ * result changes if the file is replaced or if the last records are
+ * rewritten, but it doesn't read the whole content.
+ *
+ * @param[in] content Content begin.
+ * @param[in] size Content size.
+ * @return Content fingerprint.
+ */
+uint64_t GetFingerprint(const char *content, size_t size);
+
+//! IsAscii returns true if the content has only ASCII symbols.
+/**
+ * Checks 64 symbols per step with SSE2.
+ *
+ * @param[in] begin Content begin.
+ * @param[in] end Content end.
+ * @return True if each symbol is less than 0x80.
+ */
+bool IsAscii(const char *begin, const char *end);
+
+//! HasSymbols returns true if the content has each of the symbols.
+/**
+ * Compares 16 symbols per step with each symbol by SSE2 and stops when
+ * each symbol is found.
+ *
+ * @param[in] begin Content begin.
+ * @param[in] end Content end.
+ * @param[in] symbols Symbols to find.
+ * @param[in] number Number of symbols, not more than 4.
+ * @return True if each symbol is found.
+ */
+bool HasSymbols(const char *begin,
+                const char *end,
+                const char *symbols,
+                size_t number);
+
+//! SkipCodePoints skips UTF-8 code points.
+/**
+ * A code point is a leading byte with following continuation bytes, so
+ * invalid sequences are skipped byte by byte.
+ *
+ * @param[in] begin Content begin, has to be a code point begin.
+ * @param[in] end Content end.
+ * @param[in] number Number of code points to skip.
+ * @return The begin of the code point after skipped code points or the
+ * content end.
+ */
+inline const char *SkipCodePoints(const char *begin,
+                                  const char *end,
+                                  size_t number) {
+  for (; number && begin < end; --number) {
+    for (++begin; begin < end && (*begin & 0xC0) == 0x80; ++begin) {
+    }
+  }
+  return begin;
+}
+
+//! SkipLineEnds skips line end symbols.
+/**
+ * @param[in] begin Content begin.
+ * @param[in] end Content end.
+ * @return The first symbol which is not a line end or the content end.
+ */
+inline const char *SkipLineEnds(const char *begin, const char *end) {
+  for (; begin < end && IsLineEnd(*begin); ++begin) {
+  }
+  return begin;
+}
+
+}  // namespace logReader
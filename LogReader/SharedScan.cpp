@@ -0,0 +1,496 @@
+﻿//
+//    Created: 2019/04/26 16:25
+//     Author: Eugene V. Palchukovsky
+//     E-mail: eugene@palchukovsky.com
+//
+
+#include "Prec.hpp"
+#include "SharedScan.hpp"
+#include "File.hpp"
+#include "Filter.hpp"
+
+using namespace logReader;
+
+class SharedScan::Implementation {
+ public:
+  //! Number of records, which are read by one lock of the scan.
+  enum : size_t { recordsPerLock = 1024 };
+
+  //! Query is a filter attached to the scan.
+  struct Query {
+    Filter filter;
+    //! Offset of the first record of the query.
+    size_t begin;
+    //! True if the scan has passed the file end after the query start.
+    bool isWrapped;
+    bool isCompleted;
+    bool isLineNumberingEnabled;
+    //! Number of captures of each found record, zero if capturing is
+    //! disabled.
+    size_t capturesNumber;
+    //! Ring of found records, which are not taken, of pendingLimit size.
+    LogReader::Record *pending;
+    size_t pendingBegin;
+    size_t pendingNumber;
+    //! Captures of pending records by capturesNumber for each ring slot.
+    Span *pendingCaptures;
+    //! Captures of the taken record.
+    Span *captures;
+  };
+
+  SRWLOCK m_lock = SRWLOCK_INIT;
+  //! Signaled when records are taken from a full ring or a query is
+  //! detached.
+  CONDITION_VARIABLE m_taken = CONDITION_VARIABLE_INIT;
+  bool m_isUtf8 = false;
+  MaskMatcher *m_recordStart = nullptr;
+  File *m_file = nullptr;
+  //! Queries by identifiers, nullptr for detached queries.
+  Query **m_queries = nullptr;
+  size_t m_queriesNumber = 0;
+  //! Number of queries which are not completed.
+  size_t m_activeQueriesNumber = 0;
+  //! Number of queries with full rings of pending records.
+  size_t m_fullQueriesNumber = 0;
+  //! Number of lines before the line count position.
+  size_t m_lineNumber = 0;
+  size_t m_lineCountPos = 0;
+
+  Implementation() = default;
+  Implementation(Implementation &&) = delete;
+  Implementation(const Implementation &) = delete;
+  Implementation &operator=(Implementation &&) = delete;
+  Implementation &operator=(const Implementation &) = delete;
+  ~Implementation() {
+    Close();
+    if (m_recordStart) {
+      m_recordStart->~MaskMatcher();
+      free(m_recordStart);
+    }
+  }
+
+  void Close() {
+    for (size_t i = 0; i < m_queriesNumber; ++i) {
+      DestroyQuery(m_queries[i]);
+    }
+    free(m_queries);
+    m_queries = nullptr;
+    m_queriesNumber = m_activeQueriesNumber = m_fullQueriesNumber = 0;
+    if (m_file) {
+      m_file->~File();
+      free(m_file);
+      m_file = nullptr;
+    }
+    m_lineNumber = m_lineCountPos = 0;
+  }
+
+  //! Returns the attached query or nullptr.
+  Query *Find(const size_t query) const {
+    return query < m_queriesNumber ? m_queries[query] : nullptr;
+  }
+
+  static void DestroyQuery(Query *query) {
+    if (query) {
+      free(query->captures);
+      free(query->pendingCaptures);
+      free(query->pending);
+      query->~Query();
+      free(query);
+    }
+  }
+
+  void Complete(Query &query) {
+    assert(!query.isCompleted);
+    assert(m_activeQueriesNumber > 0);
+    query.isCompleted = true;
+    --m_activeQueriesNumber;
+  }
+
+  //! Returns the number of the first line of the record.
+  size_t GetLine(const size_t offset) {
+    m_lineNumber += m_file->CountLines(m_lineCountPos, offset);
+    m_lineCountPos = offset;
+    return m_lineNumber + 1;
+  }
+
+  //! Reads the next record and adds it to rings of queries, which match it,
+  //! at the file end continues from the file begin.
+  /**
+   * Each ring has to have a free slot.
+   *
+   * @return True if the record is read or if the scan is continued from the
+   * file begin, false at error.
+   */
+  bool ReadRecord() {
+    const char *begin;
+    const char *end;
+    if (!m_file->ReadRecord(begin, end)) {
+      // The file is closed only at error, at the end it's read again from
+      // the begin, so found records stay valid.
+      if (!m_file->GetBegin()) {
+        return false;
+      }
+      m_file->SetRange(0, m_file->GetSize());
+      m_lineNumber = m_lineCountPos = 0;
+      // Queries, which have passed the file end, are completed even if they
+      // are started after the last record.
+      for (size_t i = 0; i < m_queriesNumber; ++i) {
+        const auto query = m_queries[i];
+        if (!query || query->isCompleted) {
+          continue;
+        }
+        if (query->isWrapped || !query->begin) {
+          Complete(*query);
+        } else {
+          query->isWrapped = true;
+        }
+      }
+      return true;
+    }
+
+    const auto offset = static_cast<size_t>(begin - m_file->GetBegin());
+    size_t line = 0;
+    for (size_t i = 0; i < m_queriesNumber; ++i) {
+      const auto query = m_queries[i];
+      if (!query || query->isCompleted) {
+        continue;
+      }
+      if (query->isWrapped && offset >= query->begin) {
+        Complete(*query);
+        continue;
+      }
+      assert(query->pendingNumber < pendingLimit);
+      const auto slot =
+          (query->pendingBegin + query->pendingNumber) % pendingLimit;
+      if (query->capturesNumber
+              ? !query->filter.Match(
+                    begin, end,
+                    query->pendingCaptures + slot * query->capturesNumber)
+              : !query->filter.Match(begin, end)) {
+        continue;
+      }
+      if (query->isLineNumberingEnabled && !line) {
+        line = GetLine(offset);
+      }
+      auto &record = query->pending[slot];
+      record.begin = begin;
+      record.end = end;
+      record.offset = offset;
+      record.line = query->isLineNumberingEnabled ? line : 0;
+      record.isMatched = true;
+      record.isGap = false;
+      record.captures = nullptr;
+      record.capturesNumber = query->capturesNumber;
+      if (++query->pendingNumber == pendingLimit) {
+        ++m_fullQueriesNumber;
+      }
+    }
+    return true;
+  }
+
+  //! Takes the first pending record of the query.
+  void Take(Query &query, LogReader::Record &record) {
+    assert(query.pendingNumber);
+    const auto slot = query.pendingBegin;
+    record = query.pending[slot];
+    if (record.capturesNumber) {
+      memcpy(query.captures,
+             query.pendingCaptures + slot * record.capturesNumber,
+             record.capturesNumber * sizeof(*query.captures));
+      record.captures = query.captures;
+    }
+    query.pendingBegin = (slot + 1) % pendingLimit;
+    if (query.pendingNumber-- == pendingLimit) {
+      --m_fullQueriesNumber;
+      WakeAllConditionVariable(&m_taken);
+    }
+  }
+};
+
+SharedScan::SharedScan() {
+  m_pimpl = static_cast<Implementation *>(malloc(sizeof(Implementation)));
+  if (m_pimpl) {
+    new (m_pimpl) Implementation();
+  }
+}
+
+SharedScan::~SharedScan() {
+  if (m_pimpl) {
+    m_pimpl->~Implementation();
+    free(m_pimpl);
+  }
+}
+
+bool SharedScan::SetUtf8(const bool isUtf8) {
+  if (!m_pimpl) {
+    return false;
+  }
+  AcquireSRWLockExclusive(&m_pimpl->m_lock);
+  const auto result = !m_pimpl->m_file;
+  if (result) {
+    m_pimpl->m_isUtf8 = isUtf8;
+    if (m_pimpl->m_recordStart) {
+      m_pimpl->m_recordStart->SetUtf8(isUtf8);
+    }
+  }
+  ReleaseSRWLockExclusive(&m_pimpl->m_lock);
+  return result;
+}
+
+bool SharedScan::SetRecordStart(const char *mask) {
+  if (!m_pimpl) {
+    return false;
+  }
+  auto &scan = *m_pimpl;
+  AcquireSRWLockExclusive(&scan.m_lock);
+  struct Scope {
+    SRWLOCK &lock;
+    ~Scope() { ReleaseSRWLockExclusive(&lock); }
+  } scope{scan.m_lock};  // NOLINT
+  if (scan.m_file) {
+    return false;
+  }
+  if (!mask) {
+    if (scan.m_recordStart) {
+      scan.m_recordStart->~MaskMatcher();
+      free(scan.m_recordStart);
+      scan.m_recordStart = nullptr;
+    }
+    return true;
+  }
+
+  // The mask is checked as a line prefix.
+  const auto maskLen = strlen(mask);
+  const auto prefixMask = static_cast<char *>(malloc(maskLen + 2));
+  if (!prefixMask) {
+    return false;
+  }
+  memcpy(prefixMask, mask, maskLen);
+  prefixMask[maskLen] = '*';
+  prefixMask[maskLen + 1] = 0;
+  if (!scan.m_recordStart) {
+    scan.m_recordStart =
+        static_cast<MaskMatcher *>(malloc(sizeof(MaskMatcher)));
+    if (!scan.m_recordStart) {
+      free(prefixMask);
+      return false;
+    }
+    new (scan.m_recordStart) MaskMatcher();
+    scan.m_recordStart->SetUtf8(scan.m_isUtf8);
+  }
+  const auto isCompiled = scan.m_recordStart->Compile(prefixMask);
+  free(prefixMask);
+  return isCompiled;
+}
+
+bool SharedScan::Open(const char *filePath) {
+  if (!m_pimpl) {
+    return false;
+  }
+  auto &scan = *m_pimpl;
+  AcquireSRWLockExclusive(&scan.m_lock);
+  struct Scope {
+    SRWLOCK &lock;
+    ~Scope() { ReleaseSRWLockExclusive(&lock); }
+  } scope{scan.m_lock};  // NOLINT
+  if (scan.m_file) {
+    return false;
+  }
+  const auto file = static_cast<File *>(malloc(sizeof(File)));
+  if (!file) {
+    return false;
+  }
+  new (file) File(filePath);
+  if (!*file) {
+    file->~File();
+    free(file);
+    return false;
+  }
+  file->SetRecordStart(scan.m_recordStart);
+  scan.m_file = file;
+  return true;
+}
+
+void SharedScan::Close() {
+  if (m_pimpl) {
+    AcquireSRWLockExclusive(&m_pimpl->m_lock);
+    m_pimpl->Close();
+    ReleaseSRWLockExclusive(&m_pimpl->m_lock);
+  }
+}
+
+bool SharedScan::Attach(const char *filter,
+                        const bool isExpression,
+                        size_t &query) {
+  if (!m_pimpl) {
+    return false;
+  }
+  auto &scan = *m_pimpl;
+  using Query = Implementation::Query;
+  const auto result = static_cast<Query *>(malloc(sizeof(Query)));
+  if (!result) {
+    return false;
+  }
+  // The filter is compiled without lock.
+  new (result) Query();
+  result->pending = static_cast<LogReader::Record *>(
+      malloc(pendingLimit * sizeof(*result->pending)));
+  if (!result->pending ||
+      !(isExpression ? result->filter.CompileExpression(filter)
+                     : result->filter.Compile(filter))) {
+    Implementation::DestroyQuery(result);
+    return false;
+  }
+
+  AcquireSRWLockExclusive(&scan.m_lock);
+  struct Scope {
+    SRWLOCK &lock;
+    ~Scope() { ReleaseSRWLockExclusive(&lock); }
+  } scope{scan.m_lock};  // NOLINT
+  if (!scan.m_file) {
+    Implementation::DestroyQuery(result);
+    return false;
+  }
+  size_t index = 0;
+  while (index < scan.m_queriesNumber && scan.m_queries[index]) {
+    ++index;
+  }
+  if (index == scan.m_queriesNumber) {
+    const auto queries = static_cast<Query **>(
+        realloc(scan.m_queries, (index + 1) * sizeof(*scan.m_queries)));
+    if (!queries) {
+      Implementation::DestroyQuery(result);
+      return false;
+    }
+    scan.m_queries = queries;
+    ++scan.m_queriesNumber;
+  }
+  result->filter.SetUtf8(scan.m_isUtf8);
+  // The current record is already checked for other queries, so the query
+  // starts from the next record.
+  result->begin = scan.m_file->GetPos();
+  scan.m_queries[index] = result;
+  ++scan.m_activeQueriesNumber;
+  query = index;
+  return true;
+}
+
+void SharedScan::Detach(const size_t query) {
+  if (!m_pimpl) {
+    return;
+  }
+  auto &scan = *m_pimpl;
+  AcquireSRWLockExclusive(&scan.m_lock);
+  const auto it = scan.Find(query);
+  if (it) {
+    if (!it->isCompleted) {
+      scan.Complete(*it);
+    }
+    if (it->pendingNumber == pendingLimit) {
+      --scan.m_fullQueriesNumber;
+      WakeAllConditionVariable(&scan.m_taken);
+    }
+    scan.m_queries[query] = nullptr;
+  }
+  ReleaseSRWLockExclusive(&scan.m_lock);
+  Implementation::DestroyQuery(it);
+}
+
+void SharedScan::SetLineNumbering(const size_t query, const bool isEnabled) {
+  if (!m_pimpl) {
+    return;
+  }
+  AcquireSRWLockExclusive(&m_pimpl->m_lock);
+  const auto it = m_pimpl->Find(query);
+  if (it) {
+    it->isLineNumberingEnabled = isEnabled;
+  }
+  ReleaseSRWLockExclusive(&m_pimpl->m_lock);
+}
+
+bool SharedScan::SetCapturing(const size_t query, const bool isEnabled) {
+  if (!m_pimpl) {
+    return false;
+  }
+  AcquireSRWLockExclusive(&m_pimpl->m_lock);
+  struct Scope {
+    SRWLOCK &lock;
+    ~Scope() { ReleaseSRWLockExclusive(&lock); }
+  } scope{m_pimpl->m_lock};  // NOLINT
+  const auto it = m_pimpl->Find(query);
+  if (!it) {
+    return false;
+  }
+  const auto number = it->filter.GetCapturesNumber();
+  if (!isEnabled || !number) {
+    it->capturesNumber = 0;
+    return true;
+  }
+  if (!it->captures) {
+    it->pendingCaptures = static_cast<Span *>(
+        malloc(pendingLimit * number * sizeof(*it->pendingCaptures)));
+    it->captures = static_cast<Span *>(malloc(number * sizeof(*it->captures)));
+    if (!it->pendingCaptures || !it->captures) {
+      free(it->pendingCaptures);
+      free(it->captures);
+      it->pendingCaptures = it->captures = nullptr;
+      return false;
+    }
+  }
+  it->capturesNumber = number;
+  return true;
+}
+
+bool SharedScan::IsCompleted(const size_t query) const {
+  if (!m_pimpl) {
+    return true;
+  }
+  AcquireSRWLockExclusive(&m_pimpl->m_lock);
+  const auto it = m_pimpl->Find(query);
+  const auto result = !it || it->isCompleted;
+  ReleaseSRWLockExclusive(&m_pimpl->m_lock);
+  return result;
+}
+
+bool SharedScan::GetNextRecord(const size_t query, LogReader::Record &record) {
+  if (!m_pimpl) {
+    return false;
+  }
+  auto &scan = *m_pimpl;
+  AcquireSRWLockExclusive(&scan.m_lock);
+  struct Scope {
+    SRWLOCK &lock;
+    ~Scope() { ReleaseSRWLockExclusive(&lock); }
+  } scope{scan.m_lock};  // NOLINT
+  size_t recordsNumber = 0;
+  for (;;) {
+    const auto it = scan.Find(query);
+    if (!it) {
+      return false;
+    }
+    if (it->pendingNumber) {
+      scan.Take(*it, record);
+      return true;
+    }
+    if (it->isCompleted || !scan.m_file) {
+      return false;
+    }
+    if (scan.m_fullQueriesNumber) {
+      // Records of the query would be found only after records of other
+      // queries are taken.
+      SleepConditionVariableSRW(&scan.m_taken, &scan.m_lock, INFINITE, 0);
+      continue;
+    }
+    if (recordsNumber == Implementation::recordsPerLock) {
+      // Other threads take their records while the query has no records.
+      ReleaseSRWLockExclusive(&scan.m_lock);
+      AcquireSRWLockExclusive(&scan.m_lock);
+      recordsNumber = 0;
+      continue;
+    }
+    if (!scan.ReadRecord()) {
+      return false;
+    }
+    ++recordsNumber;
+  }
+}
@@ -0,0 +1,120 @@
+﻿//
+//    Created: 2019/04/26 16:10
+//     Author: Eugene V. Palchukovsky
+//     E-mail: eugene@palchukovsky.com
+//
+
+#pragma once
+
+#include "LogReader.hpp"
+
+//! SharedScan reads one file of log for several queries by one pass.
+/**
+ * Each record is read and split once and it's checked by the filter of each
+ * attached query, so concurrent queries over the same file take one pass of
+ * memory bandwidth instead of a pass per query.
+ *
+ * A query can be attached at any time. It starts from the current scan
+ * position, the scan continues from the file begin after the file end, and
+ * the query is completed when the scan returns to its start position, so
+ * each query gets each record once. The file is read as it's at the opening.
+ * A compressed archive (see LogReader::CompressFile) is scanned the same
+ * way, its read blocks stay extracted until the scan is closed, so kept
+ * records of queries stay valid.
+ *
+ * Methods are thread-safe, so each query can be read by its own thread. The
+ * thread, which takes records of its query, moves the scan while the query
+ * has no found records, and records found for other queries are kept for
+ * them. The scan waits while a query has pendingLimit records, which are not
+ * taken, so a query, which isn't read, stops the scan for other queries.
+ * The scan is closed and destroyed after all threads stopped using it.
+ */
+class SharedScan {
+ public:
+  //! Maximum number of found records of a query, which are not taken.
+  enum : size_t { pendingLimit = 1024 };
+
+  SharedScan();
+  SharedScan(SharedScan &&) = delete;
+  SharedScan(const SharedScan &) = delete;
+  SharedScan &operator=(SharedScan &&) = delete;
+  SharedScan &operator=(const SharedScan &) = delete;
+  ~SharedScan();
+
+  //! Sets UTF-8 mode of the record start and of the filters of queries.
+  /**
+   * @sa LogReader::SetUtf8
+   * @return True at success, false if the file is already opened.
+   */
+  bool SetUtf8(bool isUtf8);
+
+  //! Sets mask for lines which start records.
+  /**
+   * @sa LogReader::SetRecordStart
+   * @param[in] mask Record start mask or nullptr to make each line a record.
+   * @return True at success, false at error or if the file is already
+   * opened.
+   */
+  bool SetRecordStart(const char *mask);
+
+  //! Opens the file of log for scanning.
+  /**
+   * @return True at success, false at error or if a file is already opened.
+   */
+  bool Open(const char *filePath);
+
+  //! Closes the file and detaches all queries.
+  void Close();
+
+  //! Attaches the query.
+  /**
+   * @param[in] filter Mask (see LogReader::SetFilter) or expression (see
+   * LogReader::SetFilterExpression).
+   * @param[in] isExpression True if the filter is an expression of masks.
+   * @param[out] query At success returns the query identifier, which is
+   * valid until the query is detached. Identifiers of detached queries are
+   * reused.
+   * @return True at success, false at error or if the filter is invalid.
+   */
+  bool Attach(const char *filter, bool isExpression, size_t &query);
+
+  //! Detaches the query, which can be not completed.
+  void Detach(size_t query);
+
+  //! Enables or disables line numbers in records of the query, which are
+  //! found after the call.
+  /**
+   * Lines are counted once for all queries and only till found records.
+   * Disabled by default.
+   *
+   * @sa LogReader::SetLineNumbering
+   */
+  void SetLineNumbering(size_t query, bool isEnabled);
+
+  //! Enables or disables capturing of parts of records of the query, which
+  //! are found after the call.
+  /**
+   * @sa LogReader::SetCapturing
+   * @return True at success, false at error.
+   */
+  bool SetCapturing(size_t query, bool isEnabled);
+
+  //! Returns true if the scan has passed the whole file for the query or
+  //! if the query is detached.
+  bool IsCompleted(size_t query) const;
+
+  //! Returns the next record, which is matched by the query.
+  /**
+   * @params[in] query Identifier of the query.
+   * @params[out] record Record content and attributes. Content is valid
+   * until the scan is closed, captures are valid until the next call for
+   * the query.
+   * @return True if record successfully extracted. False if the query is
+   * completed and all its records are taken, or if an error has occurred.
+   */
+  bool GetNextRecord(size_t query, LogReader::Record &record);
+
+ private:
+  class Implementation;
+  Implementation *m_pimpl = nullptr;
+};
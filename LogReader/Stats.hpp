@@ -0,0 +1,38 @@
+﻿//
+//    Created: 2019/04/17 09:30
+//     Author: Eugene V. Palchukovsky
+//     E-mail: eugene@palchukovsky.com
+//
+
+#pragma once
+
+namespace logReader {
+
+//! Stats is a set of hot path counters.
+/**
+ * Counters are counted only by components with enabled counting, so the
+ * reading without statistics takes one check of a flag per counter.
+ */
+struct Stats {
+  //! Number of bytes passed by the reading position.
+  uint64_t bytesScanned = 0;
+  //! Number of bytes skipped by the index.
+  uint64_t bytesSkipped = 0;
+  //! Number of read bytes released from the working set.
+  uint64_t bytesReleased = 0;
+  //! Number of read records.
+  uint64_t recordsRead = 0;
+  //! Number of records matched by the filter.
+  uint64_t recordsMatched = 0;
+  //! Number of strings rejected by the mask length bounds, anchors and
+  //! required symbols before rules checking.
+  uint64_t quickRejections = 0;
+  //! Number of branches checked after greedy rules.
+  uint64_t greedyRetries = 0;
+  //! Number of fixed string searches.
+  uint64_t literalSearches = 0;
+  //! Number of positions compared with fixed strings.
+  uint64_t literalComparisons = 0;
+};
+
+}  // namespace logReader
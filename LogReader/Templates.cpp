@@ -0,0 +1,262 @@
+﻿//
+//    Created: 2019/04/24 20:15
+//     Author: Eugene V. Palchukovsky
+//     E-mail: eugene@palchukovsky.com
+//
+
+#include "Prec.hpp"
+#include "Templates.hpp"
+
+using namespace logReader;
+
+namespace {
+
+bool IsDigit(const char ch) { return ch >= '0' && ch <= '9'; }
+
+bool IsHex(const char ch) {
+  return IsDigit(ch) || (ch >= 'a' && ch <= 'f') || (ch >= 'A' && ch <= 'F');
+}
+
+bool IsWord(const char ch) {
+  return IsDigit(ch) || (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') ||
+         ch == '_';
+}
+
+//! Returns the number of hex digits from the position, not more than max.
+size_t CountHex(const char *it, const char *end, const size_t max) {
+  size_t result = 0;
+  for (; it < end && result < max && IsHex(*it); ++it, ++result) {
+  }
+  return result;
+}
+
+//! Returns true if the content has UUID at the position.
+bool IsUuid(const char *it, const char *end) {
+  const size_t groups[] = {8, 4, 4, 4, 12};
+  for (size_t i = 0; i < sizeof(groups) / sizeof(*groups); ++i) {
+    if (i > 0) {
+      if (it >= end || *it != '-') {
+        return false;
+      }
+      ++it;
+    }
+    if (CountHex(it, end, groups[i]) != groups[i]) {
+      return false;
+    }
+    it += groups[i];
+  }
+  return it >= end || !IsWord(*it);
+}
+
+uint64_t Hash(const char *text, const size_t len) {
+  // Multiply-rotate hash of 8-byte words.
+  auto result = 0x243F6A8885A308D3ull ^ len;
+  const auto &add = [&result](const uint64_t word) {
+    result ^= word * 0x9E3779B97F4A7C15ull;
+    result = (result << 31 | result >> 33) * 0xBF58476D1CE4E5B9ull;
+  };
+  auto it = text;
+  for (const auto end = text + len; end - it >= 8; it += 8) {
+    uint64_t word;
+    memcpy(&word, it, sizeof(word));
+    add(word);
+  }
+  uint64_t tail = 0;
+  memcpy(&tail, it, static_cast<size_t>(text + len - it));
+  add(tail);
+  result ^= result >> 29;
+  return result;
+}
+
+}  // namespace
+
+Templates::~Templates() {
+  Reset();
+  free(m_buffer);
+}
+
+void Templates::Reset() {
+  for (size_t i = 0; i < m_capacity; ++i) {
+    free(m_table[i].text);
+  }
+  free(m_table);
+  m_table = nullptr;
+  m_capacity = m_size = 0;
+}
+
+size_t Templates::Normalize(const char *begin,
+                            const char *const end,
+                            char *const result) {
+  assert(begin <= end);
+  auto out = result;
+  // The content from this position is copied as is, so hex letters before a
+  // digit can be taken back.
+  auto copiedBegin = begin;
+  const auto before = _mm_set1_epi8('0' - 1);
+  const auto after = _mm_set1_epi8('9' + 1);
+  const auto &write = [&out](const char *placeholder) {
+    const auto len = strlen(placeholder);
+    memcpy(out, placeholder, len);
+    out += len;
+  };
+  for (auto it = begin; it < end;) {
+    if (end - it >= 16) {
+      const auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(it));
+      const auto digits = _mm_and_si128(_mm_cmpgt_epi8(chunk, before),
+                                        _mm_cmplt_epi8(chunk, after));
+      const auto mask = static_cast<unsigned long>(_mm_movemask_epi8(digits));
+      unsigned long index;
+      if (!_BitScanForward(&index, mask)) {
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out), chunk);
+        it += 16;
+        out += 16;
+        continue;
+      }
+      memcpy(out, it, index);
+      it += index;
+      out += index;
+    } else if (!IsDigit(*it)) {
+      *out++ = *it++;
+      continue;
+    }
+
+    // A digit, the token can start with hex letters before it.
+    auto tokenBegin = it;
+    for (; tokenBegin > copiedBegin && IsHex(tokenBegin[-1]); --tokenBegin) {
+    }
+    const auto &isWordBegin = [begin](const char *pos) {
+      return pos == begin || !IsWord(pos[-1]);
+    };
+    // UUID groups before the group with the digit can be without digits.
+    const char *uuid = nullptr;
+    for (const auto offset : {24, 19, 14, 9, 0}) {
+      if (tokenBegin - copiedBegin >= offset &&
+          isWordBegin(tokenBegin - offset) &&
+          IsUuid(tokenBegin - offset, end)) {
+        uuid = tokenBegin - offset;
+        break;
+      }
+    }
+    const auto hexLen = CountHex(tokenBegin, end, SIZE_MAX);
+    const auto isWordEnd =
+        tokenBegin + hexLen >= end || !IsWord(tokenBegin[hexLen]);
+    if (uuid) {
+      out -= it - uuid;
+      write("<uuid>");
+      it = uuid + 36;
+    } else if (*it == '0' && it + 2 < end && (it[1] == 'x' || it[1] == 'X') &&
+               IsHex(it[2]) && (it == begin || !IsWord(it[-1]))) {
+      write("<hex>");
+      it += 2 + CountHex(it + 2, end, SIZE_MAX);
+    } else if (isWordBegin(tokenBegin) && isWordEnd && hexLen >= 8) {
+      out -= it - tokenBegin;
+      write("<hex>");
+      it = tokenBegin + hexLen;
+    } else {
+      write("<num>");
+      for (++it; it < end && IsDigit(*it); ++it) {
+      }
+    }
+    copiedBegin = it;
+  }
+  return static_cast<size_t>(out - result);
+}
+
+bool Templates::Add(const char *begin, const char *end) {
+  const auto size = static_cast<size_t>(end - begin) * maxExpansion;
+  if (m_bufferSize < size) {
+    free(m_buffer);
+    m_buffer = static_cast<char *>(malloc(size));
+    m_bufferSize = m_buffer ? size : 0;
+    if (!m_buffer) {
+      return false;
+    }
+  }
+  const auto len = Normalize(begin, end, m_buffer);
+  return Count(Hash(m_buffer, len), m_buffer, len, 1);
+}
+
+bool Templates::Merge(const Templates &other) {
+  for (size_t i = 0; i < other.m_capacity; ++i) {
+    const auto &item = other.m_table[i];
+    if (item.text && !Count(item.hash, item.text, item.len, item.count)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool Templates::Count(const uint64_t hash,
+                      const char *text,
+                      const size_t len,
+                      const uint64_t count) {
+  // The table is filled not more than by half.
+  if (m_size >= m_capacity / 2 && !Grow()) {
+    return false;
+  }
+  const auto mask = m_capacity - 1;
+  for (auto index = static_cast<size_t>(hash) & mask;;
+       index = (index + 1) & mask) {
+    auto &item = m_table[index];
+    if (!item.text) {
+      // Empty template has an allocated text too, to mark the item as used.
+      item.text = static_cast<char *>(malloc(len ? len : 1));
+      if (!item.text) {
+        return false;
+      }
+      memcpy(item.text, text, len);
+      item.hash = hash;
+      item.len = len;
+      item.count = count;
+      ++m_size;
+      return true;
+    }
+    if (item.hash == hash && item.len == len &&
+        !memcmp(item.text, text, len)) {
+      item.count += count;
+      return true;
+    }
+  }
+}
+
+bool Templates::Grow() {
+  const auto capacity = m_capacity ? m_capacity * 2 : 64;
+  const auto table =
+      static_cast<Template *>(calloc(capacity, sizeof(Template)));
+  if (!table) {
+    return false;
+  }
+  for (size_t i = 0; i < m_capacity; ++i) {
+    const auto &item = m_table[i];
+    if (!item.text) {
+      continue;
+    }
+    auto index = static_cast<size_t>(item.hash) & (capacity - 1);
+    for (; table[index].text; index = (index + 1) & (capacity - 1)) {
+    }
+    table[index] = item;
+  }
+  free(m_table);
+  m_table = table;
+  m_capacity = capacity;
+  return true;
+}
+
+size_t Templates::GetTop(const Template **result, const size_t size) const {
+  // Insertion into the sorted result, as the result is much smaller than the
+  // table.
+  size_t number = 0;
+  for (size_t i = 0; i < m_capacity && size; ++i) {
+    const auto &item = m_table[i];
+    if (!item.text ||
+        (number == size && result[number - 1]->count >= item.count)) {
+      continue;
+    }
+    auto pos = number < size ? number++ : size - 1;
+    for (; pos > 0 && result[pos - 1]->count < item.count; --pos) {
+      result[pos] = result[pos - 1];
+    }
+    result[pos] = &item;
+  }
+  return number;
+}
@@ -0,0 +1,98 @@
+﻿//
+//    Created: 2019/04/24 20:15
+//     Author: Eugene V. Palchukovsky
+//     E-mail: eugene@palchukovsky.com
+//
+
+#pragma once
+
+namespace logReader {
+
+//! Templates counts strings by templates (message shapes).
+/**
+ * A template is a string where variable parts are replaced by placeholders:
+ *   UUIDs like "123e4567-e89b-12d3-a456-426655440000" - by "<uuid>";
+ *   hex numbers like "0x1F" and words of 8 or more hex digits with a decimal
+ *   digit like "deadbeef01" - by "<hex>";
+ *   decimal numbers - by "<num>".
+ * Templates are counted in a hash table with open addressing.
+ */
+class Templates {
+ public:
+  //! Maximum ratio of the template length to the string length ("1" is
+  //! "<num>").
+  enum : size_t { maxExpansion = 5 };
+
+  //! Template is a counted template.
+  struct Template {
+    uint64_t hash;
+    //! Template text, it's allocated by the table.
+    char *text;
+    size_t len;
+    uint64_t count;
+  };
+
+  Templates() = default;
+  Templates(Templates &&) = delete;
+  Templates(const Templates &) = delete;
+  Templates &operator=(Templates &&) = delete;
+  Templates &operator=(const Templates &) = delete;
+  ~Templates();
+
+  //! Add counts the string by its template.
+  /**
+   * @return True at success, false at error (the string isn't counted).
+   */
+  bool Add(const char *begin, const char *end);
+
+  //! Merge adds templates counted by other table, so strings can be counted
+  //! by several threads in own tables.
+  /**
+   * @return True at success, false at error (the rest of templates aren't
+   * merged).
+   */
+  bool Merge(const Templates &);
+
+  //! Reset removes all templates.
+  void Reset();
+
+  //! GetSize returns number of different templates.
+  size_t GetSize() const { return m_size; }
+
+  //! GetTop returns the most frequent templates.
+  /**
+   * @param[out] result Buffer for templates from the most frequent,
+   * templates are valid until the table is changed.
+   * @param[in] size Buffer size.
+   * @return Number of returned templates.
+   */
+  size_t GetTop(const Template **result, size_t size) const;
+
+  //! Normalize writes the template of the string.
+  /**
+   * Symbols without decimal digits are copied by 16 per step with SSE2.
+   *
+   * @param[in] begin String begin.
+   * @param[in] end String end.
+   * @param[out] result Buffer for the template, has to be not less than
+   * maxExpansion string lengths.
+   * @return Template length.
+   */
+  static size_t Normalize(const char *begin, const char *end, char *result);
+
+ private:
+  //! Count adds the count of the template.
+  bool Count(uint64_t hash, const char *text, size_t len, uint64_t count);
+
+  //! Grow increases the table capacity twice.
+  bool Grow();
+
+  Template *m_table{nullptr};
+  size_t m_capacity = 0;
+  size_t m_size = 0;
+  //! Buffer for templates of added strings.
+  char *m_buffer{nullptr};
+  size_t m_bufferSize = 0;
+};
+
+}  // namespace logReader
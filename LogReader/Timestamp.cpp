@@ -0,0 +1,114 @@
+﻿//
+//    Created: 2019/04/13 12:24
+//     Author: Eugene V. Palchukovsky
+//     E-mail: eugene@palchukovsky.com
+//
+
+#include "Prec.hpp"
+#include "Timestamp.hpp"
+
+using namespace logReader;
+
+namespace {
+bool ReadNumber(const char *&it,
+                const char *end,
+                const size_t len,
+                uint32_t &result) {
+  if (static_cast<size_t>(end - it) < len) {
+    return false;
+  }
+  uint32_t number = 0;
+  for (size_t i = 0; i < len; ++i) {
+    const auto digit = static_cast<uint32_t>(it[i] - '0');
+    if (digit > 9) {
+      return false;
+    }
+    number = number * 10 + digit;
+  }
+  it += len;
+  result = number;
+  return true;
+}
+
+bool ReadDate(const char *&it, const char *end, uint32_t &result) {
+  auto dateIt = it;
+  uint32_t year;
+  uint32_t month;
+  uint32_t day;
+  if (!ReadNumber(dateIt, end, 4, year) || dateIt == end) {
+    return false;
+  }
+  const auto separator = *dateIt++;
+  if (separator != '-' && separator != '/') {
+    return false;
+  }
+  if (!ReadNumber(dateIt, end, 2, month) || dateIt == end ||
+      *dateIt++ != separator || !ReadNumber(dateIt, end, 2, day) ||
+      dateIt == end || (*dateIt != ' ' && *dateIt != 'T')) {
+    return false;
+  }
+  if (month < 1 || month > 12 || day < 1 || day > 31) {
+    return false;
+  }
+  it = dateIt + 1;
+  result = year * 10000 + month * 100 + day;
+  return true;
+}
+
+bool ReadTime(const char *&it, const char *end, uint64_t &result) {
+  uint32_t hours;
+  uint32_t minutes;
+  uint32_t seconds = 0;
+  if (!ReadNumber(it, end, 2, hours) || it == end || *it++ != ':' ||
+      !ReadNumber(it, end, 2, minutes)) {
+    return false;
+  }
+  if (hours > 23 || minutes > 59) {
+    return false;
+  }
+  uint64_t micros = 0;
+  if (it != end && *it == ':') {
+    ++it;
+    if (!ReadNumber(it, end, 2, seconds) || seconds > 60) {
+      return false;
+    }
+    if (it != end && (*it == '.' || *it == ',')) {
+      ++it;
+      uint64_t scale = 100000;
+      for (; it != end && *it >= '0' && *it <= '9'; ++it) {
+        micros += static_cast<uint64_t>(*it - '0') * scale;
+        scale /= 10;
+      }
+    }
+  }
+  result = ((hours * 60 + minutes) * 60 + seconds) * 1000000ull + micros;
+  return true;
+}
+}  // namespace
+
+bool Timestamp::Parse(const char *begin, const char *end) {
+  assert(begin <= end);
+  auto it = begin;
+  if (it != end && *it == '[') {
+    ++it;
+  }
+  uint32_t date = 0;
+  ReadDate(it, end, date);
+  uint64_t time;
+  if (!ReadTime(it, end, time)) {
+    return false;
+  }
+  m_date = date;
+  m_time = time;
+  return true;
+}
+
+int Timestamp::Compare(const Timestamp &rhs) const {
+  if (m_date && rhs.m_date && m_date != rhs.m_date) {
+    return m_date < rhs.m_date ? -1 : 1;
+  }
+  if (m_time != rhs.m_time) {
+    return m_time < rhs.m_time ? -1 : 1;
+  }
+  return 0;
+}
@@ -0,0 +1,64 @@
+﻿//
+//    Created: 2019/04/13 12:20
+//     Author: Eugene V. Palchukovsky
+//     E-mail: eugene@palchukovsky.com
+//
+
+#pragma once
+
+namespace logReader {
+
+//! Timestamp is a time point from a log record begin.
+/**
+ * Supported formats (optionally in square brackets):
+ *   YYYY-MM-DD HH:MM[:SS[.FFFFFF]]
+ *   YYYY/MM/DDTHH:MM[:SS[,FFFFFF]]
+ *   HH:MM[:SS[.FFFFFF]]
+ */
+class Timestamp {
+ public:
+  Timestamp() = default;
+  Timestamp(Timestamp &&) = default;
+  Timestamp(const Timestamp &) = default;
+  Timestamp &operator=(Timestamp &&) = default;
+  Timestamp &operator=(const Timestamp &) = default;
+  ~Timestamp() = default;
+
+  //! Parse parses timestamp from the content begin.
+  /**
+   * @param[in] begin Content begin.
+   * @param[in] end Content end.
+   * @return True if the content starts with a timestamp, false otherwise
+   * (previous value still be active).
+   */
+  bool Parse(const char *begin, const char *end);
+
+  //! Compare compares two time points.
+  /**
+   * If one of the timestamps has no date - only time of day is compared.
+   *
+   * @return Negative value if this time point is earlier, zero if time points
+   * are equal, positive value otherwise.
+   */
+  int Compare(const Timestamp &) const;
+
+  bool operator<(const Timestamp &rhs) const { return Compare(rhs) < 0; }
+
+  //! HasDate returns true if the timestamp has date.
+  bool HasDate() const { return m_date != 0; }
+
+  //! InheritDate sets the date of other timestamp if this one has no date.
+  void InheritDate(const Timestamp &other) {
+    if (!m_date) {
+      m_date = other.m_date;
+    }
+  }
+
+ private:
+  //! Date as YYYYMMDD or zero if it's not set.
+  uint32_t m_date = 0;
+  //! Time of day in microseconds.
+  uint64_t m_time = 0;
+};
+
+}  // namespace logReader
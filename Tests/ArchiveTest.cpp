@@ -0,0 +1,184 @@
+﻿//
+//    Created: 2019/04/26 16:40
+//     Author: Eugene V. Palchukovsky
+//     E-mail: eugene@palchukovsky.com
+//
+
+#include "Prec.hpp"
+#include "LogReader/Archive.hpp"
+
+using namespace logReader;
+using namespace testing;
+
+namespace {
+
+//! Returns the temporary file path.
+std::string GetTempFilePath() {
+  char dir[MAX_PATH];
+  char path[MAX_PATH];
+  if (!GetTempPath(sizeof(dir), dir) ||
+      !GetTempFileName(dir, "lgr", 0, path)) {
+    return std::string();
+  }
+  return path;
+}
+
+//! Creates the archive of the content with the block size and returns the
+//! archive file content.
+std::string Compress(const std::string &content, const size_t blockSize) {
+  const auto filePath = GetTempFilePath();
+  const auto archivePath = GetTempFilePath();
+  std::string result;
+  {
+    std::ofstream(filePath, std::ios::binary) << content;
+    if (Archive::Create(filePath.c_str(), archivePath.c_str(), blockSize)) {
+      std::ifstream archive(archivePath, std::ios::binary);
+      result.assign(std::istreambuf_iterator<char>(archive),
+                    std::istreambuf_iterator<char>());
+    }
+  }
+  DeleteFile(filePath.c_str());
+  DeleteFile(archivePath.c_str());
+  return result;
+}
+
+std::string CreateContent() {
+  std::string result;
+  for (auto i = 0; result.size() < 300000; ++i) {
+    result += "2019-04-26 16:40:00 record " + std::to_string(i) +
+              std::string(static_cast<size_t>(i % 97), 'x') + "\n";
+  }
+  return result;
+}
+
+}  // namespace
+
+TEST(Archive, Open) {
+  EXPECT_FALSE(Archive::IsArchive("LRZA not an archive\n", 20));
+  const auto content = CreateContent();
+  const auto view = Compress(content, Archive::defaultBlockSize);
+  ASSERT_TRUE(Archive::IsArchive(view.data(), view.size()));
+  // The table of blocks doesn't match the header.
+  EXPECT_FALSE(Archive::IsArchive(view.data(), view.size() - 8));
+
+  const auto archive = Archive::Open(view.data(), view.size());
+  ASSERT_NE(nullptr, archive);
+  ASSERT_EQ(content.size(), archive->GetContentSize());
+  size_t begin;
+  size_t end;
+  archive->GetBlock(content.size() - 1, begin, end);
+  EXPECT_EQ(0, begin);
+  EXPECT_EQ(content.size(), end);
+  ASSERT_TRUE(archive->Lock(0, content.size()));
+  EXPECT_EQ(content, std::string(archive->GetContent(), content.size()));
+
+  // Locked content is written by the system as usual memory.
+  const auto path = GetTempFilePath();
+  const auto file = CreateFile(path.c_str(), GENERIC_WRITE, 0, nullptr,
+                               CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+  ASSERT_NE(INVALID_HANDLE_VALUE, file);
+  DWORD written;
+  EXPECT_TRUE(WriteFile(file, archive->GetContent(),
+                        static_cast<DWORD>(content.size()), &written,
+                        nullptr));
+  CloseHandle(file);
+  archive->Unlock(0, content.size());
+  Archive::Close(archive);
+  {
+    std::ifstream stream(path, std::ios::binary);
+    EXPECT_EQ(content, std::string(std::istreambuf_iterator<char>(stream),
+                                   std::istreambuf_iterator<char>()));
+  }
+  DeleteFile(path.c_str());
+}
+
+TEST(Archive, Cache) {
+  // Blocks are smaller and larger than a page, so pages are shared by blocks
+  // and blocks are decommitted while the pages of neighbors are read.
+  const auto content = CreateContent();
+  for (const size_t blockSize : {1000, 10000}) {
+    const auto view = Compress(content, blockSize);
+    for (const size_t cacheSize : {size_t(0), size_t(30000)}) {
+      const auto archive = Archive::Open(view.data(), view.size(), cacheSize);
+      ASSERT_NE(nullptr, archive);
+      const auto data = archive->GetContent();
+      ASSERT_EQ(content.size(), archive->GetContentSize());
+
+      // Each block is in one block of the table, the last block ends at the
+      // content end.
+      size_t blocksNumber = 0;
+      for (size_t pos = 0; pos < content.size(); ++blocksNumber) {
+        size_t begin;
+        size_t end;
+        archive->GetBlock(pos, begin, end);
+        ASSERT_EQ(pos, begin);
+        ASSERT_LT(begin, end);
+        ASSERT_GE(blockSize, end - begin);
+        pos = end;
+      }
+      EXPECT_LT(content.size() / blockSize, blocksNumber);
+
+      // Random regions are locked with a prefetched region and with the
+      // previous region, which is unlocked after that.
+      std::minstd_rand random(1);
+      size_t mismatchesNumber = 0;
+      size_t prevBegin = 0;
+      size_t prevEnd = 0;
+      for (auto i = 0; i < 2000; ++i) {
+        const auto begin = random() % content.size();
+        const auto end = begin + 1 + random() % (content.size() - begin);
+        const auto prefetched = random() % content.size();
+        archive->Prefetch(prefetched, prefetched + 1);
+        ASSERT_TRUE(archive->Lock(begin, end));
+        if (memcmp(content.data() + begin, data + begin, end - begin) ||
+            memcmp(content.data() + prevBegin, data + prevBegin,
+                   prevEnd - prevBegin)) {
+          ++mismatchesNumber;
+        }
+        if (prevBegin < prevEnd) {
+          archive->Unlock(prevBegin, prevEnd);
+        }
+        prevBegin = begin;
+        prevEnd = end;
+      }
+      archive->Unlock(prevBegin, prevEnd);
+      EXPECT_EQ(0, mismatchesNumber);
+      Archive::Close(archive);
+    }
+  }
+}
+
+TEST(Archive, Threads) {
+  // Threads lock blocks, which are extracted and evicted by other threads.
+  const auto content = CreateContent();
+  const auto view = Compress(content, 1000);
+  const auto archive = Archive::Open(view.data(), view.size(), 0);
+  ASSERT_NE(nullptr, archive);
+  const auto data = archive->GetContent();
+  size_t mismatchesNumbers[4] = {};
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < 4; ++i) {
+    threads.emplace_back([&, i]() {
+      std::minstd_rand random(static_cast<unsigned>(i + 1));
+      for (auto j = 0; j < 1000; ++j) {
+        const auto begin = random() % content.size();
+        const auto end = begin + 1 + random() % 20000;
+        const auto lockEnd = end < content.size() ? end : content.size();
+        archive->Prefetch(lockEnd - 1, lockEnd);
+        if (!archive->Lock(begin, lockEnd) ||
+            memcmp(content.data() + begin, data + begin, lockEnd - begin)) {
+          ++mismatchesNumbers[i];
+          continue;
+        }
+        archive->Unlock(begin, lockEnd);
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  Archive::Close(archive);
+  for (const auto number : mismatchesNumbers) {
+    EXPECT_EQ(0, number);
+  }
+}
@@ -0,0 +1,120 @@
+﻿//
+//    Created: 2019/04/23 21:40
+//     Author: Eugene V. Palchukovsky
+//     E-mail: eugene@palchukovsky.com
+//
+
+#include "Prec.hpp"
+#include "LogReader/Filter.hpp"
+#include "LogReader/MaskMatcher.hpp"
+
+using namespace logReader;
+using namespace testing;
+
+namespace {
+
+void TestMatch(const Filter &filter, const char *string, bool result) {
+  EXPECT_EQ(result, filter.Match(string, string + strlen(string))) << string;
+}
+
+}  // namespace
+
+TEST(Filter, Empty) {
+  Filter filter;
+  TestMatch(filter, "", true);
+  TestMatch(filter, "abc", true);
+  EXPECT_EQ(nullptr, filter.GetRequired());
+}
+
+TEST(Filter, Mask) {
+  Filter filter;
+  ASSERT_TRUE(filter.Compile("*abc*"));
+  TestMatch(filter, "xabcx", true);
+  TestMatch(filter, "xabx", false);
+  EXPECT_NE(nullptr, filter.GetRequired());
+}
+
+TEST(Filter, Expression) {
+  Filter filter;
+  ASSERT_TRUE(
+      filter.CompileExpression(R"("*ERROR*" AND NOT "*healthcheck*")"));
+  TestMatch(filter, "ERROR: failed", true);
+  TestMatch(filter, "ERROR: healthcheck failed", false);
+  TestMatch(filter, "INFO: started", false);
+  EXPECT_NE(nullptr, filter.GetRequired());
+
+  ASSERT_TRUE(filter.CompileExpression(R"("a*" OR "b*" AND "*c")"));
+  TestMatch(filter, "a", true);
+  TestMatch(filter, "b", false);
+  TestMatch(filter, "bc", true);
+  EXPECT_EQ(nullptr, filter.GetRequired());
+
+  ASSERT_TRUE(filter.CompileExpression(R"(("a*" OR "b*")AND"*c")"));
+  TestMatch(filter, "a", false);
+  TestMatch(filter, "ac", true);
+  TestMatch(filter, "bc", true);
+  TestMatch(filter, "cc", false);
+
+  ASSERT_TRUE(filter.CompileExpression(R"(NOT NOT ("x" OR NOT "y"))"));
+  TestMatch(filter, "x", true);
+  TestMatch(filter, "y", false);
+  TestMatch(filter, "z", true);
+
+  // Slash before double quote is removed, other slash sequences are masks
+  // escapes.
+  ASSERT_TRUE(filter.CompileExpression(R"("*\"\**")"));
+  TestMatch(filter, R"(x"*x)", true);
+  TestMatch(filter, R"(x"x)", false);
+}
+
+TEST(Filter, InvalidExpression) {
+  Filter filter;
+  ASSERT_TRUE(filter.CompileExpression(R"("a")"));
+  EXPECT_FALSE(filter.CompileExpression(""));
+  EXPECT_FALSE(filter.CompileExpression("a"));
+  EXPECT_FALSE(filter.CompileExpression(R"("a)"));
+  EXPECT_FALSE(filter.CompileExpression(R"("a" AND)"));
+  EXPECT_FALSE(filter.CompileExpression(R"("a" "b")"));
+  EXPECT_FALSE(filter.CompileExpression(R"(("a")"));
+  EXPECT_FALSE(filter.CompileExpression(R"("a"))"));
+  EXPECT_FALSE(filter.CompileExpression(R"("a" ANDNOT "b")"));
+  EXPECT_FALSE(filter.CompileExpression(R"(NOT)"));
+  EXPECT_FALSE(filter.CompileExpression(
+      (std::string(100, '(') + R"("a")" + std::string(100, ')')).c_str()));
+  // The previous filter is still active.
+  TestMatch(filter, "a", true);
+  TestMatch(filter, "b", false);
+}
+
+TEST(Filter, AdaptiveOrder) {
+  Filter filter;
+  // The second operand rejects almost each string, so it has to be checked
+  // first after the reorder, and the first operand isn't checked anymore.
+  ASSERT_TRUE(filter.CompileExpression(R"("*x*" AND "needle*")"));
+  filter.SetStatsCounting(true);
+  const std::string string = std::string(1000, 'x');
+  Stats stats;
+  for (size_t i = 0; i < Filter::reorderPeriod * 2; ++i) {
+    TestMatch(filter, string.c_str(), false);
+  }
+  filter.AddStats(stats);
+  const auto searches = stats.literalSearches;
+  for (size_t i = 0; i < Filter::reorderPeriod; ++i) {
+    TestMatch(filter, string.c_str(), false);
+  }
+  stats = {};
+  filter.AddStats(stats);
+  EXPECT_EQ(searches, stats.literalSearches);
+}
+
+TEST(Filter, StepsLimit) {
+  Filter filter;
+  filter.SetStepsLimit(100);
+  ASSERT_TRUE(filter.CompileExpression(R"(NOT "*a*a*a*b*c")"));
+  // "b" is before "a", so the content isn't rejected by required symbols.
+  const auto string = "b" + std::string(1000, 'a') + "c";
+  TestMatch(filter, string.c_str(), false);
+  EXPECT_TRUE(filter.IsAborted());
+  TestMatch(filter, "b", true);
+  EXPECT_FALSE(filter.IsAborted());
+}
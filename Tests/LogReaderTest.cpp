@@ -0,0 +1,988 @@
+﻿//
+//    Created: 2019/04/13 13:30
+//     Author: Eugene V. Palchukovsky
+//     E-mail: eugene@palchukovsky.com
+//
+
+#include "Prec.hpp"
+#include "LogReader/LogReader.hpp"
+#include "LogReader/MergedLogReader.hpp"
+#include "LogReader/SharedScan.hpp"
+
+using namespace testing;
+
+namespace {
+
+//! Temporary file of log which is removed at the test end.
+class LogFile {
+ public:
+  explicit LogFile(const char *content) {
+    char dir[MAX_PATH];
+    if (!GetTempPath(sizeof(dir), dir) ||
+        !GetTempFileName(dir, "lgr", 0, m_path)) {
+      m_path[0] = 0;
+      return;
+    }
+    const auto file = CreateFile(m_path, GENERIC_WRITE, 0, nullptr,
+                                 CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+      return;
+    }
+    DWORD written;
+    WriteFile(file, content, static_cast<DWORD>(strlen(content)), &written,
+              nullptr);
+    CloseHandle(file);
+  }
+  LogFile(LogFile &&) = delete;
+  LogFile(const LogFile &) = delete;
+  LogFile &operator=(LogFile &&) = delete;
+  LogFile &operator=(const LogFile &) = delete;
+  ~LogFile() { DeleteFile(m_path); }
+
+  const char *GetPath() const { return m_path; }
+
+  //! Appends content to the file end, as a log writer does.
+  void Append(const char *content) const {
+    const auto file =
+        CreateFile(m_path, FILE_APPEND_DATA, FILE_SHARE_READ, nullptr,
+                   OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+      return;
+    }
+    DWORD written;
+    WriteFile(file, content, static_cast<DWORD>(strlen(content)), &written,
+              nullptr);
+    CloseHandle(file);
+  }
+
+ private:
+  char m_path[MAX_PATH];
+};
+
+void TestLines(LogReader &reader, const std::vector<std::string> &expected) {
+  std::vector<std::string> lines;
+  char buffer[256];
+  while (reader.GetNextLine(&buffer[0], sizeof(buffer))) {
+    lines.emplace_back(&buffer[0]);
+  }
+  EXPECT_EQ(expected, lines);
+}
+
+}  // namespace
+
+TEST(LogReader, Filter) {
+  const LogFile file("abc 1\n\nxyz 2\r\nabc 3");
+  LogReader reader;
+  ASSERT_TRUE(reader.Open(file.GetPath()));
+  ASSERT_TRUE(reader.SetFilter("abc*"));
+  TestLines(reader, {"abc 1", "abc 3"});
+}
+
+TEST(LogReader, TimeRange) {
+  const LogFile file(
+      "2019-04-13 09:59:00 one\n"
+      "2019-04-13 10:00:00 two\n"
+      "\tat continuation\n"
+      "2019-04-13 10:01:00 three\n"
+      "2019-04-13 10:04:59.999 four\n"
+      "2019-04-13 10:05:00 five\n"
+      "2019-04-13 10:06:00 six\n");
+  {
+    LogReader reader;
+    ASSERT_TRUE(reader.Open(file.GetPath()));
+    ASSERT_TRUE(reader.SetTimeRange("10:00", "10:05"));
+    TestLines(reader,
+              {"2019-04-13 10:00:00 two", "\tat continuation",
+               "2019-04-13 10:01:00 three", "2019-04-13 10:04:59.999 four"});
+  }
+  {
+    LogReader reader;
+    ASSERT_TRUE(reader.Open(file.GetPath()));
+    ASSERT_TRUE(reader.SetFilter("*f*"));
+    ASSERT_TRUE(reader.SetTimeRange("2019-04-13 10:00:30", nullptr));
+    TestLines(reader,
+              {"2019-04-13 10:04:59.999 four", "2019-04-13 10:05:00 five"});
+  }
+  {
+    LogReader reader;
+    ASSERT_TRUE(reader.Open(file.GetPath()));
+    ASSERT_TRUE(reader.SetTimeRange(nullptr, "09:00"));
+    TestLines(reader, {});
+  }
+  {
+    LogReader reader;
+    EXPECT_FALSE(reader.SetTimeRange("10:00", nullptr));
+    ASSERT_TRUE(reader.Open(file.GetPath()));
+    EXPECT_FALSE(reader.SetTimeRange("ten", nullptr));
+  }
+}
+
+TEST(LogReader, MultilineRecords) {
+  const LogFile file(
+      "\tat orphan\n"
+      "2019-04-14 10:00:00 ERROR NullPointerException\n"
+      "\tat com.foo.Bar(Bar.java:10)\n"
+      "\n"
+      "\tat com.foo.Baz(Baz.java:20)\n"
+      "\n"
+      "2019-04-14 10:00:01 INFO done\n"
+      "2019-04-14 10:00:02 ERROR IllegalStateException\n"
+      "\tat com.foo.Qux(Qux.java:30)");
+  {
+    LogReader reader;
+    ASSERT_TRUE(reader.Open(file.GetPath()));
+    ASSERT_TRUE(reader.SetRecordStart("20*:*:* "));
+    ASSERT_TRUE(reader.SetFilter("*NullPointer*at com.foo.Baz*"));
+    TestLines(reader, {"2019-04-14 10:00:00 ERROR NullPointerException\n"
+                       "\tat com.foo.Bar(Bar.java:10)\n"
+                       "\n"
+                       "\tat com.foo.Baz(Baz.java:20)"});
+  }
+  {
+    LogReader reader;
+    ASSERT_TRUE(reader.SetRecordStart("20*:*:* "));
+    ASSERT_TRUE(reader.Open(file.GetPath()));
+    TestLines(reader, {"\tat orphan",
+                       "2019-04-14 10:00:00 ERROR NullPointerException\n"
+                       "\tat com.foo.Bar(Bar.java:10)\n"
+                       "\n"
+                       "\tat com.foo.Baz(Baz.java:20)",
+                       "2019-04-14 10:00:01 INFO done",
+                       "2019-04-14 10:00:02 ERROR IllegalStateException\n"
+                       "\tat com.foo.Qux(Qux.java:30)"});
+  }
+  {
+    LogReader reader;
+    ASSERT_TRUE(reader.Open(file.GetPath()));
+    ASSERT_TRUE(reader.SetRecordStart("20*:*:* "));
+    ASSERT_TRUE(reader.SetRecordStart(nullptr));
+    ASSERT_TRUE(reader.SetFilter("*at com.foo.*"));
+    TestLines(reader, {"\tat com.foo.Bar(Bar.java:10)",
+                       "\tat com.foo.Baz(Baz.java:20)",
+                       "\tat com.foo.Qux(Qux.java:30)"});
+  }
+}
+
+TEST(LogReader, Context) {
+  const LogFile file(
+      "1\n2\nmatch 3\n4\n5\n6\n7\nmatch 8\n9\nmatch 10\n11\n12\n");
+  const auto &read = [&file](const size_t before, const size_t after) {
+    LogReader reader;
+    EXPECT_TRUE(reader.Open(file.GetPath()));
+    EXPECT_TRUE(reader.SetFilter("match *"));
+    EXPECT_TRUE(reader.SetContext(before, after));
+    std::string result;
+    LogReader::Record record;
+    while (reader.GetNextRecord(record)) {
+      if (record.isGap) {
+        result += "|";
+      }
+      result += record.isMatched ? "+" : "-";
+      result.append(record.begin, record.end);
+      result += " ";
+    }
+    return result;
+  };
+  EXPECT_EQ("+match 3 +match 8 +match 10 ", read(0, 0));
+  EXPECT_EQ("+match 3 -4 |+match 8 -9 +match 10 -11 ", read(0, 1));
+  EXPECT_EQ("-2 +match 3 |-7 +match 8 -9 +match 10 ", read(1, 0));
+  EXPECT_EQ(
+      "-1 -2 +match 3 -4 -5 -6 -7 +match 8 -9 +match 10 -11 -12 ", read(2, 2));
+  EXPECT_EQ("-1 -2 +match 3 -4 -5 -6 -7 +match 8 -9 +match 10 ", read(10, 0));
+}
+
+TEST(LogReader, LineNumbers) {
+  std::string content;
+  for (auto i = 1; i <= 300; ++i) {
+    content += i % 7 ? "line " + std::to_string(i) + "\n" : "\n";
+  }
+  const LogFile file(content.c_str());
+  LogReader reader;
+  ASSERT_TRUE(reader.Open(file.GetPath()));
+  ASSERT_TRUE(reader.SetFilter("line *9"));
+  reader.SetLineNumbering(true);
+  LogReader::Record record;
+  for (auto i = 9; i <= 300; i += 10) {
+    if (!(i % 7)) {
+      continue;
+    }
+    ASSERT_TRUE(reader.GetNextRecord(record));
+    EXPECT_EQ(static_cast<size_t>(i), record.line);
+    EXPECT_EQ(content.find("line " + std::to_string(i) + "\n"), record.offset);
+  }
+  EXPECT_FALSE(reader.GetNextRecord(record));
+}
+
+TEST(LogReader, LineEnds) {
+  // CR LF is one line end, bare CR and LF are line ends too.
+  const char *const ends[] = {"\n", "\r", "\r\n", "\n\r"};
+  std::string content;
+  std::vector<size_t> numbers;
+  size_t number = 1;
+  for (auto i = 1; i <= 300; ++i) {
+    numbers.emplace_back(number);
+    content += "line " + std::to_string(i) + ends[i % 4];
+    number += i % 4 == 3 ? 2 : 1;
+  }
+  const LogFile file(content.c_str());
+  LogReader reader;
+  ASSERT_TRUE(reader.Open(file.GetPath()));
+  ASSERT_TRUE(reader.SetFilter("line *7"));
+  reader.SetLineNumbering(true);
+  LogReader::Record record;
+  for (auto i = 7; i <= 300; i += 10) {
+    ASSERT_TRUE(reader.GetNextRecord(record));
+    EXPECT_EQ(numbers[i - 1], record.line);
+  }
+  EXPECT_FALSE(reader.GetNextRecord(record));
+}
+
+TEST(LogReader, Stats) {
+  const LogFile file("abc 1\n\nxyz 2\nabc 3\n");
+  LogReader reader;
+  ASSERT_TRUE(reader.Open(file.GetPath()));
+  ASSERT_TRUE(reader.SetFilter("*abc*"));
+  LogReader::Stats stats;
+  EXPECT_FALSE(reader.GetStats(stats));
+  reader.SetStatsCounting(true);
+  TestLines(reader, {"abc 1", "abc 3"});
+  ASSERT_TRUE(reader.GetStats(stats));
+  EXPECT_EQ(19, stats.bytesScanned);
+  EXPECT_EQ(3, stats.recordsRead);
+  EXPECT_EQ(2, stats.recordsMatched);
+  EXPECT_LT(0, stats.literalSearches);
+  EXPECT_LT(0, stats.literalComparisons);
+
+  reader.SetStatsCounting(false);
+  EXPECT_FALSE(reader.GetStats(stats));
+}
+
+TEST(LogReader, MatchLimit) {
+  const LogFile file(
+      ("abc\nb" + std::string(1000, 'a') + "c\naaabc\n").c_str());
+  LogReader reader;
+  ASSERT_TRUE(reader.Open(file.GetPath()));
+  ASSERT_TRUE(reader.SetFilter("*a*a*a*b*c"));
+  reader.SetMatchLimit(100);
+  TestLines(reader, {"aaabc"});
+  EXPECT_EQ(1, reader.GetAbortedRecordsNumber());
+
+  // Results of the limited check are not cached for the check without limit.
+  const auto matched = "aaa" + std::string(200, 'b') + "c";
+  const LogFile cachedFile(("abc\n" + matched + "\naaabc\n").c_str());
+  const auto &read = [&cachedFile](const size_t limit,
+                                   const std::vector<std::string> &expected) {
+    LogReader cachedReader;
+    cachedReader.SetResultCaching(true);
+    ASSERT_TRUE(cachedReader.Open(cachedFile.GetPath()));
+    ASSERT_TRUE(cachedReader.SetFilter("*aa*b?c"));
+    cachedReader.SetMatchLimit(limit);
+    TestLines(cachedReader, expected);
+  };
+  read(100, {"aaabc"});
+  read(0, {matched, "aaabc"});
+  read(100, {"aaabc"});
+}
+
+TEST(LogReader, ReadAhead) {
+  const LogFile file("abc 1\n\nxyz 2\r\nabc 3");
+  for (const size_t readAhead : {0, 1, 4, 1024}) {
+    LogReader reader;
+    reader.SetReadAhead(readAhead);
+    ASSERT_TRUE(reader.Open(file.GetPath()));
+    ASSERT_TRUE(reader.SetFilter("abc*"));
+    TestLines(reader, {"abc 1", "abc 3"});
+  }
+}
+
+TEST(LogReader, ScanOnce) {
+  std::string content;
+  std::vector<std::string> expected;
+  for (auto i = 0; i < 10000; ++i) {
+    content += "record " + std::to_string(i) + "\n";
+    if (i > 0 && i % 100 == 0) {
+      expected.emplace_back("record " + std::to_string(i));
+    }
+  }
+  const LogFile file(content.c_str());
+  LogReader reader;
+  reader.SetScanOnce(8192);
+  reader.SetStatsCounting(true);
+  ASSERT_TRUE(reader.Open(file.GetPath()));
+  ASSERT_TRUE(reader.SetFilter("record *00"));
+  // Records are valid after pages release while the file is open, the file
+  // is closed after the last record.
+  std::vector<LogReader::Record> records;
+  LogReader::Record record;
+  while (reader.GetNextRecord(record)) {
+    records.emplace_back(record);
+    std::vector<std::string> lines;
+    for (const auto &it : records) {
+      lines.emplace_back(it.begin, it.end);
+    }
+    ASSERT_EQ(std::vector<std::string>(expected.cbegin(),
+                                       expected.cbegin() + lines.size()),
+              lines);
+  }
+  EXPECT_EQ(expected.size(), records.size());
+  LogReader::Stats stats;
+  ASSERT_TRUE(reader.GetStats(stats));
+  EXPECT_EQ(content.size(), stats.bytesReleased);
+}
+
+TEST(LogReader, SharedFile) {
+  LogReader::SetFileCacheSize(16);
+  const LogFile file("abc 1\nxyz 2\n");
+  LogReader reader1;
+  LogReader reader2;
+  ASSERT_TRUE(reader1.Open(file.GetPath()));
+  ASSERT_TRUE(reader2.Open(file.GetPath()));
+  LogReader::Record record1;
+  LogReader::Record record2;
+  ASSERT_TRUE(reader1.GetNextRecord(record1));
+  ASSERT_TRUE(reader1.GetNextRecord(record1));
+  ASSERT_TRUE(reader2.GetNextRecord(record2));
+  // Readers share the content, but have own reading positions.
+  EXPECT_EQ(record1.begin - record1.offset, record2.begin - record2.offset);
+  EXPECT_EQ(6, record1.offset);
+  EXPECT_EQ(0, record2.offset);
+  reader1.Close();
+  reader2.Close();
+
+  // Changed file is mapped again.
+  file.Append("abc 3\n");
+  ASSERT_TRUE(reader1.Open(file.GetPath()));
+  ASSERT_TRUE(reader1.SetFilter("abc*"));
+  TestLines(reader1, {"abc 1", "abc 3"});
+
+  LogReader::SetFileCacheSize(0);
+  ASSERT_TRUE(reader2.Open(file.GetPath()));
+  TestLines(reader2, {"abc 1", "xyz 2", "abc 3"});
+}
+
+TEST(LogReader, RotatedFile) {
+  const LogFile file("abc 1\nxyz 2\n");
+  {
+    LogReader reader;
+    ASSERT_TRUE(reader.Open(file.GetPath()));
+    TestLines(reader, {"abc 1", "xyz 2"});
+  }
+
+  // A closed file is truncated and renamed by a log writer.
+  const auto handle =
+      CreateFile(file.GetPath(), GENERIC_WRITE,
+                 FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                 nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  ASSERT_NE(INVALID_HANDLE_VALUE, handle);
+  EXPECT_TRUE(SetEndOfFile(handle));
+  CloseHandle(handle);
+  const auto rotatedPath = std::string(file.GetPath()) + ".1";
+  EXPECT_TRUE(MoveFile(file.GetPath(), rotatedPath.c_str()));
+  EXPECT_TRUE(MoveFile(rotatedPath.c_str(), file.GetPath()));
+
+  // The changed file is mapped again.
+  file.Append("abc 3\n");
+  LogReader reader;
+  ASSERT_TRUE(reader.Open(file.GetPath()));
+  TestLines(reader, {"abc 3"});
+}
+
+TEST(LogReader, ResultCache) {
+  const LogFile file("abc 1\nxyz 2\nabc 3\n");
+  const auto &read = [&file](const std::vector<std::string> &expected,
+                             const unsigned long long expectedBytesScanned) {
+    LogReader reader;
+    reader.SetResultCaching(true);
+    reader.SetStatsCounting(true);
+    ASSERT_TRUE(reader.Open(file.GetPath()));
+    ASSERT_TRUE(reader.SetFilter("abc*"));
+    TestLines(reader, expected);
+    LogReader::Stats stats;
+    ASSERT_TRUE(reader.GetStats(stats));
+    EXPECT_EQ(expectedBytesScanned, stats.bytesScanned);
+  };
+  read({"abc 1", "abc 3"}, 18);
+  // The last record is scanned again as it can be continued by the writer.
+  read({"abc 1", "abc 3"}, 6);
+  file.Append("abc 4\nxyz 5\n");
+  read({"abc 1", "abc 3", "abc 4"}, 18);
+  read({"abc 1", "abc 3", "abc 4"}, 6);
+
+  LogReader reader;
+  reader.SetResultCaching(true);
+  reader.SetLineNumbering(true);
+  ASSERT_TRUE(reader.Open(file.GetPath()));
+  ASSERT_TRUE(reader.SetFilter("abc*"));
+  LogReader::Record record;
+  ASSERT_TRUE(reader.GetNextRecord(record));
+  ASSERT_TRUE(reader.GetNextRecord(record));
+  EXPECT_EQ(3, record.line);
+  EXPECT_EQ("abc 3", std::string(record.begin, record.end));
+}
+
+TEST(LogReader, RecordBatches) {
+  std::string content;
+  std::vector<std::string> expected;
+  for (auto i = 0; i < 100; ++i) {
+    content += "xyz " + std::to_string(i) + "\n";
+    if (i % 10 == 0) {
+      content += "abc " + std::to_string(i) + "\n";
+      expected.emplace_back("abc " + std::to_string(i));
+    }
+  }
+  const LogFile file(content.c_str());
+  LogReader reader;
+  ASSERT_TRUE(reader.Open(file.GetPath()));
+  ASSERT_TRUE(reader.SetFilter("abc*"));
+  std::vector<std::string> lines;
+  LogReader::Record records[3];
+  size_t number;
+  size_t calls = 0;
+  while (reader.GetNextRecords(records, 3, 32, number)) {
+    ++calls;
+    ASSERT_GE(3, number);
+    for (size_t i = 0; i < number; ++i) {
+      lines.emplace_back(records[i].begin, records[i].end);
+    }
+  }
+  EXPECT_EQ(0, number);
+  EXPECT_EQ(expected, lines);
+  // Each call passes not more than the budget and one record.
+  EXPECT_LE(content.size() / (32 + 7), calls);
+
+  // Records of the batch, which reaches the file end, are valid, the file is
+  // closed by the next call.
+  reader.Close();
+  LogReader::SetFileCacheSize(0);
+  ASSERT_TRUE(reader.Open(file.GetPath()));
+  ASSERT_TRUE(reader.SetFilter("abc 9*"));
+  ASSERT_TRUE(reader.GetNextRecords(records, 3, 0, number));
+  ASSERT_EQ(1, number);
+  EXPECT_EQ("abc 90", std::string(records[0].begin, records[0].end));
+  EXPECT_FALSE(reader.GetNextRecords(records, 3, 0, number));
+  EXPECT_EQ(0, number);
+}
+
+TEST(LogReader, Index) {
+  // Blocks without "needle" are skipped, the found record crosses a block
+  // border.
+  const size_t blockSize = 1 << 20;
+  std::string content;
+  while (content.size() < 3 * blockSize - 3) {
+    content += "haystack " + std::to_string(content.size()) + "\n";
+  }
+  content.resize(3 * blockSize - 3);
+  content.back() = '\n';
+  content += "needle 1\n";
+  while (content.size() < 5 * blockSize) {
+    content += "haystack\n";
+  }
+  const LogFile file(content.c_str());
+  ASSERT_TRUE(LogReader::BuildIndex(file.GetPath()));
+  const auto indexPath = std::string(file.GetPath()) + ".lri";
+
+  LogReader reader;
+  reader.SetLineNumbering(true);
+  ASSERT_TRUE(reader.Open(file.GetPath()));
+  ASSERT_TRUE(reader.SetFilter("*needle*"));
+  LogReader::Record record;
+  ASSERT_TRUE(reader.GetNextRecord(record));
+  EXPECT_EQ("needle 1", std::string(record.begin, record.end));
+  EXPECT_EQ(content.find("needle"), record.offset);
+  EXPECT_EQ(std::count(content.begin(), content.begin() + record.offset, '\n') +
+                1,
+            record.line);
+  EXPECT_FALSE(reader.GetNextRecord(record));
+  LogReader::Stats stats;
+  if (reader.GetStats(stats)) {
+    EXPECT_LT(3 * blockSize, stats.bytesSkipped);
+    EXPECT_GT(2 * blockSize, stats.bytesScanned);
+  }
+  reader.Close();
+
+  // Each fixed string is checked.
+  ASSERT_TRUE(reader.Open(file.GetPath()));
+  ASSERT_TRUE(reader.SetFilter("ne?dle *"));
+  TestLines(reader, {"needle 1"});
+  reader.Close();
+  ASSERT_TRUE(reader.Open(file.GetPath()));
+  ASSERT_TRUE(reader.SetFilter("*needle 2*"));
+  TestLines(reader, {});
+  reader.Close();
+
+  DeleteFile(indexPath.c_str());
+
+  // Fixed strings of a line, which crosses a whole block, are in not
+  // neighbouring blocks.
+  content.assign(blockSize - 10, '\n');
+  content += "needle " + std::string(blockSize + 20, 'x') + " pin\n";
+  content.append(3 * blockSize, '\n');
+  const LogFile longLineFile(content.c_str());
+  ASSERT_TRUE(LogReader::BuildIndex(longLineFile.GetPath()));
+  ASSERT_TRUE(reader.Open(longLineFile.GetPath()));
+  ASSERT_TRUE(reader.SetFilter("needle *pin"));
+  ASSERT_TRUE(reader.GetNextRecord(record));
+  EXPECT_EQ(content.find("needle"), record.offset);
+  EXPECT_FALSE(reader.GetNextRecord(record));
+  reader.Close();
+  DeleteFile((std::string(longLineFile.GetPath()) + ".lri").c_str());
+}
+
+TEST(LogReader, FilterExpression) {
+  const LogFile file(
+      "ERROR: disk\nINFO: healthcheck\nERROR: healthcheck\nERROR: net\n");
+  LogReader reader;
+  ASSERT_TRUE(reader.Open(file.GetPath()));
+  ASSERT_TRUE(
+      reader.SetFilterExpression(R"("ERROR*" AND NOT "*healthcheck")"));
+  EXPECT_FALSE(reader.SetFilterExpression(R"("ERROR*" AND)"));
+  TestLines(reader, {"ERROR: disk", "ERROR: net"});
+}
+
+TEST(LogReader, Templates) {
+  const LogFile file(
+      "ERROR: job 1 failed\nINFO: job 2 done\nERROR: job 3 failed\n"
+      "ERROR: disk 0x1f\n");
+  LogReader reader;
+  ASSERT_TRUE(reader.Open(file.GetPath()));
+  ASSERT_TRUE(reader.SetFilter("ERROR*"));
+  ASSERT_TRUE(reader.AggregateTemplates());
+  LogReader other;
+  ASSERT_TRUE(other.Open(file.GetPath()));
+  ASSERT_TRUE(other.SetFilter("INFO*"));
+  ASSERT_TRUE(other.AggregateTemplates());
+  ASSERT_TRUE(reader.MergeTemplates(other));
+
+  LogReader::Template templates[2];
+  ASSERT_EQ(2, reader.GetTopTemplates(templates, 2));
+  EXPECT_EQ("ERROR: job <num> failed",
+            std::string(templates[0].begin, templates[0].end));
+  EXPECT_EQ(2, templates[0].recordsNumber);
+  EXPECT_EQ(1, templates[1].recordsNumber);
+
+  reader.ResetTemplates();
+  EXPECT_EQ(0, reader.GetTopTemplates(templates, 2));
+}
+
+TEST(LogReader, EstimateMatches) {
+  // Matched records are longer, so they get more samples.
+  std::string content;
+  for (auto i = 0; i < 2000; ++i) {
+    content += i % 10 ? "INFO: done\n"
+                      : "ERROR: failed with a long description of the error\n"
+                        "  at a continuation line\n";
+  }
+  const LogFile file(content.c_str());
+  LogReader reader;
+  reader.SetSamplingSeed(42);
+  ASSERT_TRUE(reader.Open(file.GetPath()));
+  ASSERT_TRUE(reader.SetFilter("ERROR*"));
+  LogReader::Estimate estimate;
+  EXPECT_FALSE(reader.EstimateMatches(0, estimate));
+  ASSERT_TRUE(reader.EstimateMatches(4000, estimate));
+  EXPECT_EQ(4000, estimate.samplesNumber);
+  EXPECT_NEAR(2200, estimate.recordsNumber, 2200 * 0.2);
+  EXPECT_NEAR(200, estimate.matchesNumber, 200 * 0.3);
+  EXPECT_LE(estimate.matchesLowerBound, estimate.matchesNumber);
+  EXPECT_GE(estimate.matchesUpperBound, estimate.matchesNumber);
+  EXPECT_LT(estimate.matchesLowerBound, estimate.matchesUpperBound);
+  // The same seed gives the same samples.
+  LogReader::Estimate sameEstimate;
+  ASSERT_TRUE(reader.EstimateMatches(4000, sameEstimate));
+  EXPECT_EQ(estimate.recordsNumber, sameEstimate.recordsNumber);
+  EXPECT_EQ(estimate.matchesNumber, sameEstimate.matchesNumber);
+
+  ASSERT_TRUE(reader.SetRecordStart("?????: "));
+  ASSERT_TRUE(reader.EstimateMatches(4000, estimate));
+  EXPECT_NEAR(2000, estimate.recordsNumber, 2000 * 0.2);
+  EXPECT_NEAR(200, estimate.matchesNumber, 200 * 0.3);
+
+  // Sampling doesn't move the reading position.
+  size_t number = 0;
+  LogReader::Record record;
+  while (reader.GetNextRecord(record)) {
+    ++number;
+  }
+  EXPECT_EQ(200, number);
+
+  // Samples in a record, which is longer than 2 MB, are missed, the record
+  // is not read whole for each sample.
+  const LogFile longRecordFile(
+      ("ERROR: " + std::string(3 * 1024 * 1024, 'x') + "\n").c_str());
+  reader.Close();
+  ASSERT_TRUE(reader.Open(longRecordFile.GetPath()));
+  ASSERT_TRUE(reader.SetFilter("ERROR*"));
+  ASSERT_TRUE(reader.EstimateMatches(100, estimate));
+  EXPECT_EQ(0, estimate.recordsNumber);
+}
+
+TEST(LogReader, Captures) {
+  const LogFile file("1 ERROR [net] refused\n2 INFO [db] ok\n"
+                     "3 ERROR [db] timeout\n");
+  const auto &toString = [](const LogReader::Record &record) {
+    std::string result;
+    for (size_t i = 0; i < record.capturesNumber; ++i) {
+      result.append(record.captures[i].begin, record.captures[i].end);
+      result += "|";
+    }
+    return result;
+  };
+  const auto &read = [&](const char *filter, const bool isExpression,
+                         const size_t context, const bool isCached) {
+    LogReader reader;
+    EXPECT_TRUE(reader.Open(file.GetPath()));
+    EXPECT_TRUE(isExpression ? reader.SetFilterExpression(filter)
+                             : reader.SetFilter(filter));
+    EXPECT_TRUE(reader.SetContext(context, 0));
+    reader.SetResultCaching(isCached);
+    reader.SetCapturing(true);
+    std::string result;
+    LogReader::Record records[2];
+    size_t number;
+    while (reader.GetNextRecords(records, 2, 0, number)) {
+      for (size_t i = 0; i < number; ++i) {
+        result += toString(records[i]) + " ";
+      }
+    }
+    return result;
+  };
+  const std::string expected = "1|net|refused| 3|db|timeout| ";
+  EXPECT_EQ(expected, read("* ERROR [*] *", false, 0, false));
+  // Records are checked again after context records and from the cache.
+  EXPECT_EQ("1|net|refused|  3|db|timeout| ",
+            read("* ERROR [*] *", false, 1, false));
+  EXPECT_EQ(expected, read("* ERROR [*] *", false, 0, true));
+  EXPECT_EQ(expected, read("* ERROR [*] *", false, 0, true));
+  // Expressions of several masks have no captures.
+  EXPECT_EQ("1|[net] refused| 3|[db] timeout| ",
+            read("\"* ERROR *\"", true, 0, false));
+  EXPECT_EQ("  ", read("\"* ERROR *\" AND NOT \"*INFO*\"", true, 0, false));
+
+  LogReader reader;
+  ASSERT_TRUE(reader.Open(file.GetPath()));
+  ASSERT_TRUE(reader.SetFilter("* ERROR [*] *"));
+  LogReader::Record record;
+  ASSERT_TRUE(reader.GetNextRecord(record));
+  EXPECT_EQ(nullptr, record.captures);
+  EXPECT_EQ(0, record.capturesNumber);
+}
+
+TEST(LogReader, Archive) {
+  std::string content;
+  std::vector<std::string> expected;
+  for (auto i = 0; i < 100000; ++i) {
+    const auto line = "2019-04-26 10:00:00 record " + std::to_string(i) +
+                      (i % 1000 == 0 ? " ERROR" : " INFO ok");
+    content += line + "\n";
+    if (i % 1000 == 0) {
+      expected.emplace_back(line);
+    }
+  }
+  const LogFile file(content.c_str());
+  // Blocks of the archive are decompressed on access.
+  const LogFile archive("");
+  ASSERT_TRUE(LogReader::CompressFile(file.GetPath(), archive.GetPath()));
+  {
+    LogReader reader;
+    ASSERT_TRUE(reader.Open(archive.GetPath()));
+    ASSERT_TRUE(reader.SetFilter("* ERROR"));
+    TestLines(reader, expected);
+  }
+  {
+    LogReader reader;
+    ASSERT_TRUE(reader.Open(archive.GetPath()));
+    ASSERT_TRUE(reader.SetFilter("*"));
+    ASSERT_TRUE(
+        reader.SetTimeRange("2019-04-26 10:00:00", "2019-04-26 10:00:00"));
+    LogReader::Record record;
+    EXPECT_FALSE(reader.GetNextRecord(record));
+  }
+
+  // A file of log with the signature, but without valid header, is read as
+  // is.
+  const LogFile plain("LRZA and not compressed content of log\n");
+  LogReader reader;
+  ASSERT_TRUE(reader.Open(plain.GetPath()));
+  ASSERT_TRUE(reader.SetFilter("*"));
+  TestLines(reader, {"LRZA and not compressed content of log"});
+}
+
+TEST(MergedLogReader, Merge) {
+  const LogFile first(
+      "2019-04-25 10:00:01 a1\n"
+      "2019-04-25 10:00:03 a2\n"
+      "  continuation\n"
+      "2019-04-25 10:00:05 skipped\n"
+      "2019-04-25 10:00:07 a3\n");
+  const LogFile second(
+      "2019-04-25 10:00:00 b1\n"
+      "2019-04-25 10:00:03 b2\n"
+      "2019-04-25 10:00:06 b3\n");
+  MergedLogReader reader;
+  ASSERT_TRUE(reader.Open(first.GetPath(), "* a*"));
+  ASSERT_TRUE(reader.Open(second.GetPath(), nullptr));
+  EXPECT_FALSE(reader.Open("", nullptr));
+  ASSERT_EQ(2, reader.GetFilesNumber());
+  ASSERT_TRUE(reader.GetReader(0).SetRecordStart("2019-"));
+
+  std::vector<std::pair<size_t, std::string>> records;
+  LogReader::Record record;
+  size_t fileIndex;
+  while (reader.GetNextRecord(record, fileIndex)) {
+    records.emplace_back(fileIndex, std::string(record.begin, record.end));
+  }
+  EXPECT_EQ((std::vector<std::pair<size_t, std::string>>{
+                {1, "2019-04-25 10:00:00 b1"},
+                {0, "2019-04-25 10:00:01 a1"},
+                {0, "2019-04-25 10:00:03 a2\n  continuation"},
+                {1, "2019-04-25 10:00:03 b2"},
+                {1, "2019-04-25 10:00:06 b3"},
+                {0, "2019-04-25 10:00:07 a3"}}),
+            records);
+  EXPECT_FALSE(reader.Open(second.GetPath(), nullptr));
+
+  reader.Close();
+  EXPECT_EQ(0, reader.GetFilesNumber());
+  EXPECT_FALSE(reader.GetNextRecord(record, fileIndex));
+
+  // External reader is not destroyed by the merged reader.
+  LogReader external;
+  ASSERT_TRUE(external.SetFilter("*b?"));
+  ASSERT_TRUE(external.Open(second.GetPath()));
+  ASSERT_TRUE(reader.Open(external));
+  ASSERT_TRUE(reader.GetNextRecord(record, fileIndex));
+  EXPECT_EQ(0, fileIndex);
+  EXPECT_EQ(&external, &reader.GetReader(0));
+  reader.Close();
+  external.Close();
+  ASSERT_TRUE(external.Open(first.GetPath()));
+  EXPECT_FALSE(external.GetNextRecord(record));
+}
+
+TEST(MergedLogReader, TimeWithoutDate) {
+  // Time of day without date is not comparable with dated time, it gets the
+  // last known date, so the order is the same for any files order.
+  const LogFile first("2019-04-26 09:00 a1\n");
+  const LogFile second("2019-04-25 11:00 b1\n");
+  const LogFile third(
+      "10:00 c1\n"
+      "12:00 c2\n");
+  const std::vector<std::string> expected{"10:00 c1", "2019-04-25 11:00 b1",
+                                          "12:00 c2", "2019-04-26 09:00 a1"};
+  const LogFile *const orders[][3] = {{&first, &second, &third},
+                                      {&third, &first, &second},
+                                      {&second, &third, &first}};
+  for (const auto &files : orders) {
+    MergedLogReader reader;
+    for (const auto *file : files) {
+      ASSERT_TRUE(reader.Open(file->GetPath(), nullptr));
+    }
+    std::vector<std::string> records;
+    LogReader::Record record;
+    size_t fileIndex;
+    while (reader.GetNextRecord(record, fileIndex)) {
+      records.emplace_back(record.begin, record.end);
+    }
+    EXPECT_EQ(expected, records);
+  }
+}
+
+TEST(SharedScan, Queries) {
+  std::string content;
+  for (auto i = 0; i < 100; ++i) {
+    content += "record " + std::to_string(i) + "\n";
+  }
+  const LogFile file(content.c_str());
+  // Returns lines of numbers, which match, from the first number to the file
+  // end and from the file begin.
+  const auto &getLines = [](const std::function<bool(int)> &isMatched,
+                            const int first) {
+    std::vector<std::string> result;
+    for (auto i = first; i < first + 100; ++i) {
+      if (isMatched(i % 100)) {
+        result.emplace_back("record " + std::to_string(i % 100));
+      }
+    }
+    return result;
+  };
+
+  SharedScan scan;
+  ASSERT_TRUE(scan.Open(file.GetPath()));
+  EXPECT_FALSE(scan.SetUtf8(true));
+  size_t queries[4];
+  ASSERT_TRUE(scan.Attach("record 1?", false, queries[0]));
+  ASSERT_TRUE(scan.Attach("\"*2\" OR \"*3\"", true, queries[1]));
+  EXPECT_FALSE(scan.Attach("\"*2", true, queries[2]));
+  std::vector<std::string> lines[4];
+  LogReader::Record record;
+  // Records of other queries are kept for them while the query is read.
+  while (lines[0].size() < 5 &&
+         scan.GetNextRecord(queries[0], record)) {
+    lines[0].emplace_back(record.begin, record.end);
+  }
+  ASSERT_EQ("record 13", lines[0].back());
+  // Queries, which are attached after the scan start, get records from the
+  // file begin after the file end.
+  ASSERT_TRUE(scan.Attach("*5", false, queries[2]));
+  while (scan.GetNextRecord(queries[2], record)) {
+    lines[2].emplace_back(record.begin, record.end);
+    if (lines[2].size() == 5) {
+      ASSERT_TRUE(scan.Attach("*7", false, queries[3]));
+      EXPECT_EQ(3, queries[3]);
+    }
+  }
+  for (size_t i = 0; i < 4; ++i) {
+    while (scan.GetNextRecord(queries[i], record)) {
+      lines[i].emplace_back(record.begin, record.end);
+    }
+  }
+  for (const auto it : queries) {
+    EXPECT_TRUE(scan.IsCompleted(it));
+  }
+  EXPECT_EQ(getLines([](int i) { return i == 1 || i / 10 == 1; }, 0),
+            lines[0]);
+  EXPECT_EQ(getLines([](int i) { return i % 10 == 2 || i % 10 == 3; }, 0),
+            lines[1]);
+  EXPECT_EQ(getLines([](int i) { return i % 10 == 5; }, 14), lines[2]);
+  EXPECT_EQ(getLines([](int i) { return i % 10 == 7; }, 56), lines[3]);
+
+  // Detached query identifiers are reused.
+  scan.Detach(queries[1]);
+  size_t query;
+  ASSERT_TRUE(scan.Attach("*99", false, query));
+  EXPECT_EQ(queries[1], query);
+  ASSERT_TRUE(scan.GetNextRecord(query, record));
+  EXPECT_EQ("record 99", std::string(record.begin, record.end));
+  scan.Detach(query);
+  EXPECT_FALSE(scan.GetNextRecord(query, record));
+}
+
+TEST(SharedScan, Settings) {
+  const LogFile file(
+      "10:00 \xD0\xB0 first\n"
+      "  trace 1\n"
+      "10:01 b second\n"
+      "\n"
+      "  trace 2\n"
+      "10:02 \xD0\xB1 third\n");
+  SharedScan scan;
+  ASSERT_TRUE(scan.SetUtf8(true));
+  ASSERT_TRUE(scan.SetRecordStart("??:??"));
+  ASSERT_TRUE(scan.Open(file.GetPath()));
+  EXPECT_FALSE(scan.SetRecordStart(nullptr));
+  size_t numbered;
+  size_t captured;
+  ASSERT_TRUE(scan.Attach("* ? *", false, numbered));
+  ASSERT_TRUE(scan.Attach("* ? *", false, captured));
+  scan.SetLineNumbering(numbered, true);
+  ASSERT_TRUE(scan.SetCapturing(captured, true));
+
+  LogReader::Record record;
+  std::vector<size_t> lines;
+  while (scan.GetNextRecord(numbered, record)) {
+    EXPECT_EQ(nullptr, record.captures);
+    lines.emplace_back(record.line);
+  }
+  EXPECT_EQ(std::vector<size_t>({1, 3, 6}), lines);
+
+  std::vector<std::string> symbols;
+  std::vector<std::string> records;
+  while (scan.GetNextRecord(captured, record)) {
+    EXPECT_EQ(0, record.line);
+    ASSERT_EQ(3, record.capturesNumber);
+    ASSERT_NE(nullptr, record.captures);
+    symbols.emplace_back(record.captures[1].begin, record.captures[1].end);
+    records.emplace_back(record.begin, record.end);
+  }
+  // "?" is one UTF-8 symbol, records have trace lines.
+  EXPECT_EQ(std::vector<std::string>({"\xD0\xB0", "b", "\xD0\xB1"}), symbols);
+  EXPECT_EQ(std::vector<std::string>({"10:00 \xD0\xB0 first\n  trace 1",
+                                      "10:01 b second\n\n  trace 2",
+                                      "10:02 \xD0\xB1 third"}),
+            records);
+}
+
+TEST(SharedScan, Threads) {
+  std::string content;
+  for (auto i = 0; i < 10000; ++i) {
+    content += "record " + std::to_string(i) + "\n";
+  }
+  const LogFile file(content.c_str());
+  SharedScan scan;
+  ASSERT_TRUE(scan.Open(file.GetPath()));
+  // Each query matches more records than a ring holds, so threads wait for
+  // each other.
+  const char *const filters[] = {"*", "*1*", "*2?", "record 9*"};
+  size_t queries[4];
+  for (size_t i = 0; i < 4; ++i) {
+    ASSERT_TRUE(scan.Attach(filters[i], false, queries[i]));
+  }
+  size_t numbers[4] = {};
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < 4; ++i) {
+    threads.emplace_back([&scan, &queries, &numbers, i]() {
+      LogReader::Record record;
+      while (scan.GetNextRecord(queries[i], record)) {
+        ++numbers[i];
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  for (size_t i = 0; i < 4; ++i) {
+    LogReader reader;
+    ASSERT_TRUE(reader.Open(file.GetPath()));
+    ASSERT_TRUE(reader.SetFilter(filters[i]));
+    LogReader::Record record;
+    size_t number = 0;
+    while (reader.GetNextRecord(record)) {
+      ++number;
+    }
+    EXPECT_EQ(number, numbers[i]) << filters[i];
+  }
+}
+
+TEST(SharedScan, ArchiveThreads) {
+  std::string content;
+  for (auto i = 0; i < 100000; ++i) {
+    content += "2019-04-26 10:00:00 record " + std::to_string(i) + "\n";
+  }
+  const LogFile file(content.c_str());
+  // The archive has several blocks, which are locked by the scan, so
+  // records, which are kept for other queries, stay readable.
+  const LogFile archive("");
+  ASSERT_TRUE(LogReader::CompressFile(file.GetPath(), archive.GetPath()));
+  SharedScan scan;
+  ASSERT_TRUE(scan.Open(archive.GetPath()));
+  const char *const filters[] = {"*", "*1*", "*2?", "* record 9*"};
+  size_t queries[4];
+  for (size_t i = 0; i < 4; ++i) {
+    ASSERT_TRUE(scan.Attach(filters[i], false, queries[i]));
+  }
+  std::string results[4];
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < 4; ++i) {
+    threads.emplace_back([&scan, &queries, &results, i]() {
+      LogReader::Record record;
+      while (scan.GetNextRecord(queries[i], record)) {
+        results[i].append(record.begin, record.end);
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  for (size_t i = 0; i < 4; ++i) {
+    LogReader reader;
+    ASSERT_TRUE(reader.Open(file.GetPath()));
+    ASSERT_TRUE(reader.SetFilter(filters[i]));
+    LogReader::Record record;
+    std::string expected;
+    while (reader.GetNextRecord(record)) {
+      expected.append(record.begin, record.end);
+    }
+    EXPECT_FALSE(expected.empty()) << filters[i];
+    EXPECT_TRUE(expected == results[i]) << filters[i];
+  }
+}
@@ -199,3 +199,196 @@ TEST(MaskMatcher, Regress) {
             "-he never used them, by the way--and his mind is perfectly clear.",
             true);
 }
+
+TEST(MaskMatcher, PathologicalMasks) {
+  const std::string content(10000, 'a');
+  for (const auto &mask : {"*a*a*a*a*a*a*a*a*b", "*a?a?a?a?a?a?a?a?b",
+                           "a*a*a*a*a*a*a*a*a*a*ab", "*?a?a?a?a?a?a?a?a?b*"}) {
+    MaskMatcher matcher;
+    ASSERT_TRUE(matcher.Compile(mask));
+    // Each branch is checked once, so steps are limited by the content length
+    // multiplied by the mask length.
+    const auto limit = 4 * strlen(mask) * (content.size() + 1);
+    matcher.SetStepsLimit(limit);
+    EXPECT_FALSE(matcher.Match(content.data(), content.data() + content.size()))
+        << mask;
+    EXPECT_FALSE(matcher.IsAborted()) << mask;
+    EXPECT_GE(limit, matcher.GetStepsNumber()) << mask;
+    const auto matched = content + "b";
+    EXPECT_TRUE(matcher.Match(matched.data(), matched.data() + matched.size()))
+        << mask;
+  }
+}
+
+TEST(MaskMatcher, StepsLimit) {
+  // "b" is before "a", so the content isn't rejected by required symbols.
+  const std::string content = "b" + std::string(1000, 'a') + "c";
+  MaskMatcher matcher;
+  ASSERT_TRUE(matcher.Compile("*a*a*a*b*c"));
+  matcher.SetStepsLimit(100);
+  EXPECT_FALSE(matcher.Match(content.data(), content.data() + content.size()));
+  EXPECT_TRUE(matcher.IsAborted());
+  TestMatch(matcher, "aaabc", true);
+  EXPECT_FALSE(matcher.IsAborted());
+  matcher.SetStepsLimit(0);
+  EXPECT_FALSE(matcher.Match(content.data(), content.data() + content.size()));
+  EXPECT_FALSE(matcher.IsAborted());
+}
+
+TEST(MaskMatcher, FuzzerRegress) {
+  MaskMatcher matcher;
+  // "?" after "*" must not turn the next "?" into a replacement of "*".
+  EXPECT_TRUE(matcher.Compile("*??"));
+  TestMatch(matcher, "bbba", true);
+  EXPECT_TRUE(matcher.Compile("*ab*???"));
+  TestMatch(matcher, "ab\\baba\\\\", true);
+  // Length of "?" block must not include previous blocks.
+  EXPECT_TRUE(matcher.Compile("?x??"));
+  TestMatch(matcher, "x", true);
+  TestMatch(matcher, "axbc", true);
+  TestMatch(matcher, "axbcd", false);
+  TestMatch(matcher, "abxc", false);
+}
+
+TEST(MaskMatcher, AnchoredFixedStrings) {
+  MaskMatcher matcher;
+  ASSERT_TRUE(matcher.Compile("abc*xyz"));
+  TestMatch(matcher, "abcxyz", true);
+  TestMatch(matcher, "abc-xyz", true);
+  TestMatch(matcher, "abcxy", false);
+  TestMatch(matcher, "abxyz", false);
+  TestMatch(matcher, "abcyz", false);
+  // Content is rejected by the prefix or the suffix without branches.
+  TestMatch(matcher, "xbc-xyz", false);
+  EXPECT_EQ(0, matcher.GetStepsNumber());
+  TestMatch(matcher, "abc-xyx", false);
+  EXPECT_EQ(0, matcher.GetStepsNumber());
+
+  ASSERT_TRUE(matcher.Compile("*abc"));
+  TestMatch(matcher, "abc", true);
+  TestMatch(matcher, "abcabc", true);
+  TestMatch(matcher, "abcab", false);
+  ASSERT_TRUE(matcher.Compile("abc?"));
+  TestMatch(matcher, "abc", true);
+  TestMatch(matcher, "abcd", true);
+  TestMatch(matcher, "abcde", false);
+  ASSERT_TRUE(matcher.Compile("abc"));
+  TestMatch(matcher, "abc", true);
+  TestMatch(matcher, "abcabc", false);
+  TestMatch(matcher, "ab", false);
+}
+
+TEST(MaskMatcher, Utf8) {
+  // Two-byte "Ж" and three-byte "€".
+  const std::string zhe = "\xD0\x96";
+  const std::string euro = "\xE2\x82\xAC";
+  MaskMatcher matcher;
+  ASSERT_TRUE(matcher.Compile("a?b"));
+  TestMatch(matcher, ("a" + zhe + "b").c_str(), false);
+  matcher.SetUtf8(true);
+  TestMatch(matcher, ("a" + zhe + "b").c_str(), true);
+  TestMatch(matcher, ("a" + euro + "b").c_str(), true);
+  TestMatch(matcher, ("a" + zhe + zhe + "b").c_str(), false);
+  TestMatch(matcher, "axb", true);
+  TestMatch(matcher, "ab", true);
+  TestMatch(matcher, "axxb", false);
+
+  ASSERT_TRUE(matcher.Compile("x??"));
+  TestMatch(matcher, ("x" + euro + zhe).c_str(), true);
+  TestMatch(matcher, ("x" + euro).c_str(), true);
+  TestMatch(matcher, ("x" + euro + zhe + "y").c_str(), false);
+
+  ASSERT_TRUE(matcher.Compile("*;??;*"));
+  TestMatch(matcher, (zhe + ";1" + euro + ";end").c_str(), true);
+  TestMatch(matcher, (";" + zhe + "12;").c_str(), false);
+  // Multi-byte symbols are found by SSE2 in the middle of long content.
+  const auto longPrefix = std::string(100, 'x') + "=";
+  const auto longSuffix = ";" + std::string(100, 'y');
+  ASSERT_TRUE(matcher.Compile("*=??;*"));
+  TestMatch(matcher, (longPrefix + zhe + zhe + longSuffix).c_str(), true);
+  TestMatch(matcher, (longPrefix + zhe + zhe + zhe + longSuffix).c_str(),
+            false);
+  TestMatch(matcher, (longPrefix + "ab" + longSuffix).c_str(), true);
+  TestMatch(matcher, (longPrefix + "abc" + longSuffix).c_str(), false);
+}
+
+TEST(MaskMatcher, Analysis) {
+  MaskMatcher matcher;
+  ASSERT_TRUE(matcher.Compile("ab?c??d"));
+  EXPECT_EQ(4, matcher.GetMinLen());
+  EXPECT_EQ(7, matcher.GetMaxLen());
+  matcher.SetUtf8(true);
+  EXPECT_EQ(16, matcher.GetMaxLen());
+  matcher.SetUtf8(false);
+  ASSERT_TRUE(matcher.Compile("*a*bc?"));
+  EXPECT_EQ(3, matcher.GetMinLen());
+  EXPECT_EQ(SIZE_MAX, matcher.GetMaxLen());
+  EXPECT_TRUE(matcher.IsRequired('a'));
+  EXPECT_TRUE(matcher.IsRequired('c'));
+  EXPECT_FALSE(matcher.IsRequired('d'));
+  EXPECT_FALSE(matcher.IsRequired('?'));
+
+  // Content is rejected by the length or by required symbols without
+  // branches.
+  ASSERT_TRUE(matcher.Compile("ab?c"));
+  TestMatch(matcher, "abxyc", false);
+  EXPECT_EQ(0, matcher.GetStepsNumber());
+  ASSERT_TRUE(matcher.Compile("x*Error*:*"));
+  const auto content = std::string(100, 'x') + "Warning: " +
+                       std::string(100, 'y');
+  TestMatch(matcher, content.c_str(), false);
+  EXPECT_EQ(0, matcher.GetStepsNumber());
+  TestMatch(matcher, (content + "Error:").c_str(), true);
+  TestMatch(matcher, "xError:", true);
+  TestMatch(matcher, "xErrr:", false);
+  EXPECT_EQ(0, matcher.GetStepsNumber());
+}
+
+namespace {
+std::vector<std::string> Capture(const MaskMatcher &matcher,
+                                 const std::string &content) {
+  std::vector<Span> spans(matcher.GetCapturesNumber());
+  std::vector<std::string> result;
+  if (!matcher.Match(content.c_str(), content.c_str() + content.size(),
+                     spans.data())) {
+    return result;
+  }
+  for (const auto &span : spans) {
+    result.emplace_back(span.begin, span.end);
+  }
+  return result;
+}
+}  // namespace
+
+TEST(MaskMatcher, Captures) {
+  MaskMatcher matcher;
+  using Parts = std::vector<std::string>;
+
+  ASSERT_TRUE(matcher.Compile("* ERROR [*] *"));
+  EXPECT_EQ(3, matcher.GetCapturesNumber());
+  EXPECT_EQ(Parts({"10:00", "net", "refused"}),
+            Capture(matcher, "10:00 ERROR [net] refused"));
+  EXPECT_EQ(Parts({"", "a", "[b] "}), Capture(matcher, " ERROR [a] [b] "));
+  EXPECT_EQ(Parts(), Capture(matcher, "10:00 INFO [net] ok"));
+
+  // Groups of "?" and of mixed symbols.
+  ASSERT_TRUE(matcher.Compile("id=??;*?x"));
+  EXPECT_EQ(2, matcher.GetCapturesNumber());
+  EXPECT_EQ(Parts({"42", "abc"}), Capture(matcher, "id=42;abcx"));
+  EXPECT_EQ(Parts({"4", "ab"}), Capture(matcher, "id=4;abx"));
+  EXPECT_EQ(Parts({"42", ""}), Capture(matcher, "id=42;x"));
+  EXPECT_EQ(Parts(), Capture(matcher, "id=42;"));
+
+  // Empty groups at the content end and the last greedy group.
+  ASSERT_TRUE(matcher.Compile("a*b*"));
+  EXPECT_EQ(Parts({"xx", ""}), Capture(matcher, "axxb"));
+  EXPECT_EQ(Parts({"", "bc"}), Capture(matcher, "abbc"));
+  ASSERT_TRUE(matcher.Compile("*"));
+  EXPECT_EQ(Parts({""}), Capture(matcher, ""));
+  EXPECT_EQ(Parts({"abc"}), Capture(matcher, "abc"));
+
+  // Mask without groups.
+  ASSERT_TRUE(matcher.Compile("abc"));
+  EXPECT_EQ(0, matcher.GetCapturesNumber());
+  EXPECT_TRUE(matcher.Match("abc", "abc" + 3, nullptr));
+}
@@ -1,11 +1,19 @@
-//
+﻿//
 //    Created: 2019/03/30 13:56
 //     Author: Eugene V. Palchukovsky
 //     E-mail: eugene@palchukovsky.com
 
 #pragma once
 
+#include <Windows.h>
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
 
 #pragma comment(lib, "gmock.lib")
@@ -0,0 +1,88 @@
+﻿//
+//    Created: 2019/04/24 22:10
+//     Author: Eugene V. Palchukovsky
+//     E-mail: eugene@palchukovsky.com
+//
+
+#include "Prec.hpp"
+#include "LogReader/Templates.hpp"
+
+using namespace logReader;
+using namespace testing;
+
+namespace {
+
+std::string Normalize(const std::string &string) {
+  std::vector<char> buffer(string.size() * Templates::maxExpansion + 1);
+  return std::string(
+      buffer.data(), Templates::Normalize(string.data(),
+                                          string.data() + string.size(),
+                                          buffer.data()));
+}
+
+std::vector<std::pair<std::string, uint64_t>> GetTop(
+    const Templates &templates, const size_t size) {
+  std::vector<const Templates::Template *> top(size);
+  top.resize(templates.GetTop(top.data(), top.size()));
+  std::vector<std::pair<std::string, uint64_t>> result;
+  for (const auto &item : top) {
+    result.emplace_back(std::string(item->text, item->len), item->count);
+  }
+  return result;
+}
+
+void Add(Templates &templates, const std::string &string) {
+  EXPECT_TRUE(templates.Add(string.data(), string.data() + string.size()));
+}
+
+}  // namespace
+
+TEST(Templates, Normalize) {
+  EXPECT_EQ("", Normalize(""));
+  EXPECT_EQ("no digits", Normalize("no digits"));
+  EXPECT_EQ("<num>", Normalize("1"));
+  EXPECT_EQ("user<num> took <num>.<num> ms",
+            Normalize("user42 took 15.25 ms"));
+  EXPECT_EQ("ptr <hex>, id <hex>, word deadbeef",
+            Normalize("ptr 0x7fFF1a, id 12ab34cd56, word deadbeef"));
+  EXPECT_EQ("request <uuid> done",
+            Normalize("request 123e4567-e89b-12d3-a456-426655440000 done"));
+  EXPECT_EQ("x<num>e<num>-e<num>b-<num>d<num>",
+            Normalize("x123e4567-e89b-12d3"));
+  // Long content is copied by chunks and hex letters before digits are taken
+  // back from a copied chunk.
+  const std::string text(30, 't');
+  EXPECT_EQ(text + " <hex> " + text + " <uuid>",
+            Normalize(text + " abcdefabcdef12 " + text +
+                      " ABCDEFAB-1234-1234-1234-1234567890AB"));
+}
+
+TEST(Templates, Count) {
+  Templates templates;
+  for (auto i = 0; i < 1000; ++i) {
+    Add(templates, "connection " + std::to_string(i) + " closed");
+    if (i % 2) {
+      Add(templates, "request " + std::to_string(i) + " failed");
+    }
+    if (i % 100 == 0) {
+      Add(templates, "unique text " + std::string(i / 100, 'x'));
+    }
+  }
+  EXPECT_EQ(12, templates.GetSize());
+  EXPECT_THAT(GetTop(templates, 2),
+              ElementsAre(Pair("connection <num> closed", 1000),
+                          Pair("request <num> failed", 500)));
+
+  Templates other;
+  Add(other, "request 1 failed");
+  Add(other, "other");
+  ASSERT_TRUE(templates.Merge(other));
+  EXPECT_EQ(13, templates.GetSize());
+  EXPECT_THAT(GetTop(templates, 2),
+              ElementsAre(Pair("connection <num> closed", 1000),
+                          Pair("request <num> failed", 501)));
+
+  templates.Reset();
+  EXPECT_EQ(0, templates.GetSize());
+  EXPECT_TRUE(GetTop(templates, 2).empty());
+}
@@ -0,0 +1,51 @@
+﻿//
+//    Created: 2019/04/13 13:02
+//     Author: Eugene V. Palchukovsky
+//     E-mail: eugene@palchukovsky.com
+//
+
+#include "Prec.hpp"
+#include "LogReader/Timestamp.hpp"
+
+using namespace logReader;
+using namespace testing;
+
+namespace {
+bool Parse(Timestamp &timestamp, const char *string) {
+  return timestamp.Parse(string, string + strlen(string));
+}
+}  // namespace
+
+TEST(Timestamp, Formats) {
+  Timestamp timestamp;
+  EXPECT_TRUE(Parse(timestamp, "2019-04-13 10:00:00.123 INFO started"));
+  EXPECT_TRUE(Parse(timestamp, "2019/04/13T10:00:00,123456 INFO started"));
+  EXPECT_TRUE(Parse(timestamp, "[2019-04-13 10:00] INFO started"));
+  EXPECT_TRUE(Parse(timestamp, "10:00:00 INFO started"));
+  EXPECT_TRUE(Parse(timestamp, "10:00"));
+  EXPECT_FALSE(Parse(timestamp, ""));
+  EXPECT_FALSE(Parse(timestamp, "INFO 10:00:00"));
+  EXPECT_FALSE(Parse(timestamp, "\tat com.foo.Bar(Bar.java:10)"));
+  EXPECT_FALSE(Parse(timestamp, "2019-04-13"));
+  EXPECT_FALSE(Parse(timestamp, "25:00:00"));
+  EXPECT_FALSE(Parse(timestamp, "10:60:00"));
+  EXPECT_FALSE(Parse(timestamp, "1:00:00"));
+}
+
+TEST(Timestamp, Compare) {
+  Timestamp a;
+  Timestamp b;
+  ASSERT_TRUE(Parse(a, "2019-04-13 10:00:00.5"));
+  ASSERT_TRUE(Parse(b, "2019-04-13 10:00:00.6"));
+  EXPECT_TRUE(a < b);
+  EXPECT_FALSE(b < a);
+
+  ASSERT_TRUE(Parse(b, "2019-04-12 23:00:00"));
+  EXPECT_TRUE(b < a);
+
+  // Without date only time of day is compared.
+  ASSERT_TRUE(Parse(b, "23:00"));
+  EXPECT_TRUE(a < b);
+  ASSERT_TRUE(Parse(b, "10:00:00.500"));
+  EXPECT_EQ(0, a.Compare(b));
+}